@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include <math.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+
+/* one DMA buffer worth of sc16 */
+#define BUF_SIZE 8192
+#define NITER 20000
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	int err;
+
+	err = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (err) {
+		log_crit(__func__, "failed to get time");
+	}
+
+	return ((uint64_t)ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static const char *impls[] = { "scalar", "ssse3", "avx2", "neon" };
+
+enum kernel {
+	SC16_TO_FC32,
+	SC16_TO_FC32_BSWAP,
+	FC32_TO_SC16,
+	SC16_TO_SC8,
+	SC8_TO_SC16,
+	SC12_TO_SC16,
+	SC16_TO_SC12,
+	NKERNELS,
+};
+
+static const char *names[NKERNELS] = {
+	"sc16->fc32", "sc16be->fc32", "fc32->sc16", "sc16->sc8",
+	"sc8->sc16", "sc12->sc16", "sc16->sc12",
+};
+
+/* bytes per complex sample on the output side */
+static const size_t out_size[NKERNELS] = { 8, 8, 4, 2, 4, 4, 3 };
+
+static int16_t *sc16;
+static float *fc32;
+static int8_t *sc8;
+static uint8_t *sc12;
+
+static void convert(enum kernel k, void *out, size_t n)
+{
+	switch (k) {
+	case SC16_TO_FC32:
+		liberio_convert_sc16_to_fc32(out, sc16, n, 1.0f / 32768, 0);
+		break;
+	case SC16_TO_FC32_BSWAP:
+		liberio_convert_sc16_to_fc32(out, sc16, n, 1.0f / 32768,
+					     LIBERIO_CONVERT_BSWAP);
+		break;
+	case FC32_TO_SC16:
+		liberio_convert_fc32_to_sc16(out, fc32, n, 32767.0f, 0);
+		break;
+	case SC16_TO_SC8:
+		liberio_convert_sc16_to_sc8(out, sc16, n, 0);
+		break;
+	case SC8_TO_SC16:
+		liberio_convert_sc8_to_sc16(out, sc8, n, 0);
+		break;
+	case SC12_TO_SC16:
+		liberio_convert_sc12_to_sc16(out, sc12, n);
+		break;
+	case SC16_TO_SC12:
+		liberio_convert_sc16_to_sc12(out, sc16, n);
+		break;
+	default:
+		break;
+	}
+}
+
+/* ties, values just below them and NaN, at scale 1.0 */
+static const float edges[] = {
+	0.5f, 1.5f, 2.5f, -0.5f, -1.5f, -2.5f, 0.49999997f, -0.49999997f,
+	32766.5f, -32767.5f, 40000.0f, -40000.0f, NAN, -NAN, INFINITY,
+	-INFINITY,
+};
+
+/* fc32->sc16 has to agree with the scalar kernel on the edge cases too */
+static int check_edges(const char *impl)
+{
+	size_t n = sizeof(edges) / sizeof(edges[0]) / 2;
+	int16_t out[sizeof(edges) / sizeof(edges[0])];
+	int16_t ref[sizeof(edges) / sizeof(edges[0])];
+
+	liberio_convert_set_impl("scalar");
+	liberio_convert_fc32_to_sc16(ref, edges, n, 1.0f, 0);
+	liberio_convert_set_impl(impl);
+	liberio_convert_fc32_to_sc16(out, edges, n, 1.0f, 0);
+
+	return memcmp(out, ref, sizeof(out));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s size] [-n iterations]\n"
+		"  -s  sc16 buffer size in bytes (default %d)\n"
+		"  -n  conversions per kernel (default %d)\n",
+		prog, BUF_SIZE, NITER);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = BUF_SIZE, niter = NITER, n, i, k, j;
+	uint8_t *out, *ref;
+	uint64_t start, end;
+	double secs;
+	int mismatch = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:n:h")) != -1) {
+		switch (c) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			niter = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	n = size / (2 * sizeof(int16_t));
+	if (!n || !niter) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	sc16 = malloc(n * 4);
+	fc32 = malloc(n * 8);
+	sc8 = malloc(n * 2);
+	sc12 = malloc(n * 3);
+	out = malloc(n * 8);
+	ref = malloc(n * 8);
+	if (!sc16 || !fc32 || !sc8 || !sc12 || !out || !ref) {
+		log_crit(__func__, "failed to allocate buffers");
+		return EXIT_FAILURE;
+	}
+
+	/* floats past +-1.0 so saturation gets checked too */
+	srand(42);
+	for (i = 0; i < 2 * n; i++) {
+		sc16[i] = rand();
+		fc32[i] = (float)rand() / RAND_MAX * 2.4f - 1.2f;
+		sc8[i] = rand();
+	}
+	for (i = 0; i < 3 * n; i++)
+		sc12[i] = rand();
+
+	log_info(__func__, "%zu samples per conversion, default kernels: %s",
+		 n, liberio_convert_get_impl());
+
+	for (k = 0; k < NKERNELS; k++) {
+		liberio_convert_set_impl("scalar");
+		convert(k, ref, n);
+
+		for (j = 0; j < sizeof(impls) / sizeof(impls[0]); j++) {
+			if (liberio_convert_set_impl(impls[j]))
+				continue;
+
+			memset(out, 0, n * out_size[k]);
+			convert(k, out, n);
+			if (memcmp(out, ref, n * out_size[k]))
+				mismatch = 1;
+
+			if (k == FC32_TO_SC16 && check_edges(impls[j])) {
+				log_crit(__func__, "%s differs on edge cases",
+					 impls[j]);
+				mismatch = 1;
+			}
+
+			start = get_time();
+			for (i = 0; i < niter; i++)
+				convert(k, out, n);
+			end = get_time();
+
+			secs = (double)(end - start) / 1e9;
+			printf("%-13s %-7s %8.1f Msamples/s %6.2f GB/s %s\n",
+			       names[k], impls[j], n * niter / secs / 1e6,
+			       n * 4 * niter / secs / 1e9,
+			       memcmp(out, ref, n * out_size[k]) ?
+			       "MISMATCH" : "ok");
+		}
+	}
+
+	free(ref);
+	free(out);
+	free(sc12);
+	free(sc8);
+	free(fc32);
+	free(sc16);
+
+	return mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
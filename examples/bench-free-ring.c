@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <liberio/list.h>
+
+#include "../src/log.h"
+#include "../src/ring.h"
+
+#define NBUFS 128
+#define NITER 1000000
+#define MAX_THREADS 8
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	int err;
+
+	err = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (err) {
+		log_crit(__func__, "failed to get time");
+	}
+
+	return ((uint64_t)ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+/* the spinlock + list_head free list the ring replaced */
+struct node {
+	uint32_t index;
+	struct list_head node;
+};
+
+static struct node nodes[NBUFS];
+static struct list_head free_list;
+static pthread_spinlock_t lock;
+
+static struct liberio_ring *ring;
+
+/* set while a thread owns a buffer, catches double hand-outs */
+static int owned[NBUFS];
+static int errors;
+
+static void take(uint32_t idx)
+{
+	if (__atomic_exchange_n(&owned[idx], 1, __ATOMIC_ACQ_REL))
+		__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+}
+
+static void give(uint32_t idx)
+{
+	__atomic_store_n(&owned[idx], 0, __ATOMIC_RELEASE);
+}
+
+static void *run_list(void *arg)
+{
+	struct node *n;
+	size_t i;
+
+	for (i = 0; i < NITER; i++) {
+		pthread_spin_lock(&lock);
+		if (list_empty(&free_list)) {
+			pthread_spin_unlock(&lock);
+			continue;
+		}
+		n = list_first_entry(&free_list, struct node, node);
+		list_del(&n->node);
+		pthread_spin_unlock(&lock);
+
+		take(n->index);
+		give(n->index);
+
+		pthread_spin_lock(&lock);
+		list_add_tail(&n->node, &free_list);
+		pthread_spin_unlock(&lock);
+	}
+
+	return NULL;
+}
+
+static void *run_ring(void *arg)
+{
+	uint32_t idx;
+	size_t i;
+
+	for (i = 0; i < NITER; i++) {
+		if (liberio_ring_pop(ring, &idx))
+			continue;
+
+		take(idx);
+		give(idx);
+
+		if (liberio_ring_push(ring, idx))
+			__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static uint64_t run(void *(*fn)(void *), int nthreads)
+{
+	pthread_t threads[MAX_THREADS];
+	uint64_t start;
+	int i;
+
+	start = get_time();
+	for (i = 0; i < nthreads; i++)
+		pthread_create(threads + i, NULL, fn, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	return get_time() - start;
+}
+
+/*
+ * Hammer the free buffer queue from several threads, each popping a buffer
+ * and pushing it right back, once with the old spinlock protected list and
+ * once with the lock-free ring. Afterwards every buffer must be back in the
+ * queue exactly once and no buffer may have been handed out twice.
+ */
+int main(int argc, char *argv[])
+{
+	int seen[NBUFS];
+	uint64_t t_list, t_ring;
+	uint32_t idx;
+	int nthreads, i;
+
+	log_init(2, "bench-free-ring");
+
+	pthread_spin_init(&lock, 0);
+
+	for (nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+		INIT_LIST_HEAD(&free_list);
+		for (i = 0; i < NBUFS; i++) {
+			nodes[i].index = i;
+			list_add_tail(&nodes[i].node, &free_list);
+		}
+
+		ring = __liberio_ring_new(NBUFS);
+		if (!ring)
+			return EXIT_FAILURE;
+		for (i = 0; i < NBUFS; i++)
+			liberio_ring_push(ring, i);
+
+		t_list = run(run_list, nthreads);
+		t_ring = run(run_ring, nthreads);
+
+		memset(seen, 0, sizeof(seen));
+		for (i = 0; !liberio_ring_pop(ring, &idx); i++)
+			seen[idx]++;
+		for (i = 0; i < NBUFS; i++)
+			if (seen[i] != 1)
+				errors++;
+
+		log_info(__func__, "%d threads: spinlock %6.1f ns/op, ring %6.1f ns/op",
+			 nthreads,
+			 (double)t_list / ((double)NITER * nthreads),
+			 (double)t_ring / ((double)NITER * nthreads));
+
+		__liberio_ring_free(ring);
+	}
+
+	if (errors) {
+		log_crit(__func__, "%d errors", errors);
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
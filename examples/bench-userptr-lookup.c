@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+#include "../src/priv.h"
+
+#define NLOOKUPS (1 << 20)
+#define BUF_SIZE 4096
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	int err;
+
+	err = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (err) {
+		log_crit(__func__, "failed to get time");
+	}
+
+	return ((uint64_t)ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+/* the lookup liberio_chan_buf_dequeue() used to do */
+static struct liberio_buf *lookup_linear(struct liberio_chan *chan,
+					 unsigned long addr, size_t len)
+{
+	struct liberio_buf *buf = NULL;
+	size_t i;
+
+	for (i = 0; i < chan->nbufs; i++)
+		if (addr == (unsigned long)chan->bufs[i].mem
+		    && len == chan->bufs[i].len)
+			buf = chan->bufs + i;
+
+	return buf;
+}
+
+/*
+ * Time the USERPTR address -> descriptor lookup of a dequeue for pools of
+ * 8 up to 1024 buffers, hitting the buffers in a pseudo random order.
+ */
+int main(int argc, char *argv[])
+{
+	struct liberio_chan chan;
+	unsigned long *addrs;
+	uintptr_t base;
+	size_t nbufs, i;
+	uint64_t start, lin, idx;
+	uintptr_t sum = 0;
+	int err;
+
+	log_init(2, "bench-userptr-lookup");
+
+	addrs = malloc(NLOOKUPS * sizeof(*addrs));
+	if (!addrs)
+		return EXIT_FAILURE;
+
+	for (nbufs = 8; nbufs <= 1024; nbufs *= 2) {
+		memset(&chan, 0, sizeof(chan));
+		chan.mem_type = USRP_MEMORY_USERPTR;
+		chan.nbufs = nbufs;
+		chan.nbufs_alloc = nbufs;
+		chan.bufs = calloc(nbufs, sizeof(*chan.bufs));
+		if (!chan.bufs)
+			return EXIT_FAILURE;
+
+		/* the lookup never touches the memory, fake the addresses */
+		base = 0x40000000;
+		for (i = 0; i < nbufs; i++) {
+			chan.bufs[i].index = i;
+			chan.bufs[i].mem = (void *)(base + i * BUF_SIZE);
+			chan.bufs[i].len = BUF_SIZE;
+		}
+
+		err = __liberio_userptr_index_build(&chan);
+		if (err) {
+			log_crit(__func__, "failed to build index");
+			return EXIT_FAILURE;
+		}
+
+		srand(nbufs);
+		for (i = 0; i < NLOOKUPS; i++)
+			addrs[i] = base + (rand() % nbufs) * BUF_SIZE;
+
+		start = get_time();
+		for (i = 0; i < NLOOKUPS; i++)
+			sum += (uintptr_t)lookup_linear(&chan, addrs[i], BUF_SIZE);
+		lin = get_time() - start;
+
+		start = get_time();
+		for (i = 0; i < NLOOKUPS; i++)
+			sum += (uintptr_t)__liberio_userptr_index_lookup(&chan,
+									 addrs[i],
+									 BUF_SIZE);
+		idx = get_time() - start;
+
+		log_info(__func__, "%4zu bufs: linear %6.1f ns/lookup, index %6.1f ns/lookup",
+			 nbufs, (double)lin / NLOOKUPS, (double)idx / NLOOKUPS);
+
+		__liberio_userptr_index_free(&chan);
+		free(chan.bufs);
+	}
+
+	free(addrs);
+
+	return sum ? 0 : EXIT_FAILURE;
+}
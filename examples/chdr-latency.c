@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+
+#define NBUFS 32
+#define NITER 2000
+#define TIMEOUT 250000
+#define HYBRID_SPIN_US 50
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	int err;
+
+	err = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (err) {
+		log_crit(__func__, "failed to get time");
+	}
+
+	return ((uint64_t)ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static uint64_t get_cpu_time(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 * 1000 * 1000 +
+		((uint64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void fill_cmd(struct liberio_buf *buf)
+{
+	uint32_t *vals = liberio_buf_get_mem(buf, 0);
+
+	vals[0] = 0x00000250;
+	vals[1] = 0x80010010;
+	vals[2] = 0x00000000;
+	vals[3] = 0x0000007f;
+
+	liberio_buf_set_payload(buf, 0, 16);
+}
+
+/*
+ * Send a command packet, wait for its response and record the round trip,
+ * once per iteration, using the given wait mode on both channels.
+ */
+static int measure(struct liberio_chan *tx, struct liberio_chan *rx,
+		   const char *name, enum liberio_wait_mode mode,
+		   unsigned int spin_us)
+{
+	static uint64_t lat[NITER];
+	uint64_t start, end, cpu_start, cpu_end;
+	struct liberio_buf *buf;
+	size_t i;
+	int err;
+
+	err = liberio_chan_set_wait_mode(tx, mode, spin_us);
+	if (!err)
+		err = liberio_chan_set_wait_mode(rx, mode, spin_us);
+	if (err) {
+		log_warnx(__func__, "%s: not supported, skipping", name);
+		return 0;
+	}
+
+	/* start every run with all tx buffers back on the free list */
+	liberio_chan_request_buffers(tx, 0);
+	err = liberio_chan_request_buffers(tx, NBUFS);
+	if (err) {
+		log_crit(__func__, "failed to request tx buffers");
+		return err;
+	}
+
+	err = liberio_chan_enqueue_all(rx);
+	if (err) {
+		log_crit(__func__, "failed to enqueue rx buffers");
+		return err;
+	}
+
+	err = liberio_chan_start_streaming(rx);
+	if (!err)
+		err = liberio_chan_start_streaming(tx);
+	if (err) {
+		log_crit(__func__, "failed to start streaming");
+		goto out_stop;
+	}
+
+	cpu_start = get_cpu_time();
+	start = get_time();
+
+	for (i = 0; i < NITER; i++) {
+		uint64_t t0;
+
+		buf = liberio_chan_buf_dequeue(tx, TIMEOUT);
+		if (!buf) {
+			log_warn(__func__, "failed to get tx buffer");
+			err = -EIO;
+			goto out_stop;
+		}
+
+		fill_cmd(buf);
+
+		t0 = get_time();
+		err = liberio_chan_buf_enqueue(tx, buf);
+		if (err) {
+			log_warn(__func__, "failed to send command");
+			goto out_stop;
+		}
+
+		buf = liberio_chan_buf_dequeue(rx, TIMEOUT);
+		if (!buf) {
+			log_warn(__func__, "no response");
+			err = -EIO;
+			goto out_stop;
+		}
+		lat[i] = get_time() - t0;
+
+		err = liberio_chan_buf_enqueue(rx, buf);
+		if (err) {
+			log_warn(__func__, "failed to enqueue rx buffer");
+			goto out_stop;
+		}
+	}
+
+	end = get_time();
+	cpu_end = get_cpu_time();
+
+	qsort(lat, NITER, sizeof(lat[0]), cmp_u64);
+
+	log_info(__func__, "%s: p50 %" PRIu64 " ns, p99 %" PRIu64 " ns, max %" PRIu64
+		 " ns, cpu %.1f%%",
+		 name, lat[NITER / 2], lat[NITER * 99 / 100], lat[NITER - 1],
+		 100.0 * (double)(cpu_end - cpu_start) / (double)(end - start));
+
+out_stop:
+	liberio_chan_stop_streaming(tx);
+	liberio_chan_stop_streaming(rx);
+
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct liberio_chan *tx, *rx;
+	struct liberio_ctx *ctx;
+	int err = EXIT_FAILURE;
+
+	ctx = liberio_ctx_new();
+	if (!ctx)
+		return EXIT_FAILURE;
+
+	liberio_ctx_set_loglevel(ctx, 2);
+
+	tx = liberio_ctx_alloc_chan(ctx, "/dev/tx-dma0", TX, USRP_MEMORY_MMAP);
+	rx = liberio_ctx_alloc_chan(ctx, "/dev/rx-dma0", RX, USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	if (!tx || !rx)
+		goto out_free;
+
+	err = liberio_chan_request_buffers(rx, NBUFS);
+	if (err) {
+		log_crit(__func__, "failed to request buffers");
+		goto out_free;
+	}
+
+	err = measure(tx, rx, "block", LIBERIO_WAIT_BLOCK, 0);
+	if (!err)
+		err = measure(tx, rx, "poll", LIBERIO_WAIT_POLL, 0);
+	if (!err)
+		err = measure(tx, rx, "hybrid", LIBERIO_WAIT_HYBRID,
+			      HYBRID_SPIN_US);
+	if (!err)
+		err = measure(tx, rx, "uring", LIBERIO_WAIT_URING, 0);
+
+out_free:
+	if (tx)
+		liberio_chan_put(tx);
+	if (rx)
+		liberio_chan_put(rx);
+
+	return err;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+
+#define MIN_DEPTH 8
+#define MAX_DEPTH 1024
+#define NPER_DEPTH 20000
+#define WORK_US 5
+#define STALL_US 2000
+#define STALL_EVERY 1000
+
+/* emulated 8 KiB packets at 1 Gbit/s, one every ~65us */
+#define EMU_RATE 125000000
+#define BUF_SIZE 8192
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	int err;
+
+	err = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (err) {
+		log_crit(__func__, "failed to get time");
+	}
+
+	return ((uint64_t)ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static void busy_wait_us(uint64_t us)
+{
+	uint64_t end = get_time() + us * 1000;
+
+	while (get_time() < end)
+		;
+}
+
+/* CHDR sequence number, bits 59:48 of the 64 bit header */
+static uint16_t get_seqno(struct liberio_buf *buf)
+{
+	uint64_t hdr = *(uint64_t *)liberio_buf_get_mem(buf, 0);
+
+	return (hdr >> 48) & 0xfff;
+}
+
+/*
+ * Receive with a consumer that takes WORK_US per buffer and stalls for
+ * STALL_US every STALL_EVERY buffers, and count the buffers the hardware
+ * had to drop (gaps in the CHDR sequence numbers) for increasing queue
+ * depths. The pool gets grown while streaming, which the USRP DMA driver
+ * can't do, so against the hardware only the first depth gets measured.
+ * -E uses the emulated device instead.
+ */
+int main(int argc, char *argv[])
+{
+	struct liberio_emu_config cfg;
+	struct liberio_chan *chan;
+	struct liberio_ctx *ctx;
+	struct liberio_buf *buf;
+	size_t depth, old, i;
+	uint64_t overflows;
+	uint16_t seq, last = 0;
+	int first = 1;
+	int err;
+
+	ctx = liberio_ctx_new();
+	if (!ctx)
+		return EXIT_FAILURE;
+
+	liberio_ctx_set_loglevel(ctx, 2);
+
+	if (argc > 1 && !strcmp(argv[1], "-E")) {
+		memset(&cfg, 0, sizeof(cfg));
+		cfg.rate = EMU_RATE;
+		cfg.buf_size = BUF_SIZE;
+		liberio_ctx_use_emulator(ctx, &cfg);
+	}
+
+	chan = liberio_ctx_alloc_chan(ctx, "/dev/rx-dma0", RX,
+				      USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	if (!chan)
+		return EXIT_FAILURE;
+
+	liberio_chan_stop_streaming(chan);
+	liberio_chan_set_fixed_size(chan, 0, BUF_SIZE);
+
+	err = liberio_chan_request_buffers(chan, MIN_DEPTH);
+	if (err) {
+		log_crit(__func__, "failed to request buffers");
+		goto out_free;
+	}
+
+	err = liberio_chan_enqueue_all(chan);
+	if (!err)
+		err = liberio_chan_start_streaming(chan);
+	if (err) {
+		log_crit(__func__, "failed to start streaming");
+		goto out_free;
+	}
+
+	for (depth = MIN_DEPTH; depth <= MAX_DEPTH; depth *= 2) {
+		old = liberio_chan_get_num_bufs(chan);
+		if (depth > old) {
+			err = liberio_chan_resize_buffers(chan, depth);
+			if (err) {
+				log_warnx(__func__, "can't grow to %zu buffers (%d)",
+					  depth, err);
+				break;
+			}
+
+			/* new RX buffers start out with us */
+			for (i = old; i < depth; i++)
+				liberio_chan_buf_enqueue(chan,
+					liberio_chan_get_buf_at_index(chan, i));
+		}
+
+		overflows = 0;
+		for (i = 0; i < NPER_DEPTH; i++) {
+			buf = liberio_chan_buf_dequeue(chan, 1000000);
+			if (!buf) {
+				log_warn(__func__, "failed to get buffer");
+				err = -EIO;
+				goto out_stop;
+			}
+
+			seq = get_seqno(buf);
+			if (!first)
+				overflows += (seq - last - 1) & 0xfff;
+			last = seq;
+			first = 0;
+
+			busy_wait_us(WORK_US);
+			if (!(i % STALL_EVERY))
+				busy_wait_us(STALL_US);
+
+			liberio_chan_buf_enqueue(chan, buf);
+		}
+
+		log_info(__func__, "depth %4zu: %llu overflows in %u buffers",
+			 depth, (unsigned long long)overflows, NPER_DEPTH);
+	}
+
+out_stop:
+	liberio_chan_stop_streaming(chan);
+out_free:
+	liberio_chan_put(chan);
+
+	return err;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+
+#define NBUFS 32
+#define NITER 100000
+#define TIMEOUT 250000
+
+struct rx_state {
+	size_t count;
+	uint64_t bytes;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	int err;
+
+	err = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (err) {
+		log_crit(__func__, "failed to get time");
+	}
+
+	return ((uint64_t)ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static int rx_cb(struct liberio_chan *chan, struct liberio_buf *buf,
+		 void *priv)
+{
+	struct rx_state *state = priv;
+
+	state->bytes += liberio_buf_get_payload(buf, 0);
+
+	/* positive return value stops liberio_chan_run() */
+	return ++state->count >= NITER;
+}
+
+/*
+ * Receive NITER buffers through the RX callback, with the library doing
+ * all dequeueing and re-enqueueing.
+ */
+int main(int argc, char *argv[])
+{
+	struct rx_state state = { 0, 0 };
+	struct liberio_chan *chan;
+	struct liberio_ctx *ctx;
+	uint64_t start, end;
+	int err;
+
+	ctx = liberio_ctx_new();
+	if (!ctx)
+		return EXIT_FAILURE;
+
+	liberio_ctx_set_loglevel(ctx, 2);
+
+	chan = liberio_ctx_alloc_chan(ctx, "/dev/rx-dma0", RX,
+				      USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	if (!chan)
+		return EXIT_FAILURE;
+
+	err = liberio_chan_request_buffers(chan, NBUFS);
+	if (err) {
+		log_crit(__func__, "failed to request buffers");
+		goto out_free;
+	}
+
+	liberio_chan_set_rx_callback(chan, rx_cb, &state);
+
+	start = get_time();
+	err = liberio_chan_run(chan, TIMEOUT);
+	end = get_time();
+	if (err) {
+		log_crit(__func__, "streaming failed after %zu buffers (%d)",
+			 state.count, err);
+		goto out_free;
+	}
+
+	log_info(__func__, "Received %llu bytes in %zu buffers in %llu ns -> %f MB/s",
+		 (unsigned long long)state.bytes, state.count,
+		 (unsigned long long)(end - start),
+		 ((double)state.bytes / (double)(end - start) * 1e9) / 1024.0 / 1024.0);
+
+out_free:
+	liberio_chan_put(chan);
+
+	return err;
+}
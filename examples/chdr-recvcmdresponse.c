@@ -5,6 +5,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <sys/ioctl.h>
 #include <time.h>
 
@@ -13,8 +14,9 @@
 #include "../src/log.h"
 
 #define NBUFS 128
-#define NITER 250
-//#define NITER 3
+#define NITER 10000
+#define NBATCH 32
+#define NBATCH_MIN 8
 
 static uint64_t get_time(void)
 {
@@ -33,134 +35,153 @@ static void print_buf(struct liberio_buf *buf)
 {
 	uint64_t *vals = liberio_buf_get_mem(buf, 0);
 
-	log_debug(__func__, "-- Printing buffer %u --", liberio_buf_get_index(buf));
+	log_debug(__func__, "-- Printing buffer %zu --", liberio_buf_get_index(buf));
 
 	for (size_t i = 0; (i < 10) && (8*i < liberio_buf_get_len(buf, 0)); i++)
-		log_debug(__func__, "%08llx", vals[i]);
+		log_debug(__func__, "%08" PRIx64, vals[i]);
 
 	log_debug(__func__, "[...]");
 
 	for (size_t i = 500; (i < 512) && (8*i < liberio_buf_get_len(buf, 0)); i++)
-		log_debug(__func__, "%08llx", vals[i]);
+		log_debug(__func__, "%08" PRIx64, vals[i]);
 
 	//buf->valid_bytes = buf->len;
 }
 
-int main(int argc, char *argv[])
+static int stream_single(struct liberio_chan *chan, uint64_t *received)
 {
-	struct liberio_chan *chan;
-	struct liberio_ctx *ctx;
-	int fd;
+	struct liberio_buf *buf;
 	int err;
-	uint64_t received;
-	uint64_t start, end;
-	uint64_t last;
-	uint64_t *vals;
 
-	ctx = liberio_ctx_new();
-	if (!ctx)
-		return -1;
+	for (size_t i = 0; i < NITER; ++i) {
+		buf = liberio_chan_buf_dequeue(chan, -1);
+		if (!buf) {
+			log_warn(__func__, "failed to get buffer");
+			return -EIO;
+		}
 
-	liberio_ctx_set_loglevel(ctx, 3);
+		if (!i)
+			print_buf(buf);
+		*received += liberio_buf_get_payload(buf, 0);
 
-	chan = liberio_ctx_alloc_chan(ctx, "/dev/rx-dma0", RX,
-				      USRP_MEMORY_MMAP);
-	liberio_ctx_put(ctx);
-	if (!chan)
-		return EXIT_FAILURE;
+		err = liberio_chan_buf_enqueue(chan, buf);
+		if (err) {
+			log_warn(__func__, "failed to enqueue buffer");
+			return err;
+		}
+	}
 
-	liberio_chan_stop_streaming(chan);
-	liberio_chan_set_fixed_size(chan, 0, 8192);
+	return 0;
+}
 
-	err = liberio_chan_request_buffers(chan, NBUFS);
-	if (err < 0) {
-		log_crit(__func__, "failed to request buffers");
-		goto out_free;
-	}
+static int stream_batch(struct liberio_chan *chan, uint64_t *received)
+{
+	struct liberio_buf *bufs[NBATCH];
+	size_t done = 0;
+	int n, err;
+
+	while (done < NITER) {
+		n = liberio_chan_buf_dequeue_many(chan, bufs, NBATCH,
+						  NBATCH_MIN, -1);
+		if (n <= 0) {
+			log_warn(__func__, "failed to get buffers");
+			return n ? n : -EIO;
+		}
 
-	/* queue up all the buffers, as they start out owned
-	 * by the application ... */
+		if (!done)
+			print_buf(bufs[0]);
+
+		for (int i = 0; i < n; i++)
+			*received += liberio_buf_get_payload(bufs[i], 0);
 
-	for (size_t i = 0; i < liberio_chan_get_num_bufs(chan); i++) {
-		struct liberio_buf *buf =
-			liberio_chan_get_buf_at_index(chan, i);
-		/*
-		//printf("-- Queing up buffer %u\n", i);
-		err = liberio_buf_enqueue(chan, chan->bufs + i);
+		err = liberio_chan_buf_enqueue_many(chan, bufs, n, NULL);
 		if (err) {
-			log_warn(__func__, "failed to get buffer");
-			goto out_free;
+			log_warn(__func__, "failed to enqueue buffers");
+			return err;
 		}
-		*/
-		liberio_buf_set_payload(buf, 0, 16);
+
+		done += n;
 	}
 
-	log_info(__func__, "Starting streaming (%s)",
-		 liberio_chan_get_type(chan));
+	return 0;
+}
+
+static int measure(struct liberio_chan *chan, const char *name,
+		   int (*stream)(struct liberio_chan *, uint64_t *))
+{
+	uint64_t received = 0;
+	uint64_t start, end;
+	int err;
+
+	/* queue up all the buffers, as they start out owned
+	 * by the application ... */
+	err = liberio_chan_enqueue_all(chan);
+	if (err) {
+		log_crit(__func__, "failed to enqueue buffers");
+		return err;
+	}
+
+	log_info(__func__, "Starting streaming (%s, %s)",
+		 liberio_chan_get_type(chan), name);
 
 	err = liberio_chan_start_streaming(chan);
 	if (err) {
-		log_crit(__func__, "failed to start streaming\n");
-		goto out_free;
+		log_crit(__func__, "failed to start streaming");
+		return err;
 	}
 
-	received = 0;
 	start = get_time();
+	err = stream(chan, &received);
+	end = get_time();
 
-	for (size_t i = 0; i < NITER; ++i) {
-		struct liberio_buf *buf;
+	log_info(__func__, "Stopping streaming");
+	liberio_chan_stop_streaming(chan);
 
-		if (i < liberio_chan_get_num_bufs(chan))
-			liberio_chan_buf_enqueue(chan,
-						 liberio_chan_get_buf_at_index(chan, i));
+	log_info(__func__, "%s: Received %" PRIu64 " bytes in %" PRIu64
+		 " ns -> %f MB/s",
+	       name, received, (end - start),
+	       ((double) received / (double) (end-start) * 1e9) / 1024.0 / 1024.0);
 
-		buf = liberio_chan_buf_dequeue(chan, -1);
-		if (!buf) {
-			log_warn(__func__, "failed to get buffer");
-			goto out_free;
-		}
+	return err;
+}
 
-		print_buf(buf);
-		received += liberio_buf_get_len(buf, 0);
+int main(int argc, char *argv[])
+{
+	struct liberio_chan *chan;
+	struct liberio_ctx *ctx;
+	int err;
 
+	ctx = liberio_ctx_new();
+	if (!ctx)
+		return -1;
 
-		if (i < NITER - 1) {
-			err = liberio_chan_buf_enqueue(chan, buf);
-			if (err) {
-				log_warn(__func__, "failed to get buffer");
-				goto out_free;
-			}
-		}
-	}
+	liberio_ctx_set_loglevel(ctx, 3);
 
-	end = get_time();
+	chan = liberio_ctx_alloc_chan(ctx, "/dev/rx-dma0", RX,
+				      USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	if (!chan)
+		return EXIT_FAILURE;
 
-	log_info(__func__, "Stopping streaming");
-	err = liberio_chan_stop_streaming(chan);
-	if (err) {
-		log_crit(__func__, "failed to start streaming");
+	liberio_chan_stop_streaming(chan);
+	liberio_chan_set_fixed_size(chan, 0, 8192);
+
+	err = liberio_chan_request_buffers(chan, NBUFS);
+	if (err < 0) {
+		log_crit(__func__, "failed to request buffers");
 		goto out_free;
 	}
 
-	liberio_chan_put(chan);
-
-	log_info(__func__, "Received %llu bytes in %llu ns -> %f MB/s",
-	       received, (end - start),
-	       ((double) received / (double) (end-start) * 1e9) / 1024.0 / 1024.0);
+	/* one select() + DQBUF per buffer ... */
+	err = measure(chan, "single", stream_single);
+	if (err)
+		goto out_free;
 
-	return 0;
+	/* ... vs. draining everything that is ready after one wakeup */
+	err = measure(chan, "batch", stream_batch);
 
 out_free:
-out_close:
-	end = get_time();
-
-	liberio_chan_stop_streaming(chan);
 	liberio_chan_put(chan);
 
-	log_info(__func__, "Received %llu bytes in %llu ns -> %f MB/s",
-	       received, (end - start),
-	       ((double) received / (double) (end-start) * 1e9) / 1024.0 / 1024.0);
-
-
 	return err;
 }
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <sys/ioctl.h>
 #include <time.h>
+#include <getopt.h>
 
 #include <liberio/liberio.h>
 #include "../src/log.h"
@@ -15,8 +16,11 @@
 
 #define NBUFS 32
 #define NITER 250
-//#define NITER 1
+#define TIMEOUT 250000
 
+/* register write, SID 0x0250 */
+#define CMD_SID 0x00000250
+#define CMD_LEN 16
 
 static uint64_t get_time(void)
 {
@@ -35,108 +39,205 @@ static void fill_buf(struct liberio_buf *buf, uint16_t seqno)
 {
 	uint32_t *vals = liberio_buf_get_mem(buf, 0);
 
-	//printf("filling buffer %u\n", buf->index);
-       	vals[0]	= 0x00000250;
-	vals[1] = 0x80010010;
+	vals[0] = CMD_SID;
+	vals[1] = 0x80000000 | ((seqno & 0xfff) << 16) | CMD_LEN;
 	vals[2] = 0x00000000;
-       	vals[3] = 0x0000007f;
-	//vals[0] = 0x8001001000000230 | (((uint64_t) seqno & 0xFFF) << 48);
-	/*vals[0] = htonl(0x00000230);
-	vals[0] <<= 32;
-	vals[0] |= htonl(0x80000010 | ((seqno & 0xFFF) << 16));
-	vals[1] = htonl(0x0000007F);
-	vals[1] <<= 32;*/
-	//vals[1] = 127;
-
-	liberio_buf_set_payload(buf, 0, 16);
+	vals[3] = 0x0000007f;
+
+	liberio_buf_set_payload(buf, 0, CMD_LEN);
 }
 
-int main(int argc, char *argv[])
+/* the old way, a whole buffer and a QBUF per command */
+static int send_single(struct liberio_chan *chan, size_t count)
 {
-	struct liberio_chan *chan;
-	struct liberio_ctx *ctx;
-	int fd;
+	struct liberio_buf *buf;
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		buf = liberio_chan_buf_dequeue(chan, TIMEOUT);
+		if (!buf) {
+			log_warn(__func__, "failed to get buffer");
+			return -EAGAIN;
+		}
+
+		fill_buf(buf, i);
+
+		if (liberio_chan_buf_enqueue(chan, buf)) {
+			log_warn(__func__, "failed to enqueue buffer");
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+/* commands share buffers, a QBUF per @batch commands */
+static int send_packed(struct liberio_chan *chan, size_t count, size_t batch,
+		       unsigned int delay_us)
+{
+	struct liberio_chdr_packer_attr attr = {
+		.max_pkts = batch,
+		.max_delay_us = delay_us,
+	};
+	struct liberio_chdr_packer *packer;
+	struct liberio_chdr_pkt hdr;
+	const uint32_t payload[2] = { 0x00000000, 0x0000007f };
+	size_t i;
 	int err = 0;
-	uint64_t start, end;
-	uint64_t transmitted;
 
-	ctx = liberio_ctx_new();
-	if (!ctx)
-		return EXIT_FAILURE;
+	packer = liberio_chan_alloc_packer(chan, &attr);
+	if (!packer) {
+		log_crit(__func__, "failed to allocate packer");
+		return -ENOMEM;
+	}
 
-	liberio_ctx_set_loglevel(ctx, 3);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.type = LIBERIO_CHDR_CMD;
+	hdr.sid = CMD_SID;
 
-	chan = liberio_ctx_alloc_chan(ctx, "/dev/tx-dma0", TX,
-				     USRP_MEMORY_MMAP);
-	if (!chan)
-		return EXIT_FAILURE;
-	liberio_ctx_put(ctx);
+	for (i = 0; i < count; ++i) {
+		hdr.seq = i;
+
+		err = liberio_chdr_packer_add(packer, &hdr, payload,
+					      sizeof(payload), TIMEOUT);
+		if (err) {
+			log_warnx(__func__, "failed to add packet: %s",
+				  strerror(-err));
+			break;
+		}
+	}
+
+	liberio_chdr_packer_free(packer);
+
+	return err;
+}
+
+static int run(struct liberio_chan *chan, size_t count, size_t batch,
+	       unsigned int delay_us, double *pps)
+{
+	uint64_t start, end;
+	int err;
 
 	err = liberio_chan_request_buffers(chan, NBUFS);
 	if (err < 0) {
 		log_crit(__func__, "failed to request buffers");
-		goto out_free;
+		return err;
 	}
 
-	log_info(__func__, "Starting streaming (%s)",
-		 liberio_chan_get_type(chan));
-
 	err = liberio_chan_start_streaming(chan);
 	if (err) {
 		log_crit(__func__, "failed to start streaming");
-		goto out_free;
+		return err;
 	}
 
-	transmitted = 0;
 	start = get_time();
 
-//	for (size_t i = 0; i < NITER; ++i) {
-	size_t i = 0;
-		struct liberio_buf *buf;
-
-		/* buffers start out in dequeued state,
-		 * so first ctx->nbufs times we don't need to deq */
-		if (i >= liberio_chan_get_num_bufs(chan)) {
-			buf = liberio_chan_buf_dequeue(chan, 250000);
-			if (!buf) {
-				log_warn(__func__, "failed to get buffer");
-				goto out_free;
-			}
-		} else {
-			buf = liberio_chan_get_buf_at_index(chan, i);
+	if (batch)
+		err = send_packed(chan, count, batch, delay_us);
+	else
+		err = send_single(chan, count);
+
+	end = get_time();
+
+	liberio_chan_stop_streaming(chan);
+	liberio_chan_request_buffers(chan, 0);
+
+	*pps = (double)count / (double)(end - start) * 1e9;
+
+	return err;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n count] [-b batch] [-d delay_us] [-E]\n"
+		"  -n  commands to send (default %d)\n"
+		"  -b  commands per buffer, 1 for one buffer each, default\n"
+		"      compares one per buffer against 64 per buffer\n"
+		"  -d  flush a partly filled buffer after this many us\n"
+		"  -E  send to the emulated device\n", prog, NITER);
+}
+
+int main(int argc, char *argv[])
+{
+	struct liberio_emu_config cfg;
+	struct liberio_chan *chan;
+	struct liberio_ctx *ctx;
+	size_t count = NITER, batch = 0;
+	unsigned int delay_us = 0;
+	double single, packed;
+	int emulate = 0;
+	int err = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:b:d:Eh")) != -1) {
+		switch (c) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'E':
+			emulate = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
 		}
+	}
 
-		fill_buf(buf, i);
-		transmitted += liberio_buf_get_payload(buf, 0);
+	ctx = liberio_ctx_new();
+	if (!ctx)
+		return EXIT_FAILURE;
+
+	liberio_ctx_set_loglevel(ctx, 3);
 
-		err = liberio_chan_buf_enqueue(chan, buf);
+	if (emulate) {
+		memset(&cfg, 0, sizeof(cfg));
+		err = liberio_ctx_use_emulator(ctx, &cfg);
 		if (err) {
-			log_warn(__func__, "failed to get buffer");
-			goto out_free;
+			log_crit(__func__, "failed to set up the emulator");
+			liberio_ctx_put(ctx);
+			return EXIT_FAILURE;
 		}
-//	}
+	}
 
-	end = get_time();
+	chan = liberio_ctx_alloc_chan(ctx, "/dev/tx-dma0", TX,
+				     USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	if (!chan)
+		return EXIT_FAILURE;
 
-	log_info(__func__, "Stopping streaming");
-	err = liberio_chan_stop_streaming(chan);
-	if (err) {
-		log_crit(__func__, "failed to stop streaming");
-		goto out_free;
+	log_info(__func__, "Sending %zu commands (%s)", count,
+		 liberio_chan_get_type(chan));
+
+	if (batch) {
+		/* a batch of 1 still goes through the packer */
+		err = run(chan, count, batch, delay_us, &packed);
+		if (!err)
+			log_info(__func__, "%zu per buffer: %.0f commands/s",
+				 batch, packed);
+		goto out_put;
 	}
 
-	liberio_chan_put(chan);
+	err = run(chan, count, 0, 0, &single);
+	if (err)
+		goto out_put;
 
-	log_info(__func__, "Transmitted %llu bytes in %llu ns -> %f MB/s",
-	       transmitted, (end - start),
-	       ((double) transmitted / (double) (end-start) * 1e9) / 1024.0 / 1024.0);
+	err = run(chan, count, 64, delay_us, &packed);
+	if (err)
+		goto out_put;
 
-	return 0;
+	log_info(__func__, "1 per buffer: %.0f commands/s", single);
+	log_info(__func__, "64 per buffer: %.0f commands/s (%.1fx)", packed,
+		 packed / single);
 
-out_free:
-out_close:
-	liberio_chan_stop_streaming(chan);
+out_put:
 	liberio_chan_put(chan);
 
-	return err;
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
 }
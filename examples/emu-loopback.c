@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+
+#define NBUFS 8
+#define NPKTS 1000
+#define BUF_SIZE 4096
+#define PKT_LEN 1024
+
+static int errors;
+
+#define check(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			log_crit(__func__, __VA_ARGS__);	\
+			errors++;				\
+		}						\
+	} while (0)
+
+static struct liberio_ctx *new_ctx(uint64_t rate, int loopback)
+{
+	struct liberio_emu_config cfg;
+	struct liberio_ctx *ctx;
+
+	ctx = liberio_ctx_new();
+	if (!ctx)
+		return NULL;
+
+	liberio_ctx_set_loglevel(ctx, 2);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.rate = rate;
+	cfg.buf_size = BUF_SIZE;
+	cfg.loopback = loopback;
+
+	if (liberio_ctx_use_emulator(ctx, &cfg)) {
+		liberio_ctx_put(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static struct liberio_chan *new_chan(struct liberio_ctx *ctx,
+				     const char *file,
+				     enum liberio_direction dir,
+				     enum usrp_memory mem_type)
+{
+	struct liberio_chan *chan;
+	size_t i;
+	int fd, err;
+
+	chan = liberio_ctx_alloc_chan(ctx, file, dir, mem_type);
+	if (!chan)
+		return NULL;
+
+	if (mem_type == USRP_MEMORY_USERPTR)
+		liberio_chan_set_buf_size(chan, BUF_SIZE);
+
+	err = liberio_chan_request_buffers(chan, NBUFS);
+	if (err < 0)
+		goto out_put;
+
+	/* stand-in dma-bufs, the emulator maps whatever it gets */
+	for (i = 0; mem_type == USRP_MEMORY_DMABUF && i < NBUFS; i++) {
+		fd = liberio_dmabuf_alloc_memfd(BUF_SIZE);
+		if (fd < 0)
+			goto out_put;
+
+		err = liberio_chan_attach_dmabuf(chan, i, fd);
+		close(fd);
+		if (err)
+			goto out_put;
+	}
+
+	return chan;
+
+out_put:
+	liberio_chan_put(chan);
+	return NULL;
+}
+
+/* send NPKTS numbered packets from TX to RX and check what arrives */
+static void test_loopback(enum usrp_memory mem_type, const char *name)
+{
+	struct liberio_chan *tx, *rx;
+	struct liberio_emu_stats stats;
+	struct liberio_ctx *ctx;
+	struct liberio_buf *buf;
+	uint8_t *mem;
+	size_t i;
+
+	ctx = new_ctx(0, 1);
+	check(ctx, "%s: failed to set up emulator", name);
+	if (!ctx)
+		return;
+
+	rx = new_chan(ctx, "/dev/rx-dma0", RX, mem_type);
+	tx = new_chan(ctx, "/dev/tx-dma0", TX, mem_type);
+	liberio_ctx_put(ctx);
+	check(rx && tx, "%s: failed to set up channels", name);
+	if (!rx || !tx)
+		goto out_put;
+
+	check(!liberio_chan_enqueue_all(rx), "%s: RX enqueue failed", name);
+	check(!liberio_chan_start_streaming(rx), "%s: RX start failed", name);
+	check(!liberio_chan_start_streaming(tx), "%s: TX start failed", name);
+
+	for (i = 0; i < NPKTS; i++) {
+		buf = liberio_chan_buf_dequeue(tx, 100000);
+		check(buf, "%s: no TX buffer for packet %zu", name, i);
+		if (!buf)
+			break;
+
+		memset(liberio_buf_get_mem(buf, 0), i & 0xff, PKT_LEN);
+		liberio_buf_set_payload(buf, 0, PKT_LEN);
+		check(!liberio_chan_buf_enqueue(tx, buf),
+		      "%s: TX enqueue of packet %zu failed", name, i);
+
+		buf = liberio_chan_buf_dequeue(rx, 100000);
+		check(buf, "%s: packet %zu did not arrive", name, i);
+		if (!buf)
+			break;
+
+		mem = liberio_buf_get_mem(buf, 0);
+		check(liberio_buf_get_payload(buf, 0) == PKT_LEN
+		      && mem[0] == (i & 0xff) && mem[PKT_LEN - 1] == (i & 0xff),
+		      "%s: packet %zu arrived corrupted", name, i);
+		check(!liberio_chan_buf_enqueue(rx, buf),
+		      "%s: RX enqueue failed", name);
+	}
+
+	check(!liberio_chan_get_emu_stats(tx, &stats), "%s: no stats", name);
+	check(stats.packets == NPKTS, "%s: sent %llu of %d packets", name,
+	      (unsigned long long)stats.packets, NPKTS);
+	check(!stats.underflows, "%s: %llu underflows at unlimited rate",
+	      name, (unsigned long long)stats.underflows);
+
+	check(!liberio_chan_get_emu_stats(rx, &stats), "%s: no stats", name);
+	check(!stats.overflows, "%s: %llu overflows", name,
+	      (unsigned long long)stats.overflows);
+
+	log_info(__func__, "%s: %d packets looped back", name, NPKTS);
+
+out_put:
+	if (tx)
+		liberio_chan_put(tx);
+	if (rx)
+		liberio_chan_put(rx);
+}
+
+/* a rate limited link that goes idle between two buffers underflows */
+static void test_underflow(void)
+{
+	struct liberio_emu_stats stats;
+	struct liberio_chan *tx;
+	struct liberio_ctx *ctx;
+	struct liberio_buf *buf;
+	int i;
+
+	ctx = new_ctx(100000000, 0);
+	check(ctx, "failed to set up emulator");
+	if (!ctx)
+		return;
+
+	tx = new_chan(ctx, "/dev/tx-dma0", TX, USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	check(tx, "failed to set up channel");
+	if (!tx)
+		return;
+
+	check(!liberio_chan_start_streaming(tx), "TX start failed");
+
+	for (i = 0; i < 2; i++) {
+		buf = liberio_chan_buf_dequeue(tx, 100000);
+		check(buf, "no TX buffer");
+		if (!buf)
+			break;
+
+		liberio_buf_set_payload(buf, 0, PKT_LEN);
+		check(!liberio_chan_buf_enqueue(tx, buf), "TX enqueue failed");
+
+		/* ~10us on the wire, then let the link run dry */
+		usleep(10000);
+	}
+
+	check(!liberio_chan_get_emu_stats(tx, &stats), "no stats");
+	check(stats.underflows == 1, "%llu underflows, expected 1",
+	      (unsigned long long)stats.underflows);
+
+	liberio_chan_put(tx);
+}
+
+/* TX enqueue_all only queues what's on the free list */
+static void test_enqueue_all(void)
+{
+	struct liberio_buf *held[2];
+	struct liberio_emu_stats stats;
+	struct liberio_chan *tx;
+	struct liberio_ctx *ctx;
+	int i;
+
+	ctx = new_ctx(0, 0);
+	check(ctx, "failed to set up emulator");
+	if (!ctx)
+		return;
+
+	tx = new_chan(ctx, "/dev/tx-dma0", TX, USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	check(tx, "failed to set up channel");
+	if (!tx)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		held[i] = liberio_chan_buf_dequeue(tx, 0);
+		check(held[i], "no free TX buffer");
+		if (!held[i])
+			goto out_put;
+		liberio_buf_set_payload(held[i], 0, PKT_LEN);
+	}
+
+	check(!liberio_chan_enqueue_all(tx), "enqueue_all failed");
+	check(!liberio_chan_start_streaming(tx), "TX start failed");
+
+	for (i = 0; i < 2; i++)
+		check(!liberio_chan_buf_enqueue(tx, held[i]),
+		      "TX enqueue of a held buffer failed");
+
+	check(!liberio_chan_get_emu_stats(tx, &stats), "no stats");
+	check(stats.packets == NBUFS, "sent %llu packets from %d buffers",
+	      (unsigned long long)stats.packets, NBUFS);
+
+out_put:
+	liberio_chan_put(tx);
+}
+
+static int fill_cb(struct liberio_chan *chan, struct liberio_buf *buf,
+		   void *priv)
+{
+	int *count = priv;
+
+	liberio_buf_set_payload(buf, 0, PKT_LEN);
+
+	/* positive return value stops liberio_chan_run() */
+	return ++*count >= NPKTS;
+}
+
+/* a stop issued before liberio_chan_run() is honoured, and only once */
+static void test_stop_run(void)
+{
+	struct liberio_chan *tx;
+	struct liberio_ctx *ctx;
+	int count = 0;
+
+	ctx = new_ctx(0, 0);
+	check(ctx, "failed to set up emulator");
+	if (!ctx)
+		return;
+
+	tx = new_chan(ctx, "/dev/tx-dma0", TX, USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	check(tx, "failed to set up channel");
+	if (!tx)
+		return;
+
+	liberio_chan_set_tx_fill_callback(tx, fill_cb, &count);
+
+	liberio_chan_stop_run(tx);
+	check(!liberio_chan_run(tx, 100000), "stopped run failed");
+	check(!count, "stopped run filled %d buffers", count);
+
+	check(!liberio_chan_run(tx, 100000), "run failed");
+	check(count == NPKTS, "run filled %d of %d buffers", count, NPKTS);
+
+	liberio_chan_put(tx);
+}
+
+/* free TX buffers are ready right away, before the driver completes any */
+static void test_poller(void)
+{
+	struct liberio_poll_event events[2];
+	struct liberio_poller *poller;
+	struct liberio_chan *tx;
+	struct liberio_ctx *ctx;
+	int i, n;
+
+	ctx = new_ctx(0, 0);
+	check(ctx, "failed to set up emulator");
+	if (!ctx)
+		return;
+
+	tx = new_chan(ctx, "/dev/tx-dma0", TX, USRP_MEMORY_MMAP);
+	poller = liberio_ctx_alloc_poller(ctx);
+	liberio_ctx_put(ctx);
+	check(tx && poller, "failed to set up channel and poller");
+	if (!tx || !poller)
+		goto out_put;
+
+	check(!liberio_poller_add_chan(poller, tx), "failed to add channel");
+
+	/* one buffer per channel and call */
+	for (i = 0; i < NBUFS; i++) {
+		n = liberio_poller_wait(poller, events, 2, 0);
+		check(n == 1 && events[0].chan == tx && events[0].buf
+		      && !events[0].err, "free buffer %d wasn't ready", i);
+	}
+
+	n = liberio_poller_wait(poller, events, 2, 0);
+	check(!n, "%d events without free buffers", n);
+
+	liberio_poller_del_chan(poller, tx);
+
+out_put:
+	if (poller)
+		liberio_poller_put(poller);
+	if (tx)
+		liberio_chan_put(tx);
+}
+
+/* exported MMAP buffers share their memory with the channel */
+static void test_export(void)
+{
+	struct liberio_fd_desc descs[NBUFS];
+	struct liberio_chan *tx;
+	struct liberio_ctx *ctx;
+	struct liberio_buf *buf;
+	int fds[NBUFS];
+	int sv[2];
+	uint8_t *mem;
+	int i, n;
+
+	ctx = new_ctx(0, 0);
+	check(ctx, "failed to set up emulator");
+	if (!ctx)
+		return;
+
+	tx = new_chan(ctx, "/dev/tx-dma0", TX, USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	check(tx, "failed to set up channel");
+	if (!tx)
+		return;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)) {
+		check(0, "failed to create socket pair");
+		liberio_chan_put(tx);
+		return;
+	}
+
+	check(!liberio_chan_export_pool(tx, sv[0]), "export failed");
+
+	n = liberio_recv_fds(sv[1], fds, descs, NBUFS);
+	check(n == NBUFS, "received %d of %d buffers", n, NBUFS);
+
+	for (i = 0; i < n; i++) {
+		buf = liberio_chan_get_buf_at_index(tx, descs[i].index);
+		mem = mmap(NULL, descs[i].length, PROT_READ | PROT_WRITE,
+			   MAP_SHARED, fds[i], 0);
+		check(buf && mem != MAP_FAILED, "failed to map buffer %d", i);
+		if (buf && mem != MAP_FAILED) {
+			mem[0] = 0x5a + i;
+			check(((uint8_t *)liberio_buf_get_mem(buf, 0))[0]
+			      == 0x5a + i, "buffer %d isn't shared", i);
+		}
+		if (mem != MAP_FAILED)
+			munmap(mem, descs[i].length);
+		close(fds[i]);
+	}
+
+	close(sv[0]);
+	close(sv[1]);
+	liberio_chan_put(tx);
+}
+
+/* dma-buf allocation and the errors attaching one can run into */
+static void test_dmabuf(void)
+{
+	struct liberio_chan *rx;
+	struct liberio_ctx *ctx;
+	struct liberio_buf *buf;
+	char path[64];
+	int fd, rdonly;
+
+	fd = liberio_dmabuf_alloc(BUF_SIZE);
+	check(fd >= 0 || fd == -ENODEV, "dma-heap allocation failed: %d", fd);
+	if (fd >= 0)
+		close(fd);
+
+	ctx = new_ctx(0, 0);
+	check(ctx, "failed to set up emulator");
+	if (!ctx)
+		return;
+
+	rx = new_chan(ctx, "/dev/rx-dma0", RX, USRP_MEMORY_DMABUF);
+	liberio_ctx_put(ctx);
+	check(rx, "failed to set up channel");
+	if (!rx)
+		return;
+
+	/* a read-only fd can't be mapped for writing */
+	fd = liberio_dmabuf_alloc_memfd(BUF_SIZE);
+	check(fd >= 0, "memfd allocation failed: %d", fd);
+	if (fd >= 0) {
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		rdonly = open(path, O_RDONLY | O_CLOEXEC);
+		check(rdonly >= 0, "failed to reopen memfd");
+		if (rdonly >= 0) {
+			check(liberio_chan_attach_dmabuf(rx, 0, rdonly)
+			      == -EACCES, "read-only attach didn't fail");
+			close(rdonly);
+		}
+		close(fd);
+	}
+
+	/* a queued buffer keeps its dma-buf until it comes back */
+	buf = liberio_chan_get_buf_at_index(rx, 1);
+	check(!liberio_chan_buf_enqueue(rx, buf), "RX enqueue failed");
+	fd = liberio_dmabuf_alloc_memfd(BUF_SIZE);
+	check(fd >= 0, "memfd allocation failed: %d", fd);
+	if (fd >= 0) {
+		check(liberio_chan_attach_dmabuf(rx, 1, fd) == -EBUSY,
+		      "attach to a queued buffer didn't fail");
+		check(!liberio_chan_attach_dmabuf(rx, 2, fd),
+		      "attach to an idle buffer failed");
+		close(fd);
+	}
+
+	liberio_chan_put(rx);
+}
+
+/*
+ * Exercise the emulated device: loop packets back for every memory
+ * type, attach dma-bufs, check the underflow accounting, poll for free
+ * TX buffers and export the MMAP pool.
+ */
+int main(int argc, char *argv[])
+{
+	log_init(2, "emu-loopback");
+
+	test_loopback(USRP_MEMORY_MMAP, "MMAP");
+	test_loopback(USRP_MEMORY_USERPTR, "USERPTR");
+	test_loopback(USRP_MEMORY_DMABUF, "DMABUF");
+	test_dmabuf();
+	test_underflow();
+	test_enqueue_all();
+	test_stop_run();
+	test_poller();
+	test_export();
+
+	if (errors) {
+		log_crit(__func__, "%d errors", errors);
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+
+/* more than one SCM_RIGHTS message worth */
+#define NFDS 300
+#define BUF_SIZE 4096
+
+static int errors;
+
+#define check(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			log_crit(__func__, __VA_ARGS__);	\
+			errors++;				\
+		}						\
+	} while (0)
+
+static int count_open_fds(void)
+{
+	struct dirent *d;
+	DIR *dir;
+	int n = 0;
+
+	dir = opendir("/proc/self/fd");
+	if (!dir)
+		return -1;
+
+	while ((d = readdir(dir)))
+		if (d->d_name[0] != '.')
+			n++;
+	closedir(dir);
+
+	return n;
+}
+
+/* NFDS memfds of different sizes, sent and received as one batch */
+static void test_batch(int tx, int rx)
+{
+	static struct liberio_fd_desc descs[NFDS], got_descs[NFDS];
+	static int fds[NFDS], got[NFDS];
+	struct stat st;
+	int i, n;
+
+	for (i = 0; i < NFDS; i++) {
+		fds[i] = liberio_dmabuf_alloc_memfd(BUF_SIZE * (i + 1));
+		check(fds[i] >= 0, "memfd allocation failed");
+		if (fds[i] < 0)
+			return;
+
+		descs[i].index = i;
+		descs[i].length = BUF_SIZE * (i + 1);
+		descs[i].port = 0;
+		descs[i].dir = RX;
+	}
+
+	check(!liberio_send_fds(tx, fds, descs, NFDS), "send failed");
+
+	for (i = 0; i < NFDS; i++)
+		close(fds[i]);
+
+	n = liberio_recv_fds(rx, got, got_descs, NFDS);
+	check(n == NFDS, "received %d of %d fds", n, NFDS);
+
+	for (i = 0; i < n; i++) {
+		check(!fstat(got[i], &st) && got_descs[i].index == i
+		      && st.st_size == got_descs[i].length,
+		      "fd %d doesn't match its descriptor", i);
+		close(got[i]);
+	}
+}
+
+/* a batch that doesn't fit gets closed without leaving anything queued */
+static void test_too_many(int tx, int rx)
+{
+	static struct liberio_fd_desc descs[NFDS];
+	static int fds[NFDS];
+	int i, n, before;
+
+	before = count_open_fds();
+
+	for (i = 0; i < NFDS; i++) {
+		fds[i] = liberio_dmabuf_alloc_memfd(BUF_SIZE);
+		check(fds[i] >= 0, "memfd allocation failed");
+		if (fds[i] < 0)
+			return;
+		descs[i].index = i;
+		descs[i].length = BUF_SIZE;
+	}
+
+	check(!liberio_send_fds(tx, fds, descs, NFDS), "send failed");
+
+	for (i = 0; i < NFDS; i++)
+		close(fds[i]);
+
+	n = liberio_recv_fds(rx, fds, descs, NFDS / 2);
+	check(n == -EMSGSIZE, "receiving %d into %d returned %d", NFDS,
+	      NFDS / 2, n);
+	check(count_open_fds() == before, "%d fds leaked",
+	      count_open_fds() - before);
+
+	/* the next batch has to come out intact */
+	fds[0] = liberio_dmabuf_alloc_memfd(BUF_SIZE);
+	descs[0].index = 42;
+	check(!liberio_send_fds(tx, fds, descs, 1), "send failed");
+	close(fds[0]);
+
+	n = liberio_recv_fds(rx, fds, descs, NFDS);
+	check(n == 1 && descs[0].index == 42,
+	      "left-overs of the failed batch were received");
+	if (n > 0)
+		close(fds[0]);
+}
+
+/* an emulated MMAP pool of NFDS buffers, shared with the receiver */
+static void test_export_pool(int tx, int rx)
+{
+	static struct liberio_fd_desc descs[NFDS];
+	static int fds[NFDS];
+	struct liberio_emu_config cfg;
+	struct liberio_chan *chan;
+	struct liberio_ctx *ctx;
+	struct liberio_buf *buf;
+	uint8_t *mem;
+	int i, n;
+
+	ctx = liberio_ctx_new();
+	check(ctx, "failed to create context");
+	if (!ctx)
+		return;
+
+	liberio_ctx_set_loglevel(ctx, 2);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.buf_size = BUF_SIZE;
+	check(!liberio_ctx_use_emulator(ctx, &cfg), "no emulator");
+
+	chan = liberio_ctx_alloc_chan(ctx, "/dev/tx-dma3", TX,
+				      USRP_MEMORY_MMAP);
+	liberio_ctx_put(ctx);
+	check(chan, "failed to allocate channel");
+	if (!chan)
+		return;
+
+	check(liberio_chan_request_buffers(chan, NFDS) >= 0,
+	      "failed to request buffers");
+	check(!liberio_chan_export_pool(chan, tx), "export failed");
+
+	n = liberio_recv_fds(rx, fds, descs, NFDS);
+	check(n == NFDS, "received %d of %d buffers", n, NFDS);
+
+	for (i = 0; i < n; i++) {
+		check(descs[i].port == 3 && descs[i].dir == TX
+		      && descs[i].length == BUF_SIZE,
+		      "bad descriptor for buffer %d", i);
+
+		buf = liberio_chan_get_buf_at_index(chan, descs[i].index);
+		mem = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fds[i], 0);
+		check(buf && mem != MAP_FAILED, "failed to map buffer %d", i);
+		if (buf && mem != MAP_FAILED) {
+			mem[BUF_SIZE - 1] = i & 0xff;
+			check(((uint8_t *)liberio_buf_get_mem(buf, 0))
+			      [BUF_SIZE - 1] == (i & 0xff),
+			      "buffer %d isn't shared", i);
+		}
+		if (mem != MAP_FAILED)
+			munmap(mem, BUF_SIZE);
+		close(fds[i]);
+	}
+
+	liberio_chan_put(chan);
+}
+
+/*
+ * Pass batches of fds that take more than one SCM_RIGHTS message over a
+ * socket pair: plain memfds, a batch too large for the receiver and an
+ * exported buffer pool.
+ */
+int main(int argc, char *argv[])
+{
+	int sv[2];
+
+	log_init(2, "fd-passing");
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)) {
+		log_crit(__func__, "failed to create socket pair");
+		return EXIT_FAILURE;
+	}
+
+	test_batch(sv[0], sv[1]);
+	test_too_many(sv[0], sv[1]);
+	test_export_pool(sv[0], sv[1]);
+
+	close(sv[0]);
+	close(sv[1]);
+
+	if (errors) {
+		log_crit(__func__, "%d errors", errors);
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
@@ -0,0 +1,514 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+
+#define MAX_SWEEP 16
+#define HYBRID_SPIN_US 50
+
+enum output {
+	OUTPUT_TEXT,
+	OUTPUT_CSV,
+	OUTPUT_JSON,
+};
+
+struct sweep {
+	const char *name[MAX_SWEEP];
+	long val[MAX_SWEEP];
+	size_t num;
+};
+
+struct bench_opts {
+	const char *rx_dev;
+	const char *tx_dev;
+	struct sweep dirs;
+	struct sweep mems;
+	struct sweep nbufs;
+	struct sweep sizes;
+	struct sweep waits;
+	size_t count;
+	int timeout;
+	enum output output;
+
+	int emulate;
+	struct liberio_emu_config emu;
+};
+
+struct bench_result {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	uint64_t bytes;
+	size_t bufs;
+	uint64_t p50_us, p99_us, p999_us, max_us;
+	long long overflows;
+	long long underflows;
+};
+
+static const struct {
+	const char *name;
+	long val;
+} keywords[] = {
+	{ "rx", RX },
+	{ "tx", TX },
+	{ "mmap", USRP_MEMORY_MMAP },
+	{ "userptr", USRP_MEMORY_USERPTR },
+	{ "block", LIBERIO_WAIT_BLOCK },
+	{ "poll", LIBERIO_WAIT_POLL },
+	{ "hybrid", LIBERIO_WAIT_HYBRID },
+	{ "uring", LIBERIO_WAIT_URING },
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	int err;
+
+	err = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (err) {
+		log_crit(__func__, "failed to get time");
+	}
+
+	return ((uint64_t)ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static uint64_t get_cpu_time(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 * 1000 * 1000 +
+		((uint64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+/* parse a comma separated list of keywords, or numbers if @numeric */
+static int parse_sweep(struct sweep *sweep, const char *arg, int numeric)
+{
+	char *str, *tok, *save;
+	size_t i;
+
+	str = strdup(arg);
+	if (!str)
+		return -ENOMEM;
+
+	sweep->num = 0;
+	for (tok = strtok_r(str, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (sweep->num == MAX_SWEEP)
+			goto out_inval;
+
+		if (numeric) {
+			sweep->val[sweep->num] = strtol(tok, NULL, 0);
+			if (sweep->val[sweep->num] <= 0)
+				goto out_inval;
+			sweep->name[sweep->num++] = NULL;
+			continue;
+		}
+
+		for (i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+			if (!strcmp(tok, keywords[i].name))
+				break;
+		if (i == sizeof(keywords) / sizeof(keywords[0]))
+			goto out_inval;
+
+		sweep->name[sweep->num] = keywords[i].name;
+		sweep->val[sweep->num++] = keywords[i].val;
+	}
+
+	free(str);
+
+	return sweep->num ? 0 : -EINVAL;
+
+out_inval:
+	free(str);
+
+	return -EINVAL;
+}
+
+/* CHDR sequence number, bits 59:48 of the 64 bit header */
+static uint16_t get_seqno(struct liberio_buf *buf)
+{
+	uint64_t hdr = *(uint64_t *)liberio_buf_get_mem(buf, 0);
+
+	return (hdr >> 48) & 0xfff;
+}
+
+static void fill_data(struct liberio_buf *buf, size_t size, uint16_t seqno)
+{
+	uint64_t *hdr = liberio_buf_get_mem(buf, 0);
+
+	*hdr = ((uint64_t)(seqno & 0xfff) << 48) | ((uint64_t)size << 32);
+
+	liberio_buf_set_payload(buf, 0, size);
+}
+
+/*
+ * Stream opts->count buffers through one channel. The channel keeps the
+ * turnaround of every buffer, from handing it to the driver until
+ * getting it back, its percentiles go into the result.
+ */
+static int run_one(struct liberio_ctx *ctx, const struct bench_opts *opts,
+		   int dir, int mem, size_t nbufs, size_t size, int wait,
+		   struct bench_result *res)
+{
+	struct liberio_latency_stats lat;
+	struct liberio_emu_stats emu_stats;
+	struct liberio_chan *chan;
+	struct liberio_buf *buf;
+	uint64_t start, cpu_start;
+	size_t i;
+	uint16_t seq, last = 0;
+	int first = 1;
+	int err;
+
+	chan = liberio_ctx_alloc_chan(ctx, dir == RX ? opts->rx_dev : opts->tx_dev,
+				      dir, mem);
+	if (!chan)
+		return -ENODEV;
+
+	liberio_chan_stop_streaming(chan);
+	liberio_chan_set_fixed_size(chan, 0, size);
+	if (mem == USRP_MEMORY_USERPTR)
+		liberio_chan_set_buf_size(chan, size);
+
+	err = liberio_chan_request_buffers(chan, nbufs);
+	if (err) {
+		log_warnx(__func__, "failed to request %zu buffers", nbufs);
+		goto out_free;
+	}
+	nbufs = liberio_chan_get_num_bufs(chan);
+
+	err = liberio_chan_set_wait_mode(chan, wait, HYBRID_SPIN_US);
+	if (err)
+		goto out_free;
+
+	memset(res, 0, sizeof(*res));
+	res->underflows = -1;
+
+	cpu_start = get_cpu_time();
+	start = get_time();
+
+	if (dir == RX) {
+		err = liberio_chan_enqueue_all(chan);
+		if (err) {
+			log_crit(__func__, "failed to enqueue buffers");
+			goto out_free;
+		}
+	}
+
+	err = liberio_chan_start_streaming(chan);
+	if (err) {
+		log_crit(__func__, "failed to start streaming");
+		goto out_free;
+	}
+
+	for (i = 0; i < opts->count; i++) {
+		buf = liberio_chan_buf_dequeue(chan, opts->timeout);
+		if (!buf) {
+			log_warnx(__func__, "timed out after %zu buffers", i);
+			err = -ETIMEDOUT;
+			break;
+		}
+
+		if (dir == RX) {
+			res->bytes += liberio_buf_get_payload(buf, 0);
+
+			/* count packets the hardware had to drop */
+			if (liberio_buf_get_payload(buf, 0) >= sizeof(uint64_t)) {
+				seq = get_seqno(buf);
+				if (!first)
+					res->overflows += (seq - last - 1) & 0xfff;
+				last = seq;
+				first = 0;
+			}
+		} else {
+			fill_data(buf, size, i);
+			res->bytes += size;
+		}
+
+		err = liberio_chan_buf_enqueue(chan, buf);
+		if (err) {
+			log_warn(__func__, "failed to enqueue buffer");
+			break;
+		}
+	}
+
+	res->wall_ns = get_time() - start;
+	res->cpu_ns = get_cpu_time() - cpu_start;
+	res->bufs = i;
+
+	/* the emulator knows better than sequence numbers */
+	if (!liberio_chan_get_emu_stats(chan, &emu_stats)) {
+		res->overflows = emu_stats.overflows;
+		res->underflows = emu_stats.underflows;
+	}
+
+	liberio_chan_get_latency_stats(chan, &lat);
+	res->p50_us = lat.p50_us;
+	res->p99_us = lat.p99_us;
+	res->p999_us = lat.p999_us;
+	res->max_us = lat.max_us;
+
+	liberio_chan_stop_streaming(chan);
+
+out_free:
+	liberio_chan_put(chan);
+
+	return err;
+}
+
+static void print_header(enum output output)
+{
+	if (output == OUTPUT_CSV)
+		printf("dir,mem,nbufs,size,wait,bufs,mbytes_per_s,bufs_per_s,"
+		       "p50_us,p99_us,p999_us,max_us,cpu_pct,overflows,underflows\n");
+	else if (output == OUTPUT_TEXT)
+		printf("%-3s %-8s %6s %6s %-7s %10s %10s %9s %9s %9s %9s %6s %9s %9s\n",
+		       "dir", "mem", "nbufs", "size", "wait", "MB/s", "bufs/s",
+		       "p50 us", "p99 us", "p99.9 us", "max us", "cpu %",
+		       "overflow", "underflow");
+}
+
+static void print_result(enum output output, const char *dir, const char *mem,
+			 size_t nbufs, size_t size, const char *wait,
+			 const struct bench_result *res)
+{
+	double secs = (double)res->wall_ns / 1e9;
+	double mbps = (double)res->bytes / secs / 1e6;
+	double bps = (double)res->bufs / secs;
+	double cpu = 100.0 * (double)res->cpu_ns / (double)res->wall_ns;
+
+	if (output == OUTPUT_CSV)
+		printf("%s,%s,%zu,%zu,%s,%zu,%.3f,%.1f,%llu,%llu,%llu,%llu,%.1f,%lld,%lld\n",
+		       dir, mem, nbufs, size, wait, res->bufs, mbps, bps,
+		       (unsigned long long)res->p50_us,
+		       (unsigned long long)res->p99_us,
+		       (unsigned long long)res->p999_us,
+		       (unsigned long long)res->max_us,
+		       cpu, res->overflows, res->underflows);
+	else if (output == OUTPUT_JSON)
+		printf("{\"dir\":\"%s\",\"mem\":\"%s\",\"nbufs\":%zu,\"size\":%zu,"
+		       "\"wait\":\"%s\",\"bufs\":%zu,\"mbytes_per_s\":%.3f,"
+		       "\"bufs_per_s\":%.1f,\"p50_us\":%llu,\"p99_us\":%llu,"
+		       "\"p999_us\":%llu,\"max_us\":%llu,\"cpu_pct\":%.1f,"
+		       "\"overflows\":%lld,\"underflows\":%lld}\n",
+		       dir, mem, nbufs, size, wait, res->bufs, mbps, bps,
+		       (unsigned long long)res->p50_us,
+		       (unsigned long long)res->p99_us,
+		       (unsigned long long)res->p999_us,
+		       (unsigned long long)res->max_us,
+		       cpu, res->overflows, res->underflows);
+	else
+		printf("%-3s %-8s %6zu %6zu %-7s %10.1f %10.0f %9llu %9llu %9llu %9llu %6.1f %9lld %9lld\n",
+		       dir, mem, nbufs, size, wait, mbps, bps,
+		       (unsigned long long)res->p50_us,
+		       (unsigned long long)res->p99_us,
+		       (unsigned long long)res->p999_us,
+		       (unsigned long long)res->max_us,
+		       cpu, res->overflows, res->underflows);
+
+	fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d, --dir LIST        rx,tx (default rx,tx)\n"
+		"  -m, --mem LIST        mmap,userptr (default mmap,userptr)\n"
+		"  -n, --nbufs LIST      buffer counts (default 8,32,128)\n"
+		"  -s, --size LIST       fixed block sizes in bytes (default 8192)\n"
+		"  -w, --wait LIST       block,poll,hybrid,uring (default block)\n"
+		"  -c, --count N         buffers per run (default 10000)\n"
+		"  -t, --timeout US      per buffer timeout (default 1000000)\n"
+		"  -o, --output FMT      text, csv or json (default text)\n"
+		"      --rx-dev PATH     (default /dev/rx-dma0)\n"
+		"      --tx-dev PATH     (default /dev/tx-dma0)\n"
+		"  -E, --emulate         use the emulated device instead\n"
+		"      --rate MBPS       emulated link rate, 0 unlimited (default 0)\n"
+		"      --latency US      emulated latency (default 0)\n"
+		"      --jitter US       emulated jitter (default 0)\n"
+		"      --drop PPM        emulated packet loss (default 0)\n",
+		prog);
+}
+
+enum {
+	OPT_RX_DEV = 256,
+	OPT_TX_DEV,
+	OPT_RATE,
+	OPT_LATENCY,
+	OPT_JITTER,
+	OPT_DROP,
+};
+
+static const struct option long_opts[] = {
+	{ "dir",	required_argument,	NULL, 'd' },
+	{ "mem",	required_argument,	NULL, 'm' },
+	{ "nbufs",	required_argument,	NULL, 'n' },
+	{ "size",	required_argument,	NULL, 's' },
+	{ "wait",	required_argument,	NULL, 'w' },
+	{ "count",	required_argument,	NULL, 'c' },
+	{ "timeout",	required_argument,	NULL, 't' },
+	{ "output",	required_argument,	NULL, 'o' },
+	{ "emulate",	no_argument,		NULL, 'E' },
+	{ "rx-dev",	required_argument,	NULL, OPT_RX_DEV },
+	{ "tx-dev",	required_argument,	NULL, OPT_TX_DEV },
+	{ "rate",	required_argument,	NULL, OPT_RATE },
+	{ "latency",	required_argument,	NULL, OPT_LATENCY },
+	{ "jitter",	required_argument,	NULL, OPT_JITTER },
+	{ "drop",	required_argument,	NULL, OPT_DROP },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ NULL,		0,			NULL, 0 },
+};
+
+/*
+ * Sweep direction, memory type, buffer count, block size and wait mode
+ * and report throughput, buffer turnaround percentiles, CPU usage and
+ * overflows/underflows for every combination, against the real device
+ * or the emulated one (-E).
+ */
+int main(int argc, char *argv[])
+{
+	struct bench_opts opts;
+	struct bench_result res;
+	struct liberio_ctx *ctx;
+	size_t d, m, n, s, w;
+	int err = 0;
+	int c;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.rx_dev = "/dev/rx-dma0";
+	opts.tx_dev = "/dev/tx-dma0";
+	opts.count = 10000;
+	opts.timeout = 1000000;
+	parse_sweep(&opts.dirs, "rx,tx", 0);
+	parse_sweep(&opts.mems, "mmap,userptr", 0);
+	parse_sweep(&opts.nbufs, "8,32,128", 1);
+	parse_sweep(&opts.sizes, "8192", 1);
+	parse_sweep(&opts.waits, "block", 0);
+
+	while ((c = getopt_long(argc, argv, "d:m:n:s:w:c:t:o:Eh", long_opts,
+				NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			err = parse_sweep(&opts.dirs, optarg, 0);
+			break;
+		case 'm':
+			err = parse_sweep(&opts.mems, optarg, 0);
+			break;
+		case 'n':
+			err = parse_sweep(&opts.nbufs, optarg, 1);
+			break;
+		case 's':
+			err = parse_sweep(&opts.sizes, optarg, 1);
+			break;
+		case 'w':
+			err = parse_sweep(&opts.waits, optarg, 0);
+			break;
+		case 'c':
+			opts.count = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opts.timeout = strtol(optarg, NULL, 0);
+			break;
+		case 'o':
+			if (!strcmp(optarg, "csv"))
+				opts.output = OUTPUT_CSV;
+			else if (!strcmp(optarg, "json"))
+				opts.output = OUTPUT_JSON;
+			else if (!strcmp(optarg, "text"))
+				opts.output = OUTPUT_TEXT;
+			else
+				err = -EINVAL;
+			break;
+		case 'E':
+			opts.emulate = 1;
+			break;
+		case OPT_RX_DEV:
+			opts.rx_dev = optarg;
+			break;
+		case OPT_TX_DEV:
+			opts.tx_dev = optarg;
+			break;
+		case OPT_RATE:
+			opts.emu.rate = strtoull(optarg, NULL, 0) * 1000000;
+			break;
+		case OPT_LATENCY:
+			opts.emu.latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_JITTER:
+			opts.emu.jitter_us = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_DROP:
+			opts.emu.drop_ppm = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : EXIT_FAILURE;
+		}
+
+		if (err) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!opts.count) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ctx = liberio_ctx_new();
+	if (!ctx)
+		return EXIT_FAILURE;
+
+	liberio_ctx_set_loglevel(ctx, 1);
+
+	if (opts.emulate) {
+		err = liberio_ctx_use_emulator(ctx, &opts.emu);
+		if (err) {
+			log_crit(__func__, "failed to set up emulator");
+			goto out_put;
+		}
+	}
+
+	print_header(opts.output);
+
+	for (d = 0; d < opts.dirs.num; d++)
+	for (m = 0; m < opts.mems.num; m++)
+	for (n = 0; n < opts.nbufs.num; n++)
+	for (s = 0; s < opts.sizes.num; s++)
+	for (w = 0; w < opts.waits.num; w++) {
+		err = run_one(ctx, &opts, opts.dirs.val[d], opts.mems.val[m],
+			      opts.nbufs.val[n], opts.sizes.val[s],
+			      opts.waits.val[w], &res);
+		if (err) {
+			log_warnx(__func__, "%s %s %ld bufs %ld bytes %s failed (%d)",
+				  opts.dirs.name[d], opts.mems.name[m],
+				  opts.nbufs.val[n], opts.sizes.val[s],
+				  opts.waits.name[w], err);
+			continue;
+		}
+
+		print_result(opts.output, opts.dirs.name[d], opts.mems.name[m],
+			     opts.nbufs.val[n], opts.sizes.val[s],
+			     opts.waits.name[w], &res);
+	}
+
+	err = 0;
+
+out_put:
+	liberio_ctx_put(ctx);
+
+	return err ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include <liberio/liberio.h>
+
+#include "../src/log.h"
+
+#define MAX_DEVS 64
+
+static void print_dev(const struct liberio_dev_info *info, const char *what)
+{
+	printf("%-7s %-20s port %3d %s", what, info->path, info->port,
+	       info->dir == RX ? "RX" : "TX");
+
+	if (info->api_maj >= 0)
+		printf("  api %d.%d", info->api_maj,
+		       info->api_min < 0 ? 0 : info->api_min);
+
+	printf("\n");
+}
+
+static void hotplug_cb(struct liberio_ctx *ctx,
+		       const struct liberio_dev_info *info, int added,
+		       void *priv)
+{
+	print_dev(info, added ? "added" : "removed");
+	fflush(stdout);
+}
+
+/*
+ * List the DMA devices of the system, with -m keep watching for devices
+ * coming and going.
+ */
+int main(int argc, char *argv[])
+{
+	struct liberio_dev_info devs[MAX_DEVS];
+	struct liberio_ctx *ctx;
+	struct pollfd pfd;
+	int monitor = argc > 1 && !strcmp(argv[1], "-m");
+	int n, i;
+
+	ctx = liberio_ctx_new();
+	if (!ctx)
+		return EXIT_FAILURE;
+
+	n = liberio_ctx_get_devices(ctx, devs, MAX_DEVS);
+	if (n < 0) {
+		log_crit(__func__, "failed to enumerate devices");
+		liberio_ctx_put(ctx);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < n && i < MAX_DEVS; i++)
+		print_dev(devs + i, "");
+
+	if (!monitor) {
+		liberio_ctx_put(ctx);
+		return EXIT_SUCCESS;
+	}
+
+	pfd.fd = liberio_ctx_get_monitor_fd(ctx);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0) {
+		log_crit(__func__, "hotplug monitoring is not available");
+		liberio_ctx_put(ctx);
+		return EXIT_FAILURE;
+	}
+
+	liberio_ctx_set_hotplug_callback(ctx, hotplug_cb, NULL);
+
+	while (poll(&pfd, 1, -1) >= 0)
+		liberio_ctx_process_hotplug(ctx);
+
+	liberio_ctx_put(ctx);
+
+	return EXIT_SUCCESS;
+}
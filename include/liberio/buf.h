@@ -12,6 +12,9 @@
 #ifndef LIBERIO_BUF_H
 #define LIBERIO_BUF_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 struct liberio_buf;
 
 /* Buffer API */
@@ -24,4 +27,9 @@ size_t liberio_buf_get_len(const struct liberio_buf *buf, size_t plane);
 
 size_t liberio_buf_get_index(const struct liberio_buf *buf);
 
+/* driver completion time (CLOCK_MONOTONIC, us) and sequence number */
+uint64_t liberio_buf_get_timestamp(const struct liberio_buf *buf);
+
+uint32_t liberio_buf_get_sequence(const struct liberio_buf *buf);
+
 #endif /* LIBERIO_BUF_H */
@@ -28,6 +28,52 @@ enum usrp_memory {
 	USRP_MEMORY_DMABUF           = 4,
 };
 
+enum liberio_wait_mode {
+	LIBERIO_WAIT_BLOCK           = 0,
+	LIBERIO_WAIT_POLL            = 1,
+	LIBERIO_WAIT_HYBRID          = 2,
+	LIBERIO_WAIT_URING           = 3,
+};
+
+struct liberio_engine_attr {
+	int cpu;		/* CPU to pin the engine thread to, -1 for any */
+	int priority;		/* SCHED_FIFO priority, 0 keeps the default */
+	size_t depth;		/* filled buffers held for the consumer */
+	unsigned int spin_us;	/* busy-poll this long before sleeping */
+};
+
+struct liberio_engine_stats {
+	uint64_t delivered;	/* buffers handed to the application */
+	uint64_t submitted;	/* buffers handed to the driver */
+	uint64_t overflows;
+};
+
+struct liberio_chan_stats {
+	uint64_t enqueued;	/* buffers handed to the driver */
+	uint64_t dequeued;	/* buffers handed back by the driver */
+	uint64_t bytes;		/* payload enqueued (TX) or dequeued (RX) */
+	uint64_t timeouts;	/* dequeues that ran into their timeout */
+	uint64_t wait_errors;	/* failed select()/io_uring waits */
+	uint64_t ioctl_errors;	/* driver requests that failed */
+	uint64_t gaps;		/* RX sequence number gaps */
+	uint64_t lost;		/* RX buffers missing in those gaps */
+	uint64_t queued;	/* buffers with the driver right now */
+	uint64_t queued_max;	/* most buffers the driver had */
+	uint64_t queued_min;	/* fewest buffers left after a dequeue */
+	uint64_t free;		/* TX buffers on the free list */
+};
+
+/* enqueue to completion as timestamped by the driver, in us */
+struct liberio_latency_stats {
+	uint64_t count;
+	uint64_t min_us;
+	uint64_t mean_us;
+	uint64_t max_us;
+	uint64_t p50_us;
+	uint64_t p90_us;
+	uint64_t p99_us;
+	uint64_t p999_us;
+};
 
 /* Channel API */
 struct liberio_chan;
@@ -37,11 +83,25 @@ void liberio_chan_get(struct liberio_chan *chan);
 
 const char *liberio_chan_get_type(const struct liberio_chan *chan);
 
+int liberio_chan_get_api_version(const struct liberio_chan *chan, int *maj,
+				 int *min);
+
 int liberio_chan_set_fixed_size(struct liberio_chan *chan, size_t plane,
 				size_t size);
 
+int liberio_chan_set_buf_size(struct liberio_chan *chan, size_t size);
+
 int liberio_chan_request_buffers(struct liberio_chan *chan, size_t num_buffers);
 
+int liberio_chan_resize_buffers(struct liberio_chan *chan, size_t num_buffers);
+
+int liberio_chan_attach_dmabuf(struct liberio_chan *chan, size_t index,
+			       int fd);
+
+int liberio_chan_set_wait_mode(struct liberio_chan *chan,
+			       enum liberio_wait_mode mode,
+			       unsigned int spin_us);
+
 
 int liberio_chan_enqueue_all(struct liberio_chan *chan);
 
@@ -53,13 +113,97 @@ size_t liberio_chan_get_num_bufs(const struct liberio_chan *chan);
 struct liberio_buf *liberio_chan_buf_dequeue(struct liberio_chan *chan,
 		int timeout);
 
+int liberio_chan_buf_dequeue_many(struct liberio_chan *chan,
+				  struct liberio_buf **bufs, size_t max,
+				  size_t min, int timeout);
+
 int liberio_chan_buf_enqueue(struct liberio_chan *chan,
 			struct liberio_buf *buf);
 
+int liberio_chan_buf_enqueue_many(struct liberio_chan *chan,
+				  struct liberio_buf **bufs, size_t num,
+				  size_t *queued);
+
+/*
+ * The channel fd is non-blocking. It polls readable (RX) or writable (TX)
+ * once a completed buffer can be dequeued, after which
+ * liberio_chan_buf_dequeue() with a timeout of 0 returns it without
+ * sleeping. The fd stays owned by the channel, do not read, write or
+ * close it.
+ */
+int liberio_chan_get_fd(const struct liberio_chan *chan);
+
+/*
+ * Called from dequeue when the driver's RX sequence number skipped ahead,
+ * i.e. buffers expected..seq - 1 were dropped or overflowed.
+ */
+int liberio_chan_set_gap_callback(struct liberio_chan *chan,
+				  void (*cb)(struct liberio_chan *chan,
+					     uint32_t expected, uint32_t seq,
+					     void *priv),
+				  void *priv);
+
 int liberio_chan_start_streaming(struct liberio_chan *chan);
 
 int liberio_chan_stop_streaming(struct liberio_chan *chan);
 
+void liberio_chan_get_stats(const struct liberio_chan *chan,
+			    struct liberio_chan_stats *stats);
+
+void liberio_chan_reset_stats(struct liberio_chan *chan);
+
+void liberio_chan_get_latency_stats(const struct liberio_chan *chan,
+				    struct liberio_latency_stats *stats);
+
+uint64_t liberio_chan_get_latency_percentile(const struct liberio_chan *chan,
+					     double percentile);
+
+/*
+ * Callback streaming: liberio_chan_run() starts streaming and calls the
+ * RX callback for every filled buffer, or the TX fill callback for every
+ * free one, re-enqueueing each as soon as its callback returns.
+ */
+int liberio_chan_set_rx_callback(struct liberio_chan *chan,
+				 int (*cb)(struct liberio_chan *chan,
+					   struct liberio_buf *buf,
+					   void *priv),
+				 void *priv);
+
+int liberio_chan_set_tx_fill_callback(struct liberio_chan *chan,
+				      int (*cb)(struct liberio_chan *chan,
+						struct liberio_buf *buf,
+						void *priv),
+				      void *priv);
+
+int liberio_chan_run(struct liberio_chan *chan, int timeout);
+
+void liberio_chan_stop_run(struct liberio_chan *chan);
+
+/*
+ * Background engine: a library thread services the driver and the
+ * application gets and puts buffers through lock-free rings. get/put
+ * must be called from one thread only.
+ *
+ * RX: get returns filled buffers, put hands them back for refilling. A
+ * depth of 0 holds up to half the pool for the consumer, buffers beyond
+ * that go straight back to the driver and are counted as overflows.
+ *
+ * TX: get returns free buffers, put submits a filled one. Completed
+ * buffers are reclaimed by the engine, depth is ignored.
+ */
+int liberio_chan_engine_start(struct liberio_chan *chan,
+			      const struct liberio_engine_attr *attr);
+
+int liberio_chan_engine_stop(struct liberio_chan *chan);
+
+struct liberio_buf *liberio_chan_engine_get(struct liberio_chan *chan,
+					    int timeout);
+
+int liberio_chan_engine_put(struct liberio_chan *chan, struct liberio_buf *buf);
+
+void liberio_chan_engine_get_stats(const struct liberio_chan *chan,
+				   struct liberio_engine_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
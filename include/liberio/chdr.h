@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#ifndef LIBERIO_CHDR_H
+#define LIBERIO_CHDR_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct liberio_buf;
+
+enum liberio_chdr_type {
+	LIBERIO_CHDR_DATA            = 0,
+	LIBERIO_CHDR_FLOW_CTRL       = 1,
+	LIBERIO_CHDR_CMD             = 2,
+	LIBERIO_CHDR_RESP            = 3,
+};
+
+/*
+ * A CHDR packet as found in a buffer. The 64 bit header holds type,
+ * has_time and eob (or error for responses) in bits 63:60, the sequence
+ * number in 59:48, the packet length in bytes, header included, in 47:32
+ * and the SID in 31:0. A 64 bit timestamp follows if has_time is set.
+ * payload points into the buffer, nothing is copied.
+ */
+struct liberio_chdr_pkt {
+	enum liberio_chdr_type type;
+	int has_time;
+	int eob;
+	uint16_t seq;
+	uint16_t length;
+	uint32_t sid;
+	uint64_t timestamp;
+	void *payload;
+	size_t payload_len;
+};
+
+/*
+ * Walks the CHDR packets packed into a buffer, each one starting at the
+ * next 64 bit boundary after the previous one. A zero header ends the
+ * packets, as does the end of the valid bytes.
+ */
+struct liberio_chdr_iter {
+	uint8_t *pos;
+	uint8_t *end;
+};
+
+void liberio_chdr_iter_init(struct liberio_chdr_iter *iter,
+			    const struct liberio_buf *buf);
+
+void liberio_chdr_iter_init_mem(struct liberio_chdr_iter *iter, void *mem,
+				size_t len);
+
+/* 1 and @pkt filled in, 0 after the last packet or -EBADMSG */
+int liberio_chdr_iter_next(struct liberio_chdr_iter *iter,
+			   struct liberio_chdr_pkt *pkt);
+
+/*
+ * TX packer: appends CHDR packets to a TX buffer of the channel and
+ * enqueues it once it holds max_bytes or max_pkts, or max_delay_us after
+ * its first packet. The delay is only checked by add and poll, an idle
+ * application has to call liberio_chdr_packer_poll() again within the
+ * time the last call returned.
+ */
+struct liberio_chan;
+struct liberio_chdr_packer;
+
+struct liberio_chdr_packer_attr {
+	size_t max_bytes;		/* 0 for the buffer size */
+	size_t max_pkts;		/* 0 for no limit */
+	unsigned int max_delay_us;	/* 0 for no deadline */
+};
+
+struct liberio_chdr_packer *
+liberio_chan_alloc_packer(struct liberio_chan *chan,
+			  const struct liberio_chdr_packer_attr *attr);
+
+void liberio_chdr_packer_free(struct liberio_chdr_packer *packer);
+
+/* type, has_time, eob, seq, sid and timestamp are taken from @hdr */
+int liberio_chdr_packer_add(struct liberio_chdr_packer *packer,
+			    const struct liberio_chdr_pkt *hdr,
+			    const void *payload, size_t len, int timeout);
+
+int liberio_chdr_packer_flush(struct liberio_chdr_packer *packer);
+
+/* us until the pending buffer is due, 0 if none, or an error */
+int liberio_chdr_packer_poll(struct liberio_chdr_packer *packer);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* LIBERIO_CHDR_H */
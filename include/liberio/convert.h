@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#ifndef LIBERIO_CONVERT_H
+#define LIBERIO_CONVERT_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct liberio_buf;
+
+/*
+ * Sample conversion, n counts complex samples, I and Q interleaved.
+ *
+ * sc16 <-> fc32 multiplies by scale, e.g. 1/32768.0 and 32767.0, floats
+ * are rounded to nearest, ties to even, and saturated, NaN becomes 0.
+ * sc8 is the upper byte of sc16.
+ * sc12 packs a sample into 3 bytes, I in bits 11:0 and Q in bits 23:12,
+ * the upper 12 bits of the sc16 values.
+ *
+ * LIBERIO_CONVERT_BSWAP byte swaps the sc16 side, for big endian data.
+ */
+#define LIBERIO_CONVERT_BSWAP	(1 << 0)
+
+void liberio_convert_sc16_to_fc32(float *out, const int16_t *in, size_t n,
+				  float scale, unsigned int flags);
+
+void liberio_convert_fc32_to_sc16(int16_t *out, const float *in, size_t n,
+				  float scale, unsigned int flags);
+
+void liberio_convert_sc16_to_sc8(int8_t *out, const int16_t *in, size_t n,
+				 unsigned int flags);
+
+void liberio_convert_sc8_to_sc16(int16_t *out, const int8_t *in, size_t n,
+				 unsigned int flags);
+
+void liberio_convert_sc12_to_sc16(int16_t *out, const uint8_t *in, size_t n);
+
+void liberio_convert_sc16_to_sc12(uint8_t *out, const int16_t *in, size_t n);
+
+/*
+ * Straight between a DMA buffer and the caller's samples, in one pass.
+ * Returns the number of samples converted, bounded by the valid bytes of
+ * an RX buffer and the length of a TX buffer, whose payload gets set.
+ */
+size_t liberio_buf_read_fc32(const struct liberio_buf *buf, float *out,
+			     size_t max, float scale, unsigned int flags);
+
+size_t liberio_buf_write_fc32(struct liberio_buf *buf, const float *in,
+			      size_t n, float scale, unsigned int flags);
+
+/*
+ * Kernels are picked for the CPU on first use: "avx2", "ssse3", "neon"
+ * or "scalar". The LIBERIO_CONVERT environment variable or
+ * liberio_convert_set_impl() override the choice.
+ */
+const char *liberio_convert_get_impl(void);
+
+int liberio_convert_set_impl(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* LIBERIO_CONVERT_H */
@@ -20,6 +20,8 @@ extern "C"
 
 #include <liberio/chan.h>
 #include <liberio/buf.h>
+#include <liberio/chdr.h>
+#include <liberio/convert.h>
 
 enum liberio_direction {
 	TX = 0,
@@ -40,10 +42,143 @@ liberio_ctx_alloc_chan(struct liberio_ctx *ctx,
 		       const enum liberio_direction dir,
 		       enum usrp_memory mem_type);
 
+int liberio_dmabuf_alloc(size_t len);
+
+int liberio_dmabuf_alloc_memfd(size_t len);
+
+/* Emulated device */
+struct liberio_emu_config {
+	uint64_t rate;			/* bytes per second, 0 for unlimited */
+	unsigned int latency_us;
+	unsigned int jitter_us;		/* added to latency, uniform */
+	unsigned int drop_ppm;		/* packets lost per million */
+	size_t buf_size;		/* MMAP buffer size, 0 for 8192 */
+	size_t max_bufs;		/* 0 for 1024 */
+	int loopback;			/* RX gets what TX on its port sent */
+};
+
+struct liberio_emu_stats {
+	uint64_t packets;
+	uint64_t overflows;		/* RX packets that found no buffer */
+	uint64_t underflows;		/* TX link ran dry, needs a rate */
+	uint64_t drops;			/* injected losses */
+};
+
+int liberio_ctx_use_emulator(struct liberio_ctx *ctx,
+			     const struct liberio_emu_config *cfg);
+
+int liberio_chan_get_emu_stats(struct liberio_chan *chan,
+			       struct liberio_emu_stats *stats);
+
+/* fd passing */
+struct liberio_fd_desc {
+	uint32_t index;
+	uint32_t length;
+	int32_t port;
+	uint32_t dir;		/* enum liberio_direction */
+};
+
+int liberio_send_fds(int sockfd, const int *fds,
+		     const struct liberio_fd_desc *descs, size_t num);
+
+int liberio_recv_fds(int sockfd, int *fds, struct liberio_fd_desc *descs,
+		     size_t max);
+
+int liberio_chan_export_pool(struct liberio_chan *chan, int sockfd);
+
+/* Poller API */
+struct liberio_poller;
+
+/* buf is NULL and err a negative error code if the channel failed */
+struct liberio_poll_event {
+	struct liberio_chan *chan;
+	struct liberio_buf *buf;
+	int err;
+};
+
+struct liberio_poller *liberio_ctx_alloc_poller(struct liberio_ctx *ctx);
+
+void liberio_poller_put(struct liberio_poller *poller);
+
+void liberio_poller_get(struct liberio_poller *poller);
+
+int liberio_poller_add_chan(struct liberio_poller *poller,
+			    struct liberio_chan *chan);
+
+int liberio_poller_del_chan(struct liberio_poller *poller,
+			    struct liberio_chan *chan);
+
+int liberio_poller_wait(struct liberio_poller *poller,
+			struct liberio_poll_event *events, size_t max_events,
+			int timeout);
+
 void liberio_ctx_set_loglevel(struct liberio_ctx *ctx, int loglevel);
 void liberio_ctx_register_logger(struct liberio_ctx *ctx, void (*cb)(int, const char *, void*),
 				 void *priv);
 
+/*
+ * Asynchronous logging: messages are queued as binary records and only
+ * formatted when a background thread (@thread) or liberio_ctx_flush_log()
+ * hands them to the logger. @entries of 0 goes back to logging right away.
+ */
+int liberio_ctx_set_log_async(struct liberio_ctx *ctx, size_t entries,
+			      int thread);
+
+void liberio_ctx_flush_log(struct liberio_ctx *ctx);
+
+/*
+ * Device registry: the DMA devices (rx-dma*, tx-dma*) are enumerated once
+ * per context and indexed by port and direction. With libudev a monitor
+ * keeps the list current, poll the monitor fd and call
+ * liberio_ctx_process_hotplug() when it is readable.
+ */
+struct liberio_dev_info {
+	char path[64];		/* device node, e.g. /dev/rx-dma0 */
+	int port;
+	enum liberio_direction dir;
+	int api_maj;		/* negative if the driver doesn't tell */
+	int api_min;
+};
+
+int liberio_ctx_scan_devices(struct liberio_ctx *ctx);
+
+int liberio_ctx_get_devices(struct liberio_ctx *ctx,
+			    struct liberio_dev_info *devs, size_t max);
+
+int liberio_ctx_find_device(struct liberio_ctx *ctx, int port,
+			    enum liberio_direction dir,
+			    struct liberio_dev_info *info);
+
+struct liberio_chan *liberio_ctx_alloc_chan_by_port(struct liberio_ctx *ctx,
+						    int port,
+						    enum liberio_direction dir,
+						    enum usrp_memory mem_type);
+
+int liberio_ctx_get_monitor_fd(struct liberio_ctx *ctx);
+
+int liberio_ctx_set_hotplug_callback(struct liberio_ctx *ctx,
+				     void (*cb)(struct liberio_ctx *ctx,
+						const struct liberio_dev_info *info,
+						int added, void *priv),
+				     void *priv);
+
+int liberio_ctx_process_hotplug(struct liberio_ctx *ctx);
+
+/* Context wide operations on all open channels */
+struct liberio_ctx_chan_stats {
+	int port;
+	enum liberio_direction dir;
+	struct liberio_chan_stats stats;
+};
+
+struct liberio_chan *liberio_ctx_lookup_chan(struct liberio_ctx *ctx, int port,
+					     enum liberio_direction dir);
+
+int liberio_ctx_stop_streaming(struct liberio_ctx *ctx);
+
+int liberio_ctx_get_stats(struct liberio_ctx *ctx,
+			  struct liberio_ctx_chan_stats *stats, size_t max);
+
 #ifdef __cplusplus
 }
 #endif
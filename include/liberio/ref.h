@@ -30,6 +30,21 @@ static inline void ref_inc(const struct ref *ref)
 	__sync_add_and_fetch((int *)&ref->count, 1);
 }
 
+/* take a reference unless the last one is already gone, returns 0 if so */
+static inline int ref_get_unless_zero(const struct ref *ref)
+{
+	int count = __atomic_load_n(&ref->count, __ATOMIC_RELAXED);
+
+	do {
+		if (!count)
+			return 0;
+	} while (!__atomic_compare_exchange_n((int *)&ref->count, &count,
+					      count + 1, 0, __ATOMIC_ACQUIRE,
+					      __ATOMIC_RELAXED));
+
+	return 1;
+}
+
 static inline void ref_dec(const struct ref *ref)
 {
 	if (__sync_sub_and_fetch((int *)&ref->count, 1) == 0)
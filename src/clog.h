@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#ifndef LIBERIO_CLOG_H
+#define LIBERIO_CLOG_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include "util.h"
+
+/*
+ * Per context logging
+ *
+ * ctx_warn() and friends only compare the priority against the context's
+ * level before doing anything else. Messages that pass either get
+ * formatted and handed out right away, or, once the context logs
+ * asynchronously, go into a preallocated lock-free ring as a binary
+ * record: the format string, the raw arguments and errno. Formatting
+ * happens when the ring gets drained, by the context's log thread or
+ * liberio_ctx_flush_log(). Hence %s arguments must stay valid after the
+ * call, string literals and the like, and at most LIBERIO_LOG_MAX_ARGS
+ * arguments are supported.
+ */
+#define LIBERIO_LOG_MAX_ARGS	6
+
+/* record an errno and append its description, like log_warn() */
+#define LIBERIO_LOG_ERRNO	(1 << 0)
+
+struct liberio_ctx;
+
+void __liberio_log(struct liberio_ctx *ctx, int pri, unsigned int flags,
+		   const char *token, const char *fmt, const uint64_t *args,
+		   unsigned int nargs);
+
+void __liberio_log_free(struct liberio_ctx *ctx);
+
+/*
+ * Arguments travel as 64 bit words. Only 64 bit integers can be wider
+ * than a pointer, everything else, pointers included, goes through
+ * uintptr_t. No branch casts a pointer straight to uint64_t, so 32 bit
+ * targets don't warn.
+ */
+#define __LIBERIO_LOG_ARG(x)						\
+	((uint64_t)_Generic((x),					\
+			    long long: (x),				\
+			    unsigned long long: (x),			\
+			    default: (uintptr_t)(x)))
+
+#define __LIBERIO_LOG_MAP0()
+#define __LIBERIO_LOG_MAP1(a) __LIBERIO_LOG_ARG(a)
+#define __LIBERIO_LOG_MAP2(a, ...) __LIBERIO_LOG_ARG(a), __LIBERIO_LOG_MAP1(__VA_ARGS__)
+#define __LIBERIO_LOG_MAP3(a, ...) __LIBERIO_LOG_ARG(a), __LIBERIO_LOG_MAP2(__VA_ARGS__)
+#define __LIBERIO_LOG_MAP4(a, ...) __LIBERIO_LOG_ARG(a), __LIBERIO_LOG_MAP3(__VA_ARGS__)
+#define __LIBERIO_LOG_MAP5(a, ...) __LIBERIO_LOG_ARG(a), __LIBERIO_LOG_MAP4(__VA_ARGS__)
+#define __LIBERIO_LOG_MAP6(a, ...) __LIBERIO_LOG_ARG(a), __LIBERIO_LOG_MAP5(__VA_ARGS__)
+
+#define __LIBERIO_LOG_PICK(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define __LIBERIO_LOG_MAP(...)						\
+	__LIBERIO_LOG_PICK(_0, ##__VA_ARGS__, __LIBERIO_LOG_MAP6,	\
+			   __LIBERIO_LOG_MAP5, __LIBERIO_LOG_MAP4,	\
+			   __LIBERIO_LOG_MAP3, __LIBERIO_LOG_MAP2,	\
+			   __LIBERIO_LOG_MAP1, __LIBERIO_LOG_MAP0)(__VA_ARGS__)
+
+#define ctx_log(ctx, pri, flags, fmt, ...)				\
+do {									\
+	if (unlikely((pri) <= (ctx)->log_level)) {			\
+		const uint64_t __args[] = {				\
+			0, __LIBERIO_LOG_MAP(__VA_ARGS__)		\
+		};							\
+		if (0)							\
+			__liberio_log_check(fmt, ##__VA_ARGS__);	\
+		__liberio_log(ctx, pri, flags, __func__, fmt,		\
+			      __args + 1,				\
+			      sizeof(__args) / sizeof(__args[0]) - 1);	\
+	}								\
+} while (0)
+
+/* never called, lets the compiler check the arguments against fmt */
+static inline void __liberio_log_check(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+static inline void __liberio_log_check(const char *fmt, ...)
+{
+}
+
+#define ctx_crit(ctx, fmt, ...) \
+	ctx_log(ctx, LOG_CRIT, 0, fmt, ##__VA_ARGS__)
+#define ctx_warn(ctx, fmt, ...) \
+	ctx_log(ctx, LOG_WARNING, LIBERIO_LOG_ERRNO, fmt, ##__VA_ARGS__)
+#define ctx_warnx(ctx, fmt, ...) \
+	ctx_log(ctx, LOG_WARNING, 0, fmt, ##__VA_ARGS__)
+#define ctx_info(ctx, fmt, ...) \
+	ctx_log(ctx, LOG_INFO, 0, fmt, ##__VA_ARGS__)
+#define ctx_debug(ctx, fmt, ...) \
+	ctx_log(ctx, LOG_DEBUG, 0, fmt, ##__VA_ARGS__)
+
+#endif /* LIBERIO_CLOG_H */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#ifndef LIBERIO_CONVERT_PRIV_H
+#define LIBERIO_CONVERT_PRIV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * struct liberio_convert_ops - One set of conversion kernels
+ *
+ * n counts complex samples. Vector kernels do whole blocks and hand the
+ * rest to the scalar ones, so they must give the same results.
+ */
+struct liberio_convert_ops {
+	const char *name;
+	/* 0 if the CPU can't run these */
+	int (*supported)(void);
+	void (*sc16_to_fc32)(float *out, const int16_t *in, size_t n,
+			     float scale, int bswap);
+	void (*fc32_to_sc16)(int16_t *out, const float *in, size_t n,
+			     float scale, int bswap);
+	void (*sc16_to_sc8)(int8_t *out, const int16_t *in, size_t n,
+			    int bswap);
+	void (*sc8_to_sc16)(int16_t *out, const int8_t *in, size_t n,
+			    int bswap);
+	void (*sc12_to_sc16)(int16_t *out, const uint8_t *in, size_t n);
+	void (*sc16_to_sc12)(uint8_t *out, const int16_t *in, size_t n);
+};
+
+extern const struct liberio_convert_ops __liberio_convert_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct liberio_convert_ops __liberio_convert_ssse3;
+extern const struct liberio_convert_ops __liberio_convert_avx2;
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+extern const struct liberio_convert_ops __liberio_convert_neon;
+#endif
+
+#endif /* LIBERIO_CONVERT_PRIV_H */
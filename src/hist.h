@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#ifndef LIBERIO_HIST_H
+#define LIBERIO_HIST_H
+
+#include <stdint.h>
+
+/*
+ * struct liberio_hist - Fixed size log-linear histogram
+ *
+ * Values below 2^LIBERIO_HIST_SUB_BITS get a bucket each, above that
+ * every power of two is split into 2^LIBERIO_HIST_SUB_BITS linear
+ * buckets, so a bucket is never wider than 1/16 of the values it holds.
+ * Values of 2^LIBERIO_HIST_MAX_BITS and up land in the last bucket.
+ *
+ * Recording is a couple of relaxed atomic adds, no allocation and no
+ * locking, so it can sit on the dequeue path and be read from any thread.
+ */
+#define LIBERIO_HIST_SUB_BITS	4
+#define LIBERIO_HIST_SUB	(1 << LIBERIO_HIST_SUB_BITS)
+#define LIBERIO_HIST_MAX_BITS	32
+#define LIBERIO_HIST_BUCKETS	\
+	((LIBERIO_HIST_MAX_BITS - LIBERIO_HIST_SUB_BITS + 1) * LIBERIO_HIST_SUB)
+
+struct liberio_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[LIBERIO_HIST_BUCKETS];
+};
+
+static inline unsigned int liberio_hist_bucket(uint64_t val)
+{
+	unsigned int exp;
+
+	if (val < LIBERIO_HIST_SUB)
+		return val;
+
+	if (val >> LIBERIO_HIST_MAX_BITS)
+		return LIBERIO_HIST_BUCKETS - 1;
+
+	exp = 63 - __builtin_clzll(val);
+
+	return ((exp - LIBERIO_HIST_SUB_BITS + 1) << LIBERIO_HIST_SUB_BITS)
+		| ((val >> (exp - LIBERIO_HIST_SUB_BITS)) & (LIBERIO_HIST_SUB - 1));
+}
+
+static inline void liberio_hist_record(struct liberio_hist *hist,
+				       uint64_t val)
+{
+	__atomic_fetch_add(&hist->buckets[liberio_hist_bucket(val)], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum, val, __ATOMIC_RELAXED);
+
+	if (val > __atomic_load_n(&hist->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&hist->max, val, __ATOMIC_RELAXED);
+	if (val < __atomic_load_n(&hist->min, __ATOMIC_RELAXED))
+		__atomic_store_n(&hist->min, val, __ATOMIC_RELAXED);
+}
+
+void __liberio_hist_reset(struct liberio_hist *hist);
+
+uint64_t __liberio_hist_percentile(const struct liberio_hist *hist,
+				   double percentile);
+
+#endif /* LIBERIO_HIST_H */
@@ -6,6 +6,7 @@
 #include <sys/time.h>
 #include <stdlib.h>
 
+#define __u64 uint64_t
 #define __u32 uint32_t
 #define __s32 int32_t
 #define __u8 uint8_t
@@ -109,4 +110,26 @@ struct usrp_fmt {
 #define USRPIOC_STREAMOFF	_IOW('V', 19, int)
 #define USRPIOC_SET_FMT	_IOW('V', 20, struct usrp_fmt)
 
+/* dma-buf / dma-heap, from include/uapi/linux/dma-{buf,heap}.h */
+struct dma_buf_sync {
+	__u64 flags;
+};
+
+#define DMA_BUF_SYNC_READ	(1 << 0)
+#define DMA_BUF_SYNC_WRITE	(2 << 0)
+#define DMA_BUF_SYNC_RW		(DMA_BUF_SYNC_READ | DMA_BUF_SYNC_WRITE)
+#define DMA_BUF_SYNC_START	(0 << 2)
+#define DMA_BUF_SYNC_END	(1 << 2)
+
+#define DMA_BUF_IOCTL_SYNC	_IOW('b', 0, struct dma_buf_sync)
+
+struct dma_heap_allocation_data {
+	__u64 len;
+	__u32 fd;
+	__u32 fd_flags;
+	__u64 heap_flags;
+};
+
+#define DMA_HEAP_IOCTL_ALLOC	_IOWR('H', 0x0, struct dma_heap_allocation_data)
+
 #endif /* LIBERIO_KERNEL_H */
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "priv.h"
+#include "util.h"
+
+#define CHDR_HDR_LEN	8
+#define CHDR_TIME_LEN	8
+
+/* the length field is 16 bits */
+#define CHDR_MAX_LEN	0xffff
+
+/* packets start on 64 bit boundaries */
+#define CHDR_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+void liberio_chdr_iter_init_mem(struct liberio_chdr_iter *iter, void *mem,
+				size_t len)
+{
+	iter->pos = mem;
+	iter->end = iter->pos + len;
+}
+
+/*
+ * liberio_chdr_iter_init - Start walking the packets of an RX buffer
+ * @iter: the iterator
+ * @buf: the buffer, up to its valid bytes are looked at
+ *
+ * The packets stay in @buf, @buf must not be enqueued again while they
+ * are used.
+ */
+void liberio_chdr_iter_init(struct liberio_chdr_iter *iter,
+			    const struct liberio_buf *buf)
+{
+	size_t len = buf->valid_bytes < buf->len ? buf->valid_bytes : buf->len;
+
+	liberio_chdr_iter_init_mem(iter, buf->mem, len);
+}
+
+/*
+ * liberio_chdr_iter_next - Decode the next packet
+ * @iter: the iterator
+ * @pkt: output for the packet
+ *
+ * Every packet is checked against what is left of the buffer before
+ * anything in it is handed out. After an error the iterator stays at the
+ * broken packet.
+ *
+ * Returns 1 if @pkt holds a packet, 0 if there are no more or -EBADMSG
+ * if a length is off.
+ */
+int liberio_chdr_iter_next(struct liberio_chdr_iter *iter,
+			   struct liberio_chdr_pkt *pkt)
+{
+	size_t left = iter->end - iter->pos, hdr_len;
+	uint64_t hdr;
+
+	if (left < CHDR_HDR_LEN)
+		return 0;
+
+	/* buffers come from the driver, don't assume anything on alignment */
+	memcpy(&hdr, iter->pos, sizeof(hdr));
+
+	/* padding up to the end of a fixed size block */
+	if (!hdr)
+		return 0;
+
+	pkt->type = (hdr >> 62) & 0x3;
+	pkt->has_time = (hdr >> 61) & 0x1;
+	pkt->eob = (hdr >> 60) & 0x1;
+	pkt->seq = (hdr >> 48) & 0xfff;
+	pkt->length = (hdr >> 32) & 0xffff;
+	pkt->sid = hdr & 0xffffffff;
+
+	hdr_len = CHDR_HDR_LEN + (pkt->has_time ? CHDR_TIME_LEN : 0);
+
+	if (unlikely(pkt->length < hdr_len || pkt->length > left))
+		return -EBADMSG;
+
+	if (pkt->has_time)
+		memcpy(&pkt->timestamp, iter->pos + CHDR_HDR_LEN,
+		       sizeof(pkt->timestamp));
+	else
+		pkt->timestamp = 0;
+
+	pkt->payload = iter->pos + hdr_len;
+	pkt->payload_len = pkt->length - hdr_len;
+
+	/* the last packet may end without padding */
+	iter->pos += CHDR_ALIGN(pkt->length) < left ? CHDR_ALIGN(pkt->length)
+						     : left;
+
+	return 1;
+}
+
+struct liberio_chdr_packer {
+	struct liberio_chan *chan;
+	struct liberio_chdr_packer_attr attr;
+
+	/* buffer being filled, NULL until the next add */
+	struct liberio_buf *buf;
+	size_t limit;
+	size_t used;
+	size_t npkts;
+	uint64_t deadline_us;
+};
+
+/*
+ * liberio_chan_alloc_packer - Set up packet coalescing on a TX channel
+ * @chan: the liberio channel, with buffers requested
+ * @attr: flush conditions, NULL to flush only full buffers
+ *
+ * The packer takes a reference on @chan and gets its buffers through
+ * liberio_chan_buf_dequeue(), mixing in direct enqueues is fine.
+ */
+struct liberio_chdr_packer *
+liberio_chan_alloc_packer(struct liberio_chan *chan,
+			  const struct liberio_chdr_packer_attr *attr)
+{
+	struct liberio_chdr_packer *packer;
+
+	if (chan->dir != TX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	packer = calloc(1, sizeof(*packer));
+	if (!packer)
+		return NULL;
+
+	if (attr)
+		packer->attr = *attr;
+
+	liberio_chan_get(chan);
+	packer->chan = chan;
+
+	return packer;
+}
+
+/* pending packets get sent first */
+void liberio_chdr_packer_free(struct liberio_chdr_packer *packer)
+{
+	if (!packer)
+		return;
+
+	liberio_chdr_packer_flush(packer);
+	liberio_chan_put(packer->chan);
+	free(packer);
+}
+
+/*
+ * liberio_chdr_packer_flush - Enqueue the buffer being filled
+ * @packer: the packer
+ *
+ * Returns 0, also if there was nothing to send, or a negative error code,
+ * in which case the packets stay pending.
+ */
+int liberio_chdr_packer_flush(struct liberio_chdr_packer *packer)
+{
+	struct liberio_buf *buf = packer->buf;
+	int err;
+
+	if (!buf)
+		return 0;
+
+	buf->valid_bytes = packer->used;
+
+	err = liberio_chan_buf_enqueue(packer->chan, buf);
+	if (err)
+		return -errno;
+
+	packer->buf = NULL;
+
+	return 0;
+}
+
+static int __liberio_chdr_packer_get_buf(struct liberio_chdr_packer *packer,
+					 int timeout)
+{
+	struct liberio_buf *buf;
+
+	buf = liberio_chan_buf_dequeue(packer->chan, timeout);
+	if (!buf)
+		return -EAGAIN;
+
+	packer->buf = buf;
+	packer->used = 0;
+	packer->npkts = 0;
+
+	packer->limit = buf->len;
+	if (packer->attr.max_bytes && packer->attr.max_bytes < packer->limit)
+		packer->limit = packer->attr.max_bytes;
+
+	if (packer->attr.max_delay_us)
+		packer->deadline_us = __liberio_get_time_us()
+				      + packer->attr.max_delay_us;
+
+	return 0;
+}
+
+/*
+ * liberio_chdr_packer_add - Append a packet
+ * @packer: the packer
+ * @hdr: header fields of the packet, length and payload are ignored
+ * @payload: the payload, copied
+ * @len: length of @payload
+ * @timeout: how long to wait for a free buffer in us, negative for
+ * forever
+ *
+ * Returns 0, -EAGAIN if no buffer became free in time, -EMSGSIZE if the
+ * packet can never fit or another negative error code from a flush.
+ */
+int liberio_chdr_packer_add(struct liberio_chdr_packer *packer,
+			    const struct liberio_chdr_pkt *hdr,
+			    const void *payload, size_t len, int timeout)
+{
+	size_t hdr_len = CHDR_HDR_LEN + (hdr->has_time ? CHDR_TIME_LEN : 0);
+	size_t pkt_len = hdr_len + len, aligned = CHDR_ALIGN(pkt_len);
+	uint64_t word;
+	uint8_t *pos;
+	int err;
+
+	if (pkt_len > CHDR_MAX_LEN)
+		return -EMSGSIZE;
+
+	/* a packet that doesn't fit behind the others goes first in the next */
+	if (packer->buf && packer->used + pkt_len > packer->limit) {
+		err = liberio_chdr_packer_flush(packer);
+		if (err)
+			return err;
+	}
+
+	if (!packer->buf) {
+		err = __liberio_chdr_packer_get_buf(packer, timeout);
+		if (err)
+			return err;
+
+		if (pkt_len > packer->limit)
+			return -EMSGSIZE;
+	}
+
+	pos = (uint8_t *)packer->buf->mem + packer->used;
+
+	word = ((uint64_t)(hdr->type & 0x3) << 62)
+		| ((uint64_t)!!hdr->has_time << 61)
+		| ((uint64_t)!!hdr->eob << 60)
+		| ((uint64_t)(hdr->seq & 0xfff) << 48)
+		| ((uint64_t)pkt_len << 32)
+		| hdr->sid;
+	memcpy(pos, &word, sizeof(word));
+
+	if (hdr->has_time)
+		memcpy(pos + CHDR_HDR_LEN, &hdr->timestamp,
+		       sizeof(hdr->timestamp));
+
+	memcpy(pos + hdr_len, payload, len);
+
+	/* don't send whatever the buffer held before as padding */
+	if (aligned > pkt_len && packer->used + aligned <= packer->buf->len) {
+		memset(pos + pkt_len, 0, aligned - pkt_len);
+		packer->used += aligned;
+	} else {
+		packer->used += pkt_len;
+	}
+	packer->npkts++;
+
+	if (packer->used >= packer->limit
+	    || (packer->attr.max_pkts && packer->npkts >= packer->attr.max_pkts)
+	    || (packer->attr.max_delay_us
+		&& __liberio_get_time_us() >= packer->deadline_us))
+		return liberio_chdr_packer_flush(packer);
+
+	return 0;
+}
+
+/*
+ * liberio_chdr_packer_poll - Flush the pending buffer if it is due
+ * @packer: the packer
+ *
+ * Returns the us left until the pending buffer is due, 0 if nothing is
+ * waiting for a deadline or a negative error code from the flush.
+ */
+int liberio_chdr_packer_poll(struct liberio_chdr_packer *packer)
+{
+	uint64_t now;
+
+	if (!packer->buf || !packer->attr.max_delay_us)
+		return 0;
+
+	now = __liberio_get_time_us();
+	if (now < packer->deadline_us)
+		return packer->deadline_us - now;
+
+	return liberio_chdr_packer_flush(packer);
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <arm_neon.h>
+
+#include "convert.h"
+
+static inline int16x8_t __liberio_neon_bswap(int16x8_t x)
+{
+	return vreinterpretq_s16_u8(vrev16q_u8(vreinterpretq_u8_s16(x)));
+}
+
+/* NEON is mandatory on the targets this gets built for */
+static int __liberio_neon_supported(void)
+{
+	return 1;
+}
+
+static void __liberio_sc16_to_fc32_neon(float *out, const int16_t *in,
+					size_t n, float scale, int bswap)
+{
+	int16x8_t x;
+	size_t i;
+
+	/* 4 complex samples, 8 values per round */
+	for (i = 0; i + 4 <= n; i += 4) {
+		x = vld1q_s16(in + 2 * i);
+		if (bswap)
+			x = __liberio_neon_bswap(x);
+
+		vst1q_f32(out + 2 * i,
+			  vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))),
+				      scale));
+		vst1q_f32(out + 2 * i + 4,
+			  vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))),
+				      scale));
+	}
+
+	__liberio_convert_scalar.sc16_to_fc32(out + 2 * i, in + 2 * i, n - i,
+					      scale, bswap);
+}
+
+/* v has to be clamped to the sc16 range and free of NaNs */
+static inline int32x4_t __liberio_neon_round(float32x4_t v)
+{
+#ifdef __aarch64__
+	return vcvtnq_s32_f32(v);
+#else
+	/*
+	 * ARMv7 only converts by truncating. Adding 1.5 * 2^23 leaves no
+	 * fraction bits, so the add itself rounds to nearest even like
+	 * lrintf() and the integer ends up in the low mantissa bits.
+	 */
+	const float32x4_t magic = vdupq_n_f32(12582912.0f);
+
+	return vsubq_s32(vreinterpretq_s32_f32(vaddq_f32(v, magic)),
+			 vreinterpretq_s32_f32(magic));
+#endif
+}
+
+static inline float32x4_t __liberio_neon_zero_nan(float32x4_t v)
+{
+	return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v),
+					       vceqq_f32(v, v)));
+}
+
+static void __liberio_fc32_to_sc16_neon(int16_t *out, const float *in,
+					size_t n, float scale, int bswap)
+{
+	const float32x4_t min = vdupq_n_f32(-32768.0f);
+	const float32x4_t max = vdupq_n_f32(32767.0f);
+	float32x4_t a, b;
+	int16x8_t x;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a = vmulq_n_f32(vld1q_f32(in + 2 * i), scale);
+		b = vmulq_n_f32(vld1q_f32(in + 2 * i + 4), scale);
+
+		/* NaN lanes become 0, same as the scalar kernel */
+		a = __liberio_neon_zero_nan(a);
+		b = __liberio_neon_zero_nan(b);
+		a = vminq_f32(vmaxq_f32(a, min), max);
+		b = vminq_f32(vmaxq_f32(b, min), max);
+
+		x = vcombine_s16(vqmovn_s32(__liberio_neon_round(a)),
+				 vqmovn_s32(__liberio_neon_round(b)));
+		if (bswap)
+			x = __liberio_neon_bswap(x);
+
+		vst1q_s16(out + 2 * i, x);
+	}
+
+	__liberio_convert_scalar.fc32_to_sc16(out + 2 * i, in + 2 * i, n - i,
+					      scale, bswap);
+}
+
+static void __liberio_sc16_to_sc8_neon(int8_t *out, const int16_t *in,
+				       size_t n, int bswap)
+{
+	int16x8_t a, b;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = vld1q_s16(in + 2 * i);
+		b = vld1q_s16(in + 2 * i + 8);
+		if (bswap) {
+			a = __liberio_neon_bswap(a);
+			b = __liberio_neon_bswap(b);
+		}
+
+		vst1q_s8(out + 2 * i, vcombine_s8(vshrn_n_s16(a, 8),
+						  vshrn_n_s16(b, 8)));
+	}
+
+	__liberio_convert_scalar.sc16_to_sc8(out + 2 * i, in + 2 * i, n - i,
+					     bswap);
+}
+
+static void __liberio_sc8_to_sc16_neon(int16_t *out, const int8_t *in,
+				       size_t n, int bswap)
+{
+	int16x8_t lo, hi;
+	int8x16_t x;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = vld1q_s8(in + 2 * i);
+
+		lo = vshll_n_s8(vget_low_s8(x), 8);
+		hi = vshll_n_s8(vget_high_s8(x), 8);
+		if (bswap) {
+			lo = __liberio_neon_bswap(lo);
+			hi = __liberio_neon_bswap(hi);
+		}
+
+		vst1q_s16(out + 2 * i, lo);
+		vst1q_s16(out + 2 * i + 8, hi);
+	}
+
+	__liberio_convert_scalar.sc8_to_sc16(out + 2 * i, in + 2 * i, n - i,
+					     bswap);
+}
+
+static void __liberio_sc12_to_sc16_neon(int16_t *out, const uint8_t *in,
+					size_t n)
+{
+	uint8x8x3_t b;
+	int16x8x2_t iq;
+	uint16x8_t v;
+	size_t i;
+
+	/* the de-interleaving loads do 8 samples, 24 bytes, at a time */
+	for (i = 0; i + 8 <= n; i += 8) {
+		b = vld3_u8(in + 3 * i);
+
+		v = vorrq_u16(vmovl_u8(b.val[0]), vshll_n_u8(b.val[1], 8));
+		iq.val[0] = vreinterpretq_s16_u16(vshlq_n_u16(v, 4));
+
+		v = vorrq_u16(vmovl_u8(b.val[1]), vshll_n_u8(b.val[2], 8));
+		iq.val[1] = vreinterpretq_s16_u16(vandq_u16(v,
+							    vdupq_n_u16(0xfff0)));
+
+		vst2q_s16(out + 2 * i, iq);
+	}
+
+	__liberio_convert_scalar.sc12_to_sc16(out + 2 * i, in + 3 * i, n - i);
+}
+
+static void __liberio_sc16_to_sc12_neon(uint8_t *out, const int16_t *in,
+					size_t n)
+{
+	uint16x8_t i12, q12;
+	int16x8x2_t iq;
+	uint8x8x3_t b;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		iq = vld2q_s16(in + 2 * i);
+
+		i12 = vshrq_n_u16(vreinterpretq_u16_s16(iq.val[0]), 4);
+		q12 = vshrq_n_u16(vreinterpretq_u16_s16(iq.val[1]), 4);
+
+		b.val[0] = vmovn_u16(i12);
+		b.val[1] = vmovn_u16(vorrq_u16(vshrq_n_u16(i12, 8),
+					       vshlq_n_u16(q12, 4)));
+		b.val[2] = vshrn_n_u16(q12, 4);
+
+		vst3_u8(out + 3 * i, b);
+	}
+
+	__liberio_convert_scalar.sc16_to_sc12(out + 3 * i, in + 2 * i, n - i);
+}
+
+const struct liberio_convert_ops __liberio_convert_neon = {
+	.name		=	"neon",
+	.supported	=	__liberio_neon_supported,
+	.sc16_to_fc32	=	__liberio_sc16_to_fc32_neon,
+	.fc32_to_sc16	=	__liberio_fc32_to_sc16_neon,
+	.sc16_to_sc8	=	__liberio_sc16_to_sc8_neon,
+	.sc8_to_sc16	=	__liberio_sc8_to_sc16_neon,
+	.sc12_to_sc16	=	__liberio_sc12_to_sc16_neon,
+	.sc16_to_sc12	=	__liberio_sc16_to_sc12_neon,
+};
+
+#endif /* __ARM_NEON || __aarch64__ */
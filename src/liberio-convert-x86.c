@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "convert.h"
+
+/*
+ * The kernels carry their own target attribute, so the library builds
+ * for the baseline ISA and only runs them after the CPU check.
+ */
+#define SSSE3	__attribute__((target("ssse3")))
+#define AVX2	__attribute__((target("avx2")))
+
+/* swap the bytes of every 16 bit value */
+#define BSWAP16_MASK \
+	14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1
+
+static SSSE3 int __liberio_ssse3_supported(void)
+{
+	return __builtin_cpu_supports("ssse3");
+}
+
+static SSSE3 void __liberio_sc16_to_fc32_ssse3(float *out, const int16_t *in,
+					       size_t n, float scale, int bswap)
+{
+	const __m128i swap = _mm_set_epi8(BSWAP16_MASK);
+	const __m128 s = _mm_set1_ps(scale);
+	__m128i x, lo, hi;
+	size_t i;
+
+	/* 4 complex samples, 8 values per round */
+	for (i = 0; i + 4 <= n; i += 4) {
+		x = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+		if (bswap)
+			x = _mm_shuffle_epi8(x, swap);
+
+		lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+		_mm_storeu_ps(out + 2 * i, _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+		_mm_storeu_ps(out + 2 * i + 4,
+			      _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+	}
+
+	__liberio_convert_scalar.sc16_to_fc32(out + 2 * i, in + 2 * i, n - i,
+					      scale, bswap);
+}
+
+static SSSE3 void __liberio_fc32_to_sc16_ssse3(int16_t *out, const float *in,
+					       size_t n, float scale, int bswap)
+{
+	const __m128i swap = _mm_set_epi8(BSWAP16_MASK);
+	const __m128 s = _mm_set1_ps(scale);
+	const __m128 min = _mm_set1_ps(-32768.0f);
+	const __m128 max = _mm_set1_ps(32767.0f);
+	__m128 a, b;
+	__m128i x;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a = _mm_mul_ps(_mm_loadu_ps(in + 2 * i), s);
+		b = _mm_mul_ps(_mm_loadu_ps(in + 2 * i + 4), s);
+
+		/*
+		 * Out of range floats and NaN convert to 0x80000000, zero
+		 * the NaNs like the scalar kernel does and clamp the rest.
+		 */
+		a = _mm_and_ps(a, _mm_cmpord_ps(a, a));
+		b = _mm_and_ps(b, _mm_cmpord_ps(b, b));
+		a = _mm_min_ps(_mm_max_ps(a, min), max);
+		b = _mm_min_ps(_mm_max_ps(b, min), max);
+
+		x = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+		if (bswap)
+			x = _mm_shuffle_epi8(x, swap);
+
+		_mm_storeu_si128((__m128i *)(out + 2 * i), x);
+	}
+
+	__liberio_convert_scalar.fc32_to_sc16(out + 2 * i, in + 2 * i, n - i,
+					      scale, bswap);
+}
+
+static SSSE3 void __liberio_sc16_to_sc8_ssse3(int8_t *out, const int16_t *in,
+					      size_t n, int bswap)
+{
+	const __m128i swap = _mm_set_epi8(BSWAP16_MASK);
+	__m128i a, b;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+		b = _mm_loadu_si128((const __m128i *)(in + 2 * i + 8));
+		if (bswap) {
+			a = _mm_shuffle_epi8(a, swap);
+			b = _mm_shuffle_epi8(b, swap);
+		}
+
+		a = _mm_packs_epi16(_mm_srai_epi16(a, 8), _mm_srai_epi16(b, 8));
+		_mm_storeu_si128((__m128i *)(out + 2 * i), a);
+	}
+
+	__liberio_convert_scalar.sc16_to_sc8(out + 2 * i, in + 2 * i, n - i,
+					     bswap);
+}
+
+static SSSE3 void __liberio_sc8_to_sc16_ssse3(int16_t *out, const int8_t *in,
+					      size_t n, int bswap)
+{
+	const __m128i swap = _mm_set_epi8(BSWAP16_MASK);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i x, lo, hi;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+
+		/* the byte lands in the upper half, that's the << 8 */
+		lo = _mm_unpacklo_epi8(zero, x);
+		hi = _mm_unpackhi_epi8(zero, x);
+		if (bswap) {
+			lo = _mm_shuffle_epi8(lo, swap);
+			hi = _mm_shuffle_epi8(hi, swap);
+		}
+
+		_mm_storeu_si128((__m128i *)(out + 2 * i), lo);
+		_mm_storeu_si128((__m128i *)(out + 2 * i + 8), hi);
+	}
+
+	__liberio_convert_scalar.sc8_to_sc16(out + 2 * i, in + 2 * i, n - i,
+					     bswap);
+}
+
+static SSSE3 void __liberio_sc12_to_sc16_ssse3(int16_t *out, const uint8_t *in,
+					       size_t n)
+{
+	/* per sample b0 b1 b2: I from b0 b1, Q from b1 b2 */
+	const __m128i spread = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5,
+					     6, 7, 7, 8, 9, 10, 10, 11);
+	const __m128i i_mask = _mm_set1_epi32(0x0000ffff);
+	const __m128i q_mask = _mm_set1_epi32(0xfff00000);
+	__m128i x;
+	size_t i;
+
+	/* 4 samples from 12 bytes, the 16 byte load must stay in bounds */
+	for (i = 0; i + 6 <= n; i += 4) {
+		x = _mm_loadu_si128((const __m128i *)(in + 3 * i));
+		x = _mm_shuffle_epi8(x, spread);
+		x = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(x, 4), i_mask),
+				 _mm_and_si128(x, q_mask));
+		_mm_storeu_si128((__m128i *)(out + 2 * i), x);
+	}
+
+	__liberio_convert_scalar.sc12_to_sc16(out + 2 * i, in + 3 * i, n - i);
+}
+
+static SSSE3 void __liberio_sc16_to_sc12_ssse3(uint8_t *out, const int16_t *in,
+					       size_t n)
+{
+	const __m128i squeeze = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+					      10, 12, 13, 14, -1, -1, -1, -1);
+	const __m128i i_mask = _mm_set1_epi32(0x0000fff0);
+	const __m128i q_mask = _mm_set1_epi32(0x00fff000);
+	__m128i x;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		x = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+
+		/* I and Q as 24 bits per 32 bit lane, then drop the 4th byte */
+		x = _mm_or_si128(_mm_srli_epi32(_mm_and_si128(x, i_mask), 4),
+				 _mm_and_si128(_mm_srli_epi32(x, 8), q_mask));
+		x = _mm_shuffle_epi8(x, squeeze);
+
+		_mm_storel_epi64((__m128i *)(out + 3 * i), x);
+		*(uint32_t *)(out + 3 * i + 8) =
+			_mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+	}
+
+	__liberio_convert_scalar.sc16_to_sc12(out + 3 * i, in + 2 * i, n - i);
+}
+
+const struct liberio_convert_ops __liberio_convert_ssse3 = {
+	.name		=	"ssse3",
+	.supported	=	__liberio_ssse3_supported,
+	.sc16_to_fc32	=	__liberio_sc16_to_fc32_ssse3,
+	.fc32_to_sc16	=	__liberio_fc32_to_sc16_ssse3,
+	.sc16_to_sc8	=	__liberio_sc16_to_sc8_ssse3,
+	.sc8_to_sc16	=	__liberio_sc8_to_sc16_ssse3,
+	.sc12_to_sc16	=	__liberio_sc12_to_sc16_ssse3,
+	.sc16_to_sc12	=	__liberio_sc16_to_sc12_ssse3,
+};
+
+static AVX2 int __liberio_avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+static AVX2 void __liberio_sc16_to_fc32_avx2(float *out, const int16_t *in,
+					     size_t n, float scale, int bswap)
+{
+	const __m128i swap = _mm_set_epi8(BSWAP16_MASK);
+	const __m256 s = _mm256_set1_ps(scale);
+	__m128i a, b;
+	size_t i;
+
+	/* 8 complex samples, 16 values per round */
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+		b = _mm_loadu_si128((const __m128i *)(in + 2 * i + 8));
+		if (bswap) {
+			a = _mm_shuffle_epi8(a, swap);
+			b = _mm_shuffle_epi8(b, swap);
+		}
+
+		_mm256_storeu_ps(out + 2 * i,
+			_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a)), s));
+		_mm256_storeu_ps(out + 2 * i + 8,
+			_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b)), s));
+	}
+
+	__liberio_convert_scalar.sc16_to_fc32(out + 2 * i, in + 2 * i, n - i,
+					      scale, bswap);
+}
+
+static AVX2 void __liberio_fc32_to_sc16_avx2(int16_t *out, const float *in,
+					     size_t n, float scale, int bswap)
+{
+	const __m256i swap = _mm256_set_epi8(BSWAP16_MASK, BSWAP16_MASK);
+	const __m256 s = _mm256_set1_ps(scale);
+	const __m256 min = _mm256_set1_ps(-32768.0f);
+	const __m256 max = _mm256_set1_ps(32767.0f);
+	__m256 a, b;
+	__m256i x;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = _mm256_mul_ps(_mm256_loadu_ps(in + 2 * i), s);
+		b = _mm256_mul_ps(_mm256_loadu_ps(in + 2 * i + 8), s);
+
+		a = _mm256_and_ps(a, _mm256_cmp_ps(a, a, _CMP_ORD_Q));
+		b = _mm256_and_ps(b, _mm256_cmp_ps(b, b, _CMP_ORD_Q));
+		a = _mm256_min_ps(_mm256_max_ps(a, min), max);
+		b = _mm256_min_ps(_mm256_max_ps(b, min), max);
+
+		/* packs works per 128 bit lane, put the quarters back in order */
+		x = _mm256_packs_epi32(_mm256_cvtps_epi32(a),
+				       _mm256_cvtps_epi32(b));
+		x = _mm256_permute4x64_epi64(x, 0xd8);
+		if (bswap)
+			x = _mm256_shuffle_epi8(x, swap);
+
+		_mm256_storeu_si256((__m256i *)(out + 2 * i), x);
+	}
+
+	__liberio_convert_scalar.fc32_to_sc16(out + 2 * i, in + 2 * i, n - i,
+					      scale, bswap);
+}
+
+static AVX2 void __liberio_sc16_to_sc8_avx2(int8_t *out, const int16_t *in,
+					    size_t n, int bswap)
+{
+	const __m256i swap = _mm256_set_epi8(BSWAP16_MASK, BSWAP16_MASK);
+	__m256i a, b;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		a = _mm256_loadu_si256((const __m256i *)(in + 2 * i));
+		b = _mm256_loadu_si256((const __m256i *)(in + 2 * i + 16));
+		if (bswap) {
+			a = _mm256_shuffle_epi8(a, swap);
+			b = _mm256_shuffle_epi8(b, swap);
+		}
+
+		a = _mm256_packs_epi16(_mm256_srai_epi16(a, 8),
+				       _mm256_srai_epi16(b, 8));
+		a = _mm256_permute4x64_epi64(a, 0xd8);
+		_mm256_storeu_si256((__m256i *)(out + 2 * i), a);
+	}
+
+	__liberio_sc16_to_sc8_ssse3(out + 2 * i, in + 2 * i, n - i, bswap);
+}
+
+static AVX2 void __liberio_sc8_to_sc16_avx2(int16_t *out, const int8_t *in,
+					    size_t n, int bswap)
+{
+	const __m256i swap = _mm256_set_epi8(BSWAP16_MASK, BSWAP16_MASK);
+	__m256i lo, hi;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		lo = _mm256_cvtepi8_epi16(
+			_mm_loadu_si128((const __m128i *)(in + 2 * i)));
+		hi = _mm256_cvtepi8_epi16(
+			_mm_loadu_si128((const __m128i *)(in + 2 * i + 16)));
+
+		lo = _mm256_slli_epi16(lo, 8);
+		hi = _mm256_slli_epi16(hi, 8);
+		if (bswap) {
+			lo = _mm256_shuffle_epi8(lo, swap);
+			hi = _mm256_shuffle_epi8(hi, swap);
+		}
+
+		_mm256_storeu_si256((__m256i *)(out + 2 * i), lo);
+		_mm256_storeu_si256((__m256i *)(out + 2 * i + 16), hi);
+	}
+
+	__liberio_sc8_to_sc16_ssse3(out + 2 * i, in + 2 * i, n - i, bswap);
+}
+
+/*
+ * sc12 moves 3 byte groups across the 128 bit lanes, which AVX2 shuffles
+ * can't do, the SSSE3 kernels are as fast as it gets here.
+ */
+const struct liberio_convert_ops __liberio_convert_avx2 = {
+	.name		=	"avx2",
+	.supported	=	__liberio_avx2_supported,
+	.sc16_to_fc32	=	__liberio_sc16_to_fc32_avx2,
+	.fc32_to_sc16	=	__liberio_fc32_to_sc16_avx2,
+	.sc16_to_sc8	=	__liberio_sc16_to_sc8_avx2,
+	.sc8_to_sc16	=	__liberio_sc8_to_sc16_avx2,
+	.sc12_to_sc16	=	__liberio_sc12_to_sc16_ssse3,
+	.sc16_to_sc12	=	__liberio_sc16_to_sc12_ssse3,
+};
+
+#endif /* __x86_64__ || __i386__ */
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <liberio/convert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "priv.h"
+#include "util.h"
+#include "convert.h"
+
+static inline int16_t __liberio_sc16_load(const int16_t *p, int bswap)
+{
+	return bswap ? (int16_t)__builtin_bswap16(*p) : *p;
+}
+
+static inline void __liberio_sc16_store(int16_t *p, int16_t v, int bswap)
+{
+	*p = bswap ? (int16_t)__builtin_bswap16(v) : v;
+}
+
+static void __liberio_sc16_to_fc32_scalar(float *out, const int16_t *in,
+					  size_t n, float scale, int bswap)
+{
+	size_t i;
+
+	for (i = 0; i < 2 * n; i++)
+		out[i] = (float)__liberio_sc16_load(in + i, bswap) * scale;
+}
+
+static void __liberio_fc32_to_sc16_scalar(int16_t *out, const float *in,
+					  size_t n, float scale, int bswap)
+{
+	float v;
+	size_t i;
+
+	for (i = 0; i < 2 * n; i++) {
+		v = in[i] * scale;
+		/* NaN has no sc16 value, every kernel turns it into 0 */
+		v = v == v ? v : 0.0f;
+		v = v < -32768.0f ? -32768.0f : v;
+		v = v > 32767.0f ? 32767.0f : v;
+		/* nearest, ties to even, same as the vector conversions */
+		__liberio_sc16_store(out + i, (int16_t)lrintf(v), bswap);
+	}
+}
+
+static void __liberio_sc16_to_sc8_scalar(int8_t *out, const int16_t *in,
+					 size_t n, int bswap)
+{
+	size_t i;
+
+	for (i = 0; i < 2 * n; i++)
+		out[i] = __liberio_sc16_load(in + i, bswap) >> 8;
+}
+
+static void __liberio_sc8_to_sc16_scalar(int16_t *out, const int8_t *in,
+					 size_t n, int bswap)
+{
+	size_t i;
+
+	for (i = 0; i < 2 * n; i++)
+		__liberio_sc16_store(out + i, (int16_t)((uint8_t)in[i] << 8),
+				     bswap);
+}
+
+static void __liberio_sc12_to_sc16_scalar(int16_t *out, const uint8_t *in,
+					  size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++, in += 3) {
+		out[2 * i] = (int16_t)((in[0] | in[1] << 8) << 4);
+		out[2 * i + 1] = (int16_t)((in[1] | in[2] << 8) & 0xfff0);
+	}
+}
+
+static void __liberio_sc16_to_sc12_scalar(uint8_t *out, const int16_t *in,
+					  size_t n)
+{
+	uint16_t i12, q12;
+	size_t i;
+
+	for (i = 0; i < n; i++, out += 3) {
+		i12 = (uint16_t)in[2 * i] >> 4;
+		q12 = (uint16_t)in[2 * i + 1] >> 4;
+		out[0] = i12;
+		out[1] = (i12 >> 8) | (q12 << 4);
+		out[2] = q12 >> 4;
+	}
+}
+
+static int __liberio_convert_always(void)
+{
+	return 1;
+}
+
+const struct liberio_convert_ops __liberio_convert_scalar = {
+	.name		=	"scalar",
+	.supported	=	__liberio_convert_always,
+	.sc16_to_fc32	=	__liberio_sc16_to_fc32_scalar,
+	.fc32_to_sc16	=	__liberio_fc32_to_sc16_scalar,
+	.sc16_to_sc8	=	__liberio_sc16_to_sc8_scalar,
+	.sc8_to_sc16	=	__liberio_sc8_to_sc16_scalar,
+	.sc12_to_sc16	=	__liberio_sc12_to_sc16_scalar,
+	.sc16_to_sc12	=	__liberio_sc16_to_sc12_scalar,
+};
+
+/* best first */
+static const struct liberio_convert_ops *const liberio_convert_impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	&__liberio_convert_avx2,
+	&__liberio_convert_ssse3,
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+	&__liberio_convert_neon,
+#endif
+	&__liberio_convert_scalar,
+};
+
+#define LIBERIO_CONVERT_NIMPLS \
+	(sizeof(liberio_convert_impls) / sizeof(liberio_convert_impls[0]))
+
+static const struct liberio_convert_ops *liberio_convert_ops;
+
+static const struct liberio_convert_ops *__liberio_convert_find(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < LIBERIO_CONVERT_NIMPLS; i++) {
+		if (name && strcmp(name, liberio_convert_impls[i]->name))
+			continue;
+		if (liberio_convert_impls[i]->supported())
+			return liberio_convert_impls[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Picked on first use, racing callers pick the same and the store is
+ * atomic, so there is nothing to lock.
+ */
+static const struct liberio_convert_ops *__liberio_convert_get(void)
+{
+	const struct liberio_convert_ops *ops;
+
+	ops = __atomic_load_n(&liberio_convert_ops, __ATOMIC_RELAXED);
+	if (likely(ops != NULL))
+		return ops;
+
+	ops = __liberio_convert_find(getenv("LIBERIO_CONVERT"));
+	if (!ops)
+		ops = __liberio_convert_find(NULL);
+
+	__atomic_store_n(&liberio_convert_ops, ops, __ATOMIC_RELAXED);
+
+	return ops;
+}
+
+const char *liberio_convert_get_impl(void)
+{
+	return __liberio_convert_get()->name;
+}
+
+/*
+ * liberio_convert_set_impl - Force a set of kernels
+ * @name: the kernels' name, NULL for the best the CPU runs
+ *
+ * Returns 0, -ENOENT if there are no such kernels or -ENOTSUP if the CPU
+ * can't run them.
+ */
+int liberio_convert_set_impl(const char *name)
+{
+	const struct liberio_convert_ops *ops;
+	size_t i;
+
+	ops = __liberio_convert_find(name);
+	if (!ops) {
+		for (i = 0; i < LIBERIO_CONVERT_NIMPLS; i++)
+			if (!strcmp(name, liberio_convert_impls[i]->name))
+				return -ENOTSUP;
+		return -ENOENT;
+	}
+
+	__atomic_store_n(&liberio_convert_ops, ops, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+void liberio_convert_sc16_to_fc32(float *out, const int16_t *in, size_t n,
+				  float scale, unsigned int flags)
+{
+	__liberio_convert_get()->sc16_to_fc32(out, in, n, scale,
+					      flags & LIBERIO_CONVERT_BSWAP);
+}
+
+void liberio_convert_fc32_to_sc16(int16_t *out, const float *in, size_t n,
+				  float scale, unsigned int flags)
+{
+	__liberio_convert_get()->fc32_to_sc16(out, in, n, scale,
+					      flags & LIBERIO_CONVERT_BSWAP);
+}
+
+void liberio_convert_sc16_to_sc8(int8_t *out, const int16_t *in, size_t n,
+				 unsigned int flags)
+{
+	__liberio_convert_get()->sc16_to_sc8(out, in, n,
+					     flags & LIBERIO_CONVERT_BSWAP);
+}
+
+void liberio_convert_sc8_to_sc16(int16_t *out, const int8_t *in, size_t n,
+				 unsigned int flags)
+{
+	__liberio_convert_get()->sc8_to_sc16(out, in, n,
+					     flags & LIBERIO_CONVERT_BSWAP);
+}
+
+void liberio_convert_sc12_to_sc16(int16_t *out, const uint8_t *in, size_t n)
+{
+	__liberio_convert_get()->sc12_to_sc16(out, in, n);
+}
+
+void liberio_convert_sc16_to_sc12(uint8_t *out, const int16_t *in, size_t n)
+{
+	__liberio_convert_get()->sc16_to_sc12(out, in, n);
+}
+
+/*
+ * liberio_buf_read_fc32 - Convert the sc16 samples of an RX buffer
+ * @buf: the buffer, dequeued
+ * @out: output for up to @max samples
+ * @max: size of @out in complex samples
+ * @scale: applied to every value
+ * @flags: LIBERIO_CONVERT_*
+ *
+ * Reads the mapped DMA memory directly, there is no intermediate copy.
+ *
+ * Returns the number of samples converted.
+ */
+size_t liberio_buf_read_fc32(const struct liberio_buf *buf, float *out,
+			     size_t max, float scale, unsigned int flags)
+{
+	size_t len = buf->valid_bytes < buf->len ? buf->valid_bytes : buf->len;
+	size_t n = len / (2 * sizeof(int16_t));
+
+	if (n > max)
+		n = max;
+
+	liberio_convert_sc16_to_fc32(out, buf->mem, n, scale, flags);
+
+	return n;
+}
+
+/*
+ * liberio_buf_write_fc32 - Fill a TX buffer with sc16 samples
+ * @buf: the buffer, owned by the application
+ * @in: @n complex samples
+ * @n: number of samples
+ * @scale: applied to every value
+ * @flags: LIBERIO_CONVERT_*
+ *
+ * Writes straight into the mapped DMA memory and sets the payload.
+ *
+ * Returns the number of samples converted, less than @n if the buffer is
+ * too small.
+ */
+size_t liberio_buf_write_fc32(struct liberio_buf *buf, const float *in,
+			      size_t n, float scale, unsigned int flags)
+{
+	size_t max = buf->len / (2 * sizeof(int16_t));
+
+	if (n > max)
+		n = max;
+
+	liberio_convert_fc32_to_sc16(buf->mem, in, n, scale, flags);
+	buf->valid_bytes = n * 2 * sizeof(int16_t);
+
+	return n;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+
+#ifdef LIBERIO_HAVE_UDEV
+#include <libudev.h>
+#endif
+
+#include "priv.h"
+#include "clog.h"
+#include "kernel.h"
+#include "util.h"
+
+/* the driver doesn't tell, REQBUFS grants what it can within this */
+#define LIBERIO_DEFAULT_MAX_BUFS 1024
+
+static int __liberio_dev_open(struct liberio_chan *chan, const char *file)
+{
+	struct stat statbuf;
+
+	/*
+	 * The fd is opened non-blocking, USRPIOC_DQBUF returns -EAGAIN
+	 * instead of sleeping when no buffer is ready, readiness is
+	 * signalled through poll/select/epoll on the fd.
+	 */
+	chan->fd = open(file, O_RDWR | O_NONBLOCK);
+	if (chan->fd < 0) {
+		ctx_warn(chan->ctx, "Failed to open device");
+		return -errno;
+	}
+
+	if (fstat(chan->fd, &statbuf) < 0 || !S_ISCHR(statbuf.st_mode)) {
+		close(chan->fd);
+		return -ENODEV;
+	}
+
+	chan->devnum = statbuf.st_rdev;
+	chan->fd_events = (chan->dir == RX) ? POLLIN : POLLOUT;
+
+	/* everything the library needs from sysfs, read once */
+	chan->port = __liberio_sysfs_read_int(chan->devnum, "port");
+	if (chan->port < 0)
+		chan->port = __liberio_port_from_name(file);
+	chan->api_maj = __liberio_sysfs_read_int(chan->devnum, "api_maj");
+	chan->api_min = __liberio_sysfs_read_int(chan->devnum, "api_min");
+
+	chan->max_bufs = LIBERIO_DEFAULT_MAX_BUFS;
+
+	return 0;
+}
+
+static void __liberio_dev_close(struct liberio_chan *chan)
+{
+#ifdef LIBERIO_HAVE_UDEV
+	if (chan->dev)
+		udev_device_unref(chan->dev);
+#endif
+
+	close(chan->fd);
+}
+
+static int __liberio_dev_reqbufs(struct liberio_chan *chan,
+				 struct usrp_requestbuffers *req)
+{
+	return __liberio_ioctl(chan->fd, USRPIOC_REQBUFS, req);
+}
+
+static int __liberio_dev_querybuf(struct liberio_chan *chan,
+				  struct usrp_buffer *breq)
+{
+	return __liberio_ioctl(chan->fd, USRPIOC_QUERYBUF, breq);
+}
+
+static int __liberio_dev_qbuf(struct liberio_chan *chan,
+			      struct usrp_buffer *breq)
+{
+	return __liberio_ioctl(chan->fd, USRPIOC_QBUF, breq);
+}
+
+static int __liberio_dev_dqbuf(struct liberio_chan *chan,
+			       struct usrp_buffer *breq)
+{
+	return __liberio_ioctl(chan->fd, USRPIOC_DQBUF, breq);
+}
+
+static int __liberio_dev_streamon(struct liberio_chan *chan)
+{
+	enum usrp_buf_type type = __to_buf_type(chan);
+
+	return __liberio_ioctl(chan->fd, USRPIOC_STREAMON, (void *)type);
+}
+
+static int __liberio_dev_streamoff(struct liberio_chan *chan)
+{
+	enum usrp_buf_type type = __to_buf_type(chan);
+
+	return __liberio_ioctl(chan->fd, USRPIOC_STREAMOFF, (void *)type);
+}
+
+static int __liberio_dev_expbuf(struct liberio_chan *chan,
+				struct usrp_exportbuffer *breq)
+{
+	return __liberio_ioctl(chan->fd, USRPIOC_EXPBUF, breq);
+}
+
+static int __liberio_dev_set_fmt(struct liberio_chan *chan,
+				 struct usrp_fmt *fmt)
+{
+	return __liberio_ioctl(chan->fd, USRPIOC_SET_FMT, fmt);
+}
+
+static void *__liberio_dev_mmap(struct liberio_chan *chan, size_t len,
+				off_t offset)
+{
+	return mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, chan->fd,
+		    offset);
+}
+
+/*
+ * __liberio_dev_wait - Wait for the channel fd to become ready
+ * @chan: the liberio channel to wait on
+ * @timeout: the timeout to use in us, negative values wait forever
+ *
+ * Returns > 0 if ready, 0 on timeout or a negative error code.
+ */
+static int __liberio_dev_wait(struct liberio_chan *chan, int timeout)
+{
+	fd_set fds;
+	struct timeval tv;
+	struct timeval *tv_ptr = &tv;
+	int err;
+
+	FD_ZERO(&fds);
+	FD_SET(chan->fd, &fds);
+
+	if (timeout >= 0) {
+		tv.tv_sec = timeout / 1000000;
+		tv.tv_usec = timeout % 1000000;
+	} else {
+		tv_ptr = NULL;
+	}
+
+	if (chan->dir == RX)
+		err = select(chan->fd + 1, &fds, NULL, NULL, tv_ptr);
+	else
+		err = select(chan->fd + 1, NULL, &fds, NULL, tv_ptr);
+
+	if (-1 == err) {
+		ctx_warn(chan->ctx, "select failed");
+		return -errno;
+	}
+
+	return err;
+}
+
+const struct liberio_backend_ops __liberio_backend_dev = {
+	.name		=	"dev",
+	.open		=	__liberio_dev_open,
+	.close		=	__liberio_dev_close,
+	.reqbufs	=	__liberio_dev_reqbufs,
+	.querybuf	=	__liberio_dev_querybuf,
+	.qbuf		=	__liberio_dev_qbuf,
+	.dqbuf		=	__liberio_dev_dqbuf,
+	.streamon	=	__liberio_dev_streamon,
+	.streamoff	=	__liberio_dev_streamoff,
+	.expbuf		=	__liberio_dev_expbuf,
+	.set_fmt	=	__liberio_dev_set_fmt,
+	.mmap		=	__liberio_dev_mmap,
+	.wait		=	__liberio_dev_wait,
+};
@@ -1,17 +1,206 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "priv.h"
+#include "clog.h"
+#include "kernel.h"
+#include "util.h"
+
+#define DMA_HEAP_SYSTEM "/dev/dma_heap/system"
+
+/*
+ * With USRP_MEMORY_DMABUF the buffers start out empty, the memory gets
+ * attached per index with liberio_chan_attach_dmabuf() before the buffer
+ * is enqueued for the first time.
+ */
 static int __liberio_buf_init_dmabuf(struct liberio_chan *chan,
 				       struct liberio_buf *buf, size_t index)
 {
-	log_crit(__func__, "Not implemented");
+	buf->index = index;
+	buf->mem = NULL;
+	buf->len = 0;
+	buf->valid_bytes = 0;
+	buf->fd = -1;
+	buf->sync = 0;
 
-	return -ENOTTY;
+	return 0;
 }
 
 static void __liberio_buf_release_dmabuf(struct liberio_buf *buf)
 {
-	log_crit(__func__, "Not implemented");
+	if (!buf)
+		return;
+
+	if (buf->mem)
+		munmap(buf->mem, buf->len);
+
+	if (buf->fd >= 0)
+		close(buf->fd);
+
+	buf->mem = NULL;
+	buf->fd = -1;
 }
 
-const struct liberio_buf_ops liberio_buf_dmabuf_ops = {
+const struct liberio_buf_ops __liberio_buf_dmabuf_ops = {
 	.init		=	__liberio_buf_init_dmabuf,
 	.release	=	__liberio_buf_release_dmabuf,
 };
+
+/*
+ * __liberio_dmabuf_sync - Bracket CPU access to an imported dma-buf
+ * @buf: the liberio buffer
+ * @flags: DMA_BUF_SYNC_START or DMA_BUF_SYNC_END
+ *
+ * Called when a buffer is handed to the application (START) and when it
+ * goes back to the driver (END). Stand-ins such as memfds don't know the
+ * ioctl, that gets detected once at attach time.
+ */
+void __liberio_dmabuf_sync(struct liberio_buf *buf, unsigned int flags)
+{
+	struct dma_buf_sync sync;
+
+	if (!buf->sync)
+		return;
+
+	sync.flags = flags | DMA_BUF_SYNC_RW;
+	__liberio_ioctl(buf->fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+/*
+ * liberio_chan_attach_dmabuf - Attach a dma-buf to a buffer index
+ * @chan: a channel allocated with USRP_MEMORY_DMABUF
+ * @index: the buffer index, must be below liberio_chan_get_num_bufs()
+ * @fd: the dma-buf fd, e.g. from a dma-heap or liberio_chan_export_pool()
+ *
+ * The channel keeps its own duplicate of @fd, the caller may close it
+ * afterwards. The whole dma-buf is used as DMA target and gets mapped so
+ * liberio_buf_get_mem() works as for the other memory types. Attaching
+ * to an index that already has a dma-buf replaces it, which is only
+ * allowed while the buffer is owned by the application.
+ *
+ * Returns 0 on success, -EBUSY if the buffer is queued with the driver
+ * or another negative error code.
+ */
+int liberio_chan_attach_dmabuf(struct liberio_chan *chan, size_t index,
+			       int fd)
+{
+	struct liberio_buf *buf;
+	struct dma_buf_sync sync;
+	off_t len;
+	int dupfd, err;
+
+	if (chan->mem_type != USRP_MEMORY_DMABUF ||
+	    index >= chan->nbufs_alloc)
+		return -EINVAL;
+
+	/* the driver still does DMA to the one attached now */
+	buf = chan->bufs + index;
+	if (buf->queued_us)
+		return -EBUSY;
+
+	len = lseek(fd, 0, SEEK_END);
+	if (len <= 0) {
+		ctx_warn(chan->ctx, "failed to get size of dma-buf %d", fd);
+		return -EINVAL;
+	}
+
+	dupfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (dupfd < 0)
+		return -errno;
+
+	__liberio_buf_release_dmabuf(buf);
+
+	buf->mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			dupfd, 0);
+	if (buf->mem == MAP_FAILED) {
+		err = -errno;
+		ctx_warn(chan->ctx, "failed to mmap dma-buf for index %zu",
+			 index);
+		buf->mem = NULL;
+		close(dupfd);
+		return err;
+	}
+
+	buf->fd = dupfd;
+	buf->len = len;
+	buf->valid_bytes = len;
+
+	/* the buffer is owned by the application now, open CPU access */
+	sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
+	buf->sync = !__liberio_ioctl(dupfd, DMA_BUF_IOCTL_SYNC, &sync);
+
+	return 0;
+}
+
+/*
+ * liberio_dmabuf_alloc - Allocate a dma-buf to attach to a channel
+ * @len: size in bytes
+ *
+ * Allocates from the system dma-heap.
+ *
+ * Returns the fd, -ENODEV if there is no system dma-heap or another
+ * negative error code.
+ */
+int liberio_dmabuf_alloc(size_t len)
+{
+	struct dma_heap_allocation_data data;
+	int heap, err;
+
+	heap = open(DMA_HEAP_SYSTEM, O_RDONLY | O_CLOEXEC);
+	if (heap < 0)
+		return (errno == ENOENT) ? -ENODEV : -errno;
+
+	data.len = len;
+	data.fd = 0;
+	data.fd_flags = O_RDWR | O_CLOEXEC;
+	data.heap_flags = 0;
+
+	err = __liberio_ioctl(heap, DMA_HEAP_IOCTL_ALLOC, &data);
+	if (err)
+		err = -errno;
+	close(heap);
+
+	return err ? err : (int)data.fd;
+}
+
+/*
+ * liberio_dmabuf_alloc_memfd - Allocate a stand-in for a dma-buf
+ * @len: size in bytes
+ *
+ * Returns a memfd of @len bytes. liberio_chan_attach_dmabuf() takes it
+ * like a dma-buf, which is good enough to exercise the import path with
+ * the emulator, but a real DMA engine cannot import it.
+ *
+ * Returns the fd or a negative error code.
+ */
+int liberio_dmabuf_alloc_memfd(size_t len)
+{
+	int fd, err;
+
+	fd = memfd_create("liberio-dmabuf", MFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, len)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
@@ -0,0 +1,960 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "priv.h"
+#include "clog.h"
+#include "kernel.h"
+
+#define EMU_DEFAULT_BUF_SIZE 8192
+#define EMU_DEFAULT_MAX_BUFS 1024
+
+/*
+ * The emulator stands in for the DMA engine without a thread of its own:
+ * every request first advances the device model to the current time and
+ * the channel fd is a timerfd armed for the next moment the model has a
+ * completion to hand out, so select/poll/epoll/io_uring on it behave as
+ * on a real device (readable when a buffer can be dequeued, for TX too).
+ *
+ * RX either generates CHDR packets at the configured rate or, with
+ * loopback, receives what TX on the same port sent. A packet that finds
+ * no queued buffer is an overflow, its sequence number is lost like on
+ * the hardware. TX serializes queued buffers onto a link of the
+ * configured rate, a link that ran dry while streaming is an underflow.
+ * At unlimited rate the link never holds on to anything, so there is
+ * nothing to run dry.
+ *
+ * MMAP buffers are memfds so they can be exported, DMABUF imports get
+ * mapped on the first QBUF of a dma-buf and stay mapped until REQBUFS.
+ *
+ * All channels of a context share one lock, loopback TX reaches into the
+ * peer RX channel.
+ */
+
+struct liberio_emu {
+	struct liberio_emu_config cfg;
+	pthread_mutex_t lock;
+	struct list_head chans;
+	uint64_t rand;
+};
+
+/* a loopback packet on its way to an RX channel */
+struct liberio_emu_pkt {
+	struct list_head node;
+	uint64_t due;
+	size_t len;
+	uint8_t data[];
+};
+
+struct liberio_emu_slot {
+	void *mem;
+	size_t len;
+	size_t used;
+	uint64_t due;
+	uint32_t sequence;
+
+	/* MMAP, the memfd behind mem, -1 otherwise */
+	int fd;
+
+	/* DMABUF, our mapping of the attached dma-buf */
+	void *map;
+	size_t map_len;
+	dev_t map_dev;
+	ino_t map_ino;
+};
+
+/* FIFO of buffer indices, sized for max_bufs so it can't overflow */
+struct liberio_emu_fifo {
+	uint32_t *idx;
+	size_t size;
+	size_t head;
+	size_t tail;
+};
+
+struct liberio_emu_chan {
+	struct liberio_emu *emu;
+	struct liberio_chan *chan;
+	struct list_head node;
+
+	struct liberio_emu_slot *slots;
+	size_t nslots;
+	size_t buf_size;
+	size_t pkt_size;
+
+	/* owned by the device, completed and waiting for DQBUF */
+	struct liberio_emu_fifo queued;
+	struct liberio_emu_fifo done;
+
+	int streaming;
+
+	/* RX packet generator, TX link */
+	uint64_t next_pkt;
+	uint64_t link_free;
+	uint16_t seq;
+
+	/*
+	 * like a capture driver, RX also counts packets that found no
+	 * buffer, link drops never reach the DMA engine and only show in
+	 * the CHDR sequence number
+	 */
+	uint32_t sequence;
+
+	/* RX loopback packets, ordered by due time */
+	struct list_head arrivals;
+
+	uint64_t armed;
+
+	struct liberio_emu_stats stats;
+};
+
+static uint64_t __liberio_emu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64, good enough to pick jitter and drops */
+static uint64_t __liberio_emu_rand(struct liberio_emu *emu)
+{
+	uint64_t x = emu->rand;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	emu->rand = x;
+
+	return x;
+}
+
+static uint64_t __liberio_emu_xfer_ns(struct liberio_emu *emu, size_t len)
+{
+	if (!emu->cfg.rate)
+		return 0;
+
+	return (uint64_t)len * 1000000000 / emu->cfg.rate;
+}
+
+static uint64_t __liberio_emu_latency_ns(struct liberio_emu *emu)
+{
+	uint64_t lat = (uint64_t)emu->cfg.latency_us * 1000;
+
+	if (emu->cfg.jitter_us)
+		lat += __liberio_emu_rand(emu) %
+			((uint64_t)emu->cfg.jitter_us * 1000 + 1);
+
+	return lat;
+}
+
+static int __liberio_emu_drop(struct liberio_emu *emu)
+{
+	return emu->cfg.drop_ppm &&
+		__liberio_emu_rand(emu) % 1000000 < emu->cfg.drop_ppm;
+}
+
+static int __liberio_emu_fifo_init(struct liberio_emu_fifo *fifo, size_t size)
+{
+	fifo->idx = calloc(size, sizeof(*fifo->idx));
+	if (!fifo->idx)
+		return -ENOMEM;
+
+	fifo->size = size;
+	fifo->head = 0;
+	fifo->tail = 0;
+
+	return 0;
+}
+
+static inline int __liberio_emu_fifo_empty(struct liberio_emu_fifo *fifo)
+{
+	return fifo->head == fifo->tail;
+}
+
+static inline void __liberio_emu_fifo_push(struct liberio_emu_fifo *fifo,
+					   uint32_t idx)
+{
+	fifo->idx[fifo->head++ % fifo->size] = idx;
+}
+
+static inline uint32_t __liberio_emu_fifo_peek(struct liberio_emu_fifo *fifo)
+{
+	return fifo->idx[fifo->tail % fifo->size];
+}
+
+static inline uint32_t __liberio_emu_fifo_pop(struct liberio_emu_fifo *fifo)
+{
+	return fifo->idx[fifo->tail++ % fifo->size];
+}
+
+static void __liberio_emu_flush_arrivals(struct liberio_emu_chan *ec)
+{
+	struct liberio_emu_pkt *pkt, *tmp;
+
+	list_for_each_entry_safe(pkt, tmp, &ec->arrivals, node) {
+		list_del(&pkt->node);
+		free(pkt);
+	}
+}
+
+/* completions leave in order, like from a DMA engine */
+static void __liberio_emu_complete(struct liberio_emu_chan *ec, uint32_t idx,
+				   uint64_t due)
+{
+	struct liberio_emu_slot *last;
+
+	if (!__liberio_emu_fifo_empty(&ec->done)) {
+		last = ec->slots + ec->done.idx[(ec->done.head - 1) % ec->done.size];
+		if (due < last->due)
+			due = last->due;
+	}
+
+	ec->slots[idx].due = due;
+	__liberio_emu_fifo_push(&ec->done, idx);
+}
+
+/* put one packet that shows up at @t into the next queued RX buffer */
+static void __liberio_emu_rx_fill(struct liberio_emu_chan *ec, uint64_t t,
+				  const void *data, size_t len)
+{
+	struct liberio_emu *emu = ec->emu;
+	struct liberio_emu_slot *slot;
+	uint64_t hdr;
+	uint32_t idx;
+
+	ec->stats.packets++;
+
+	if (__liberio_emu_drop(emu)) {
+		ec->stats.drops++;
+		ec->seq++;
+		return;
+	}
+
+	if (__liberio_emu_fifo_empty(&ec->queued)) {
+		ec->stats.overflows++;
+		ec->seq++;
+		ec->sequence++;
+		return;
+	}
+
+	idx = __liberio_emu_fifo_pop(&ec->queued);
+	slot = ec->slots + idx;
+
+	if (data) {
+		slot->used = len < slot->len ? len : slot->len;
+		memcpy(slot->mem, data, slot->used);
+	} else {
+		/* CHDR data packet, sequence number and length, SID = port */
+		slot->used = len < slot->len ? len : slot->len;
+		hdr = ((uint64_t)(ec->seq & 0xfff) << 48)
+			| ((uint64_t)(slot->used & 0xffff) << 32)
+			| (uint32_t)ec->chan->port;
+		if (slot->used >= sizeof(hdr))
+			memcpy(slot->mem, &hdr, sizeof(hdr));
+	}
+	ec->seq++;
+	slot->sequence = ec->sequence++;
+
+	__liberio_emu_complete(ec, idx, t + __liberio_emu_latency_ns(emu));
+}
+
+static size_t __liberio_emu_pkt_size(struct liberio_emu_chan *ec)
+{
+	return ec->pkt_size ? ec->pkt_size : ec->buf_size;
+}
+
+static void __liberio_emu_rx_advance(struct liberio_emu_chan *ec, uint64_t now)
+{
+	struct liberio_emu *emu = ec->emu;
+	struct liberio_emu_pkt *pkt, *tmp;
+	size_t len = __liberio_emu_pkt_size(ec);
+	uint64_t interval, n;
+
+	if (!ec->streaming)
+		return;
+
+	if (emu->cfg.loopback) {
+		list_for_each_entry_safe(pkt, tmp, &ec->arrivals, node) {
+			if (pkt->due > now)
+				break;
+			__liberio_emu_rx_fill(ec, pkt->due, pkt->data, pkt->len);
+			list_del(&pkt->node);
+			free(pkt);
+		}
+		return;
+	}
+
+	interval = __liberio_emu_xfer_ns(emu, len);
+	if (!interval) {
+		/* unlimited rate, every queued buffer fills right away */
+		while (!__liberio_emu_fifo_empty(&ec->queued))
+			__liberio_emu_rx_fill(ec, now, NULL, len);
+		ec->next_pkt = now;
+		return;
+	}
+
+	while (ec->next_pkt <= now) {
+		if (__liberio_emu_fifo_empty(&ec->queued)) {
+			/* nowhere to put them, skip ahead in one go */
+			n = (now - ec->next_pkt) / interval + 1;
+			ec->stats.packets += n;
+			ec->stats.overflows += n;
+			ec->seq += n;
+			ec->sequence += n;
+			ec->next_pkt += n * interval;
+			break;
+		}
+
+		__liberio_emu_rx_fill(ec, ec->next_pkt, NULL, len);
+		ec->next_pkt += interval;
+	}
+}
+
+static struct liberio_emu_chan *
+__liberio_emu_find_rx(struct liberio_emu *emu, int port)
+{
+	struct liberio_emu_chan *ec;
+
+	list_for_each_entry(ec, &emu->chans, node)
+		if (ec->chan->dir == RX && ec->chan->port == port)
+			return ec;
+
+	return NULL;
+}
+
+static void __liberio_emu_rearm(struct liberio_emu_chan *ec);
+
+/* hand a TX buffer to the link, it completes once it's out on the wire */
+static void __liberio_emu_tx_send(struct liberio_emu_chan *ec, uint32_t idx,
+				  uint64_t now)
+{
+	struct liberio_emu *emu = ec->emu;
+	struct liberio_emu_slot *slot = ec->slots + idx;
+	struct liberio_emu_chan *peer;
+	struct liberio_emu_pkt *pkt, *pos;
+	uint64_t start, due;
+
+	start = now;
+	if (ec->link_free > now)
+		start = ec->link_free;
+	else if (emu->cfg.rate && ec->link_free && ec->link_free < now)
+		ec->stats.underflows++;
+
+	due = start + __liberio_emu_xfer_ns(emu, slot->used);
+	ec->link_free = due;
+	ec->stats.packets++;
+
+	__liberio_emu_complete(ec, idx, due);
+
+	if (!emu->cfg.loopback)
+		return;
+
+	if (__liberio_emu_drop(emu)) {
+		ec->stats.drops++;
+		return;
+	}
+
+	peer = __liberio_emu_find_rx(emu, ec->chan->port);
+	if (!peer || !peer->streaming)
+		return;
+
+	pkt = malloc(sizeof(*pkt) + slot->used);
+	if (!pkt)
+		return;
+
+	pkt->due = due + __liberio_emu_latency_ns(emu);
+	pkt->len = slot->used;
+	memcpy(pkt->data, slot->mem, slot->used);
+
+	/* jitter can reorder arrivals, keep the list sorted */
+	list_for_each_entry_reverse(pos, &peer->arrivals, node)
+		if (pos->due <= pkt->due)
+			break;
+	list_add(&pkt->node, &pos->node);
+
+	__liberio_emu_rearm(peer);
+}
+
+/* arm the timerfd for the next time the model has something to say */
+static void __liberio_emu_rearm(struct liberio_emu_chan *ec)
+{
+	struct liberio_emu_pkt *pkt;
+	struct itimerspec its;
+	uint64_t next = 0;
+
+	if (!__liberio_emu_fifo_empty(&ec->done)) {
+		next = ec->slots[__liberio_emu_fifo_peek(&ec->done)].due;
+	} else if (ec->streaming && ec->chan->dir == RX
+		   && !__liberio_emu_fifo_empty(&ec->queued)) {
+		if (ec->emu->cfg.loopback) {
+			if (!list_empty(&ec->arrivals)) {
+				pkt = list_first_entry(&ec->arrivals,
+						       struct liberio_emu_pkt,
+						       node);
+				next = pkt->due;
+			}
+		} else {
+			next = ec->next_pkt;
+		}
+	}
+
+	/*
+	 * Nothing changed: either still pending, or it fired for something
+	 * that is still due. Setting the timer clears a pending expiration,
+	 * a time in the past fires right away and 0 disarms it.
+	 */
+	if (next == ec->armed)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	if (next) {
+		its.it_value.tv_sec = next / 1000000000;
+		its.it_value.tv_nsec = next % 1000000000;
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+			its.it_value.tv_nsec = 1;
+	}
+
+	if (timerfd_settime(ec->chan->fd, TFD_TIMER_ABSTIME, &its, NULL))
+		ctx_warn(ec->chan->ctx, "failed to arm timer");
+
+	ec->armed = next;
+}
+
+static void __liberio_emu_advance(struct liberio_emu_chan *ec, uint64_t now)
+{
+	if (ec->chan->dir == RX)
+		__liberio_emu_rx_advance(ec, now);
+}
+
+/* drop the memory of all slots, the caller's MMAP mappings stay valid */
+static void __liberio_emu_reset_slots(struct liberio_emu_chan *ec)
+{
+	struct liberio_emu_slot *slot;
+	size_t i;
+
+	for (i = 0; i < ec->chan->max_bufs; i++) {
+		slot = ec->slots + i;
+		if (slot->fd >= 0)
+			close(slot->fd);
+		if (slot->map)
+			munmap(slot->map, slot->map_len);
+	}
+
+	memset(ec->slots, 0, ec->chan->max_bufs * sizeof(*ec->slots));
+	for (i = 0; i < ec->chan->max_bufs; i++)
+		ec->slots[i].fd = -1;
+}
+
+static int __liberio_emu_port_from_file(const char *file)
+{
+	const char *p = file + strlen(file);
+
+	while (p > file && isdigit((unsigned char)p[-1]))
+		p--;
+
+	return *p ? atoi(p) : 0;
+}
+
+static int __liberio_emu_open(struct liberio_chan *chan, const char *file)
+{
+	struct liberio_emu *emu = chan->ctx->emu;
+	struct liberio_emu_chan *ec;
+	int err;
+
+	ec = calloc(1, sizeof(*ec));
+	if (!ec)
+		return -ENOMEM;
+
+	ec->emu = emu;
+	ec->chan = chan;
+	INIT_LIST_HEAD(&ec->arrivals);
+
+	chan->port = __liberio_emu_port_from_file(file);
+	chan->max_bufs = emu->cfg.max_bufs ? emu->cfg.max_bufs
+					   : EMU_DEFAULT_MAX_BUFS;
+	chan->fd_events = POLLIN;
+
+	ec->buf_size = emu->cfg.buf_size ? emu->cfg.buf_size
+					 : EMU_DEFAULT_BUF_SIZE;
+
+	err = -ENOMEM;
+	ec->slots = calloc(chan->max_bufs, sizeof(*ec->slots));
+	if (!ec->slots)
+		goto out_free;
+
+	if (__liberio_emu_fifo_init(&ec->queued, chan->max_bufs)
+	    || __liberio_emu_fifo_init(&ec->done, chan->max_bufs))
+		goto out_free;
+
+	__liberio_emu_reset_slots(ec);
+
+	chan->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (chan->fd < 0) {
+		err = -errno;
+		goto out_free;
+	}
+
+	chan->backend_priv = ec;
+
+	pthread_mutex_lock(&emu->lock);
+	list_add_tail(&ec->node, &emu->chans);
+	pthread_mutex_unlock(&emu->lock);
+
+	return 0;
+
+out_free:
+	free(ec->queued.idx);
+	free(ec->done.idx);
+	free(ec->slots);
+	free(ec);
+
+	return err;
+}
+
+static void __liberio_emu_close(struct liberio_chan *chan)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+	struct liberio_emu *emu = ec->emu;
+
+	pthread_mutex_lock(&emu->lock);
+	list_del(&ec->node);
+	__liberio_emu_flush_arrivals(ec);
+	pthread_mutex_unlock(&emu->lock);
+
+	close(chan->fd);
+
+	__liberio_emu_reset_slots(ec);
+	free(ec->queued.idx);
+	free(ec->done.idx);
+	free(ec->slots);
+	free(ec);
+}
+
+static int __liberio_emu_reqbufs(struct liberio_chan *chan,
+				 struct usrp_requestbuffers *req)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+
+	if (req->memory != USRP_MEMORY_MMAP
+	    && req->memory != USRP_MEMORY_USERPTR
+	    && req->memory != USRP_MEMORY_DMABUF) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&ec->emu->lock);
+	if (ec->streaming) {
+		pthread_mutex_unlock(&ec->emu->lock);
+		errno = EBUSY;
+		return -1;
+	}
+
+	__liberio_emu_reset_slots(ec);
+	ec->nslots = req->count < chan->max_bufs ? req->count : chan->max_bufs;
+	req->count = ec->nslots;
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	return 0;
+}
+
+static int __liberio_emu_create_bufs(struct liberio_chan *chan,
+				     struct liberio_create_bufs *create)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+
+	pthread_mutex_lock(&ec->emu->lock);
+	if (create->count > chan->max_bufs - ec->nslots)
+		create->count = chan->max_bufs - ec->nslots;
+	create->index = ec->nslots;
+	ec->nslots += create->count;
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	return 0;
+}
+
+static size_t __liberio_emu_stride(struct liberio_emu_chan *ec)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	return (ec->buf_size + page - 1) & ~(page - 1);
+}
+
+static int __liberio_emu_querybuf(struct liberio_chan *chan,
+				  struct usrp_buffer *breq)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+
+	if (breq->index >= ec->nslots) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	breq->length = ec->buf_size;
+	breq->m.offset = breq->index * __liberio_emu_stride(ec);
+
+	return 0;
+}
+
+static void *__liberio_emu_mmap(struct liberio_chan *chan, size_t len,
+				off_t offset)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+	size_t idx = offset / __liberio_emu_stride(ec);
+	struct liberio_emu_slot *slot;
+	void *mem;
+	int fd, err;
+
+	if (idx >= ec->nslots) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	fd = memfd_create("liberio-emu", MFD_CLOEXEC);
+	if (fd < 0)
+		return MAP_FAILED;
+
+	if (ftruncate(fd, len)) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return MAP_FAILED;
+	}
+
+	mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return mem;
+	}
+
+	pthread_mutex_lock(&ec->emu->lock);
+	slot = ec->slots + idx;
+	if (slot->fd >= 0)
+		close(slot->fd);
+	slot->fd = fd;
+	slot->mem = mem;
+	slot->len = len;
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	return mem;
+}
+
+/* map a dma-buf, unless it is the one this slot already has mapped */
+static int __liberio_emu_import(struct liberio_emu_slot *slot, int fd,
+				size_t len)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(fd, &st))
+		return -1;
+
+	if (slot->map && slot->map_len == len
+	    && slot->map_dev == st.st_dev && slot->map_ino == st.st_ino)
+		return 0;
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	if (slot->map)
+		munmap(slot->map, slot->map_len);
+
+	slot->map = map;
+	slot->map_len = len;
+	slot->map_dev = st.st_dev;
+	slot->map_ino = st.st_ino;
+	slot->mem = map;
+	slot->len = len;
+
+	return 0;
+}
+
+static int __liberio_emu_qbuf(struct liberio_chan *chan,
+			      struct usrp_buffer *breq)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+	struct liberio_emu_slot *slot;
+	uint64_t now;
+
+	if (breq->index >= ec->nslots) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	slot = ec->slots + breq->index;
+
+	pthread_mutex_lock(&ec->emu->lock);
+
+	if (breq->memory == USRP_MEMORY_USERPTR) {
+		slot->mem = (void *)breq->m.userptr;
+		slot->len = breq->length;
+	} else if (breq->memory == USRP_MEMORY_DMABUF) {
+		if (__liberio_emu_import(slot, breq->m.fd, breq->length)) {
+			pthread_mutex_unlock(&ec->emu->lock);
+			return -1;
+		}
+	}
+	slot->used = breq->bytesused;
+
+	now = __liberio_emu_now();
+	__liberio_emu_advance(ec, now);
+
+	if (chan->dir == TX && ec->streaming)
+		__liberio_emu_tx_send(ec, breq->index, now);
+	else
+		__liberio_emu_fifo_push(&ec->queued, breq->index);
+
+	__liberio_emu_rearm(ec);
+
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	return 0;
+}
+
+static int __liberio_emu_dqbuf(struct liberio_chan *chan,
+			       struct usrp_buffer *breq)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+	struct liberio_emu_slot *slot;
+	uint64_t now;
+	uint32_t idx;
+
+	pthread_mutex_lock(&ec->emu->lock);
+
+	now = __liberio_emu_now();
+	__liberio_emu_advance(ec, now);
+
+	if (__liberio_emu_fifo_empty(&ec->done)
+	    || ec->slots[__liberio_emu_fifo_peek(&ec->done)].due > now) {
+		__liberio_emu_rearm(ec);
+		pthread_mutex_unlock(&ec->emu->lock);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	idx = __liberio_emu_fifo_pop(&ec->done);
+	slot = ec->slots + idx;
+
+	breq->index = idx;
+	breq->bytesused = slot->used;
+	breq->length = slot->len;
+	breq->flags = 0;
+	if (chan->dir == RX)
+		breq->sequence = slot->sequence;
+	else
+		breq->sequence = ec->sequence++;
+	breq->timestamp.tv_sec = slot->due / 1000000000;
+	breq->timestamp.tv_usec = (slot->due % 1000000000) / 1000;
+	if (breq->memory == USRP_MEMORY_USERPTR)
+		breq->m.userptr = (unsigned long)slot->mem;
+	else if (breq->memory == USRP_MEMORY_MMAP)
+		breq->m.offset = idx * __liberio_emu_stride(ec);
+
+	__liberio_emu_rearm(ec);
+
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	return 0;
+}
+
+static int __liberio_emu_streamon(struct liberio_chan *chan)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+	uint64_t now;
+
+	pthread_mutex_lock(&ec->emu->lock);
+
+	if (!ec->streaming) {
+		now = __liberio_emu_now();
+		ec->streaming = 1;
+		ec->next_pkt = now;
+		ec->link_free = 0;
+		ec->sequence = 0;
+
+		/* TX buffers queued before streaming go out now */
+		if (chan->dir == TX)
+			while (!__liberio_emu_fifo_empty(&ec->queued))
+				__liberio_emu_tx_send(ec,
+					__liberio_emu_fifo_pop(&ec->queued),
+					now);
+
+		__liberio_emu_rearm(ec);
+	}
+
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	return 0;
+}
+
+/* like vb2, stopping hands every buffer back without a DQBUF */
+static int __liberio_emu_streamoff(struct liberio_chan *chan)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+
+	pthread_mutex_lock(&ec->emu->lock);
+
+	ec->streaming = 0;
+	ec->queued.head = ec->queued.tail = 0;
+	ec->done.head = ec->done.tail = 0;
+	__liberio_emu_flush_arrivals(ec);
+	__liberio_emu_rearm(ec);
+
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	return 0;
+}
+
+static int __liberio_emu_expbuf(struct liberio_chan *chan,
+				struct usrp_exportbuffer *breq)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+	int fd = -1;
+
+	pthread_mutex_lock(&ec->emu->lock);
+	if (breq->index < ec->nslots && ec->slots[breq->index].fd >= 0)
+		fd = fcntl(ec->slots[breq->index].fd,
+			   (breq->flags & O_CLOEXEC) ? F_DUPFD_CLOEXEC
+						     : F_DUPFD, 0);
+	else
+		errno = EINVAL;
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	if (fd < 0)
+		return -1;
+
+	breq->fd = fd;
+
+	return 0;
+}
+
+static int __liberio_emu_set_fmt(struct liberio_chan *chan,
+				 struct usrp_fmt *fmt)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+
+	if (fmt->type != USRP_FMT_CHDR_FIXED_BLOCK) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ec->pkt_size = fmt->length;
+
+	return 0;
+}
+
+static int __liberio_emu_wait(struct liberio_chan *chan, int timeout)
+{
+	struct pollfd pfd;
+	int err;
+
+	pfd.fd = chan->fd;
+	pfd.events = POLLIN;
+
+	/* ms resolution, round up so we never return early */
+	err = poll(&pfd, 1, (timeout >= 0) ? (timeout + 999) / 1000 : -1);
+	if (err < 0) {
+		ctx_warn(chan->ctx, "poll failed");
+		return -errno;
+	}
+
+	return err;
+}
+
+const struct liberio_backend_ops __liberio_backend_emu = {
+	.name		=	"emu",
+	.open		=	__liberio_emu_open,
+	.close		=	__liberio_emu_close,
+	.reqbufs	=	__liberio_emu_reqbufs,
+	.create_bufs	=	__liberio_emu_create_bufs,
+	.querybuf	=	__liberio_emu_querybuf,
+	.qbuf		=	__liberio_emu_qbuf,
+	.dqbuf		=	__liberio_emu_dqbuf,
+	.streamon	=	__liberio_emu_streamon,
+	.streamoff	=	__liberio_emu_streamoff,
+	.expbuf		=	__liberio_emu_expbuf,
+	.set_fmt	=	__liberio_emu_set_fmt,
+	.mmap		=	__liberio_emu_mmap,
+	.wait		=	__liberio_emu_wait,
+};
+
+void __liberio_emu_free(struct liberio_emu *emu)
+{
+	if (!emu)
+		return;
+
+	pthread_mutex_destroy(&emu->lock);
+	free(emu);
+}
+
+/*
+ * liberio_ctx_use_emulator - Make a context's channels emulated devices
+ * @ctx: the context
+ * @cfg: rate, latency, jitter and loss of the emulated DMA engine
+ *
+ * Channels allocated from @ctx afterwards ignore the device node and
+ * talk to an in-process model instead, the port is taken from the
+ * trailing digits of the path ("/dev/rx-dma3" is port 3). All memory
+ * types are supported, MMAP buffers can be exported.
+ */
+int liberio_ctx_use_emulator(struct liberio_ctx *ctx,
+			     const struct liberio_emu_config *cfg)
+{
+	struct liberio_emu *emu;
+
+	if (ctx->emu)
+		return -EBUSY;
+
+	emu = calloc(1, sizeof(*emu));
+	if (!emu)
+		return -ENOMEM;
+
+	if (cfg)
+		emu->cfg = *cfg;
+	INIT_LIST_HEAD(&emu->chans);
+	pthread_mutex_init(&emu->lock, NULL);
+	emu->rand = 0x9e3779b97f4a7c15ull;
+
+	ctx->emu = emu;
+	ctx->backend = &__liberio_backend_emu;
+
+	return 0;
+}
+
+int liberio_chan_get_emu_stats(struct liberio_chan *chan,
+			       struct liberio_emu_stats *stats)
+{
+	struct liberio_emu_chan *ec = chan->backend_priv;
+
+	if (chan->backend != &__liberio_backend_emu)
+		return -ENOTTY;
+
+	pthread_mutex_lock(&ec->emu->lock);
+	__liberio_emu_advance(ec, __liberio_emu_now());
+	*stats = ec->stats;
+	pthread_mutex_unlock(&ec->emu->lock);
+
+	return 0;
+}
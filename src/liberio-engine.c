@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "priv.h"
+#include "clog.h"
+#include "ring.h"
+#include "util.h"
+
+#define ENGINE_BATCH 32
+/* how often a sleeping engine checks whether it got stopped */
+#define ENGINE_POLL_MS 100
+
+/*
+ * The engine owns the driver side of a channel: a thread that moves
+ * dequeued buffers to the application through a single producer, single
+ * consumer ring and enqueues the buffers the application posts to a
+ * second ring in batches. On RX that keeps the driver queue full while
+ * the application is busy, on TX it takes submission and reclaiming off
+ * the application thread. Either way the application never enters the
+ * kernel while the engine is awake.
+ *
+ * Both sides only make a syscall when the other side is asleep: before
+ * sleeping a side raises its waiting flag and checks its ring once more,
+ * the other side pushes and then checks the flag, with full barriers in
+ * between so at least one of them sees the other.
+ */
+
+static void __liberio_engine_wake(struct liberio_ctx *ctx, int *waiting,
+				  int efd)
+{
+	uint64_t one = 1;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+		if (write(efd, &one, sizeof(one)) < 0)
+			ctx_warn(ctx, "failed to wake up");
+}
+
+static void __liberio_engine_drain_efd(struct liberio_ctx *ctx, int efd)
+{
+	uint64_t val;
+
+	if (read(efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		ctx_warn(ctx, "failed to read eventfd");
+}
+
+/*
+ * Give everything the application posted to the driver. Buffers the
+ * driver refuses stay with the engine and are tried again first on the
+ * next round, returns the number of buffers the driver took.
+ */
+static size_t __liberio_engine_requeue(struct liberio_engine *eng)
+{
+	struct liberio_chan *chan = eng->chan;
+	struct liberio_buf *bufs[ENGINE_BATCH];
+	size_t n, i, queued, total = 0;
+	uint32_t idx;
+	int err;
+
+	do {
+		n = (eng->nretry < ENGINE_BATCH) ? eng->nretry : ENGINE_BATCH;
+		for (i = 0; i < n; i++)
+			bufs[i] = chan->bufs + eng->retry[i];
+		eng->nretry -= n;
+		memmove(eng->retry, eng->retry + n,
+			eng->nretry * sizeof(*eng->retry));
+
+		for (; n < ENGINE_BATCH; n++) {
+			if (liberio_spsc_pop(eng->done, &idx))
+				break;
+			bufs[n] = chan->bufs + idx;
+		}
+
+		if (!n)
+			break;
+
+		err = liberio_chan_buf_enqueue_many(chan, bufs, n, &queued);
+
+		total += queued;
+		__atomic_store_n(&eng->submitted, eng->submitted + queued,
+				 __ATOMIC_RELAXED);
+
+		if (err) {
+			/* once per run of failures, we retry on every wakeup */
+			if (!eng->retry_warned)
+				ctx_warnx(chan->ctx,
+					  "failed to enqueue %zu buffers (%d)",
+					  n - queued, err);
+			eng->retry_warned = 1;
+
+			for (i = queued; i < n; i++)
+				eng->retry[eng->nretry++] = bufs[i]->index;
+			break;
+		}
+
+		eng->retry_warned = 0;
+	} while (n == ENGINE_BATCH);
+
+	return total;
+}
+
+static void __liberio_engine_deliver(struct liberio_engine *eng,
+				     struct liberio_buf **bufs, int n)
+{
+	struct liberio_chan *chan = eng->chan;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!liberio_spsc_push(eng->ready, bufs[i]->index)) {
+			__atomic_store_n(&eng->delivered, eng->delivered + 1,
+					 __ATOMIC_RELAXED);
+			continue;
+		}
+
+		/*
+		 * The consumer is too far behind, drop the data and keep
+		 * the buffer with the driver rather than letting it starve.
+		 * Never happens on TX, the ring there holds the whole pool.
+		 */
+		__atomic_store_n(&eng->overflows, eng->overflows + 1,
+				 __ATOMIC_RELAXED);
+		liberio_chan_buf_enqueue(chan, bufs[i]);
+	}
+
+	__liberio_engine_wake(chan->ctx, &eng->app_waiting, eng->ready_efd);
+}
+
+static void __liberio_engine_setup_thread(struct liberio_engine *eng)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	int err;
+
+	if (eng->attr.cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(eng->attr.cpu, &cpus);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(cpus),
+					     &cpus);
+		if (err)
+			ctx_warnx(eng->chan->ctx,
+				  "failed to pin engine to cpu %d (%d)",
+				  eng->attr.cpu, err);
+	}
+
+	if (eng->attr.priority > 0) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = eng->attr.priority;
+		err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err)
+			ctx_warnx(eng->chan->ctx,
+				  "failed to set priority %d (%d)",
+				  eng->attr.priority, err);
+	}
+}
+
+static void *__liberio_engine_run(void *arg)
+{
+	struct liberio_engine *eng = arg;
+	struct liberio_chan *chan = eng->chan;
+	struct liberio_buf *bufs[ENGINE_BATCH];
+	struct pollfd pfd[2];
+	uint64_t now, idle_since = 0;
+	size_t requeued;
+	int n;
+
+	__liberio_engine_setup_thread(eng);
+
+	pfd[0].fd = chan->fd;
+	pfd[0].events = chan->fd_events;
+	pfd[1].fd = eng->done_efd;
+	pfd[1].events = POLLIN;
+
+	while (__atomic_load_n(&eng->running, __ATOMIC_ACQUIRE)) {
+		requeued = __liberio_engine_requeue(eng);
+
+		n = liberio_chan_buf_dequeue_many(chan, bufs, ENGINE_BATCH,
+						  0, 0);
+		if (n > 0)
+			__liberio_engine_deliver(eng, bufs, n);
+
+		if (requeued || n > 0) {
+			idle_since = 0;
+			continue;
+		}
+
+		/* stay awake for a bit so a busy application never has to wake us */
+		if (eng->attr.spin_us) {
+			now = __liberio_get_time_us();
+			if (!idle_since)
+				idle_since = now;
+			if (now - idle_since < eng->attr.spin_us) {
+				cpu_relax();
+				continue;
+			}
+			idle_since = 0;
+		}
+
+		/* nothing to do, sleep until the driver or the app needs us */
+		__atomic_store_n(&eng->engine_waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if (liberio_spsc_empty(eng->done))
+			poll(pfd, 2, ENGINE_POLL_MS);
+
+		__atomic_store_n(&eng->engine_waiting, 0, __ATOMIC_RELAXED);
+
+		if (pfd[1].revents & POLLIN)
+			__liberio_engine_drain_efd(chan->ctx, eng->done_efd);
+		pfd[1].revents = 0;
+	}
+
+	return NULL;
+}
+
+static void __liberio_engine_free(struct liberio_engine *eng)
+{
+	if (eng->ready_efd >= 0)
+		close(eng->ready_efd);
+	if (eng->done_efd >= 0)
+		close(eng->done_efd);
+
+	__liberio_spsc_free(eng->ready);
+	__liberio_spsc_free(eng->done);
+	free(eng->retry);
+	free(eng);
+}
+
+/*
+ * liberio_chan_engine_start - Hand the driver side of a channel to a
+ * background thread
+ * @chan: a channel with buffers requested but not streaming yet
+ * @attr: thread and queue settings, NULL for defaults
+ *
+ * Starts streaming and the engine thread, on RX all buffers get enqueued
+ * first, on TX they all start out free for the application. From then on
+ * the application only uses liberio_chan_engine_get() and
+ * liberio_chan_engine_put(), from a single thread.
+ */
+int liberio_chan_engine_start(struct liberio_chan *chan,
+			      const struct liberio_engine_attr *attr)
+{
+	struct liberio_engine *eng;
+	size_t depth;
+	int err;
+
+	if (chan->engine || !chan->nbufs)
+		return -EBUSY;
+
+	eng = calloc(1, sizeof(*eng));
+	if (!eng)
+		return -ENOMEM;
+
+	eng->chan = chan;
+	eng->ready_efd = -1;
+	eng->done_efd = -1;
+
+	if (attr) {
+		eng->attr = *attr;
+	} else {
+		eng->attr.cpu = -1;
+		eng->attr.priority = 0;
+		eng->attr.depth = 0;
+		eng->attr.spin_us = 0;
+	}
+
+	if (chan->dir == TX)
+		depth = chan->max_bufs;
+	else
+		depth = eng->attr.depth ? eng->attr.depth : chan->nbufs / 2;
+
+	err = -ENOMEM;
+	eng->ready = __liberio_spsc_new(depth ? depth : 1);
+	eng->done = __liberio_spsc_new(chan->max_bufs);
+	eng->retry = calloc(chan->max_bufs, sizeof(*eng->retry));
+	if (!eng->ready || !eng->done || !eng->retry)
+		goto out_free;
+
+	eng->ready_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	eng->done_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eng->ready_efd < 0 || eng->done_efd < 0) {
+		err = -errno;
+		goto out_free;
+	}
+
+	/* TX buffers come out of the free list with the first dequeue */
+	if (chan->dir == RX) {
+		err = liberio_chan_enqueue_all(chan);
+		if (err) {
+			ctx_crit(chan->ctx, "failed to enqueue buffers");
+			goto out_free;
+		}
+	}
+
+	err = liberio_chan_start_streaming(chan);
+	if (err) {
+		ctx_crit(chan->ctx, "failed to start streaming");
+		err = -errno;
+		goto out_free;
+	}
+
+	eng->running = 1;
+	err = pthread_create(&eng->thread, NULL, __liberio_engine_run, eng);
+	if (err) {
+		liberio_chan_stop_streaming(chan);
+		err = -err;
+		goto out_free;
+	}
+
+	chan->engine = eng;
+
+	return 0;
+
+out_free:
+	__liberio_engine_free(eng);
+
+	return err;
+}
+
+/*
+ * liberio_chan_engine_stop - Stop the engine thread and streaming
+ * @chan: the channel
+ *
+ * All buffers are owned by the application afterwards, on TX they are
+ * back on the free list for liberio_chan_buf_dequeue().
+ */
+int liberio_chan_engine_stop(struct liberio_chan *chan)
+{
+	struct liberio_engine *eng = chan->engine;
+	uint64_t one = 1;
+	int err;
+
+	if (!eng)
+		return -EINVAL;
+
+	__atomic_store_n(&eng->running, 0, __ATOMIC_RELEASE);
+	if (write(eng->done_efd, &one, sizeof(one)) < 0)
+		ctx_warn(chan->ctx, "failed to wake engine");
+	pthread_join(eng->thread, NULL);
+
+	err = liberio_chan_stop_streaming(chan);
+
+	/* stopping gave every TX buffer back, put them on the free list */
+	__liberio_chan_reset_free(chan);
+
+	chan->engine = NULL;
+	__liberio_engine_free(eng);
+
+	return err;
+}
+
+/*
+ * liberio_chan_engine_get - Get the next buffer from the engine
+ * @chan: the channel
+ * @timeout: the timeout to use in us, negative values wait forever
+ *
+ * Returns a filled buffer on RX and a free one on TX, NULL on timeout or
+ * if the engine isn't running. Doesn't enter the kernel as long as
+ * buffers are waiting.
+ */
+struct liberio_buf *liberio_chan_engine_get(struct liberio_chan *chan,
+					    int timeout)
+{
+	struct liberio_engine *eng = chan->engine;
+	uint64_t now, deadline = 0;
+	int64_t remaining = -1;
+	struct pollfd pfd;
+	uint32_t idx;
+	int ret;
+
+	if (!eng)
+		return NULL;
+
+	if (!liberio_spsc_pop(eng->ready, &idx))
+		return chan->bufs + idx;
+
+	if (!timeout)
+		return NULL;
+
+	if (timeout > 0)
+		deadline = __liberio_get_time_us() + timeout;
+
+	pfd.fd = eng->ready_efd;
+	pfd.events = POLLIN;
+
+	__atomic_store_n(&eng->app_waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (;;) {
+		if (!liberio_spsc_pop(eng->ready, &idx))
+			break;
+
+		/* spurious wakeups and EINTR don't restart the timeout */
+		if (timeout > 0) {
+			now = __liberio_get_time_us();
+			remaining = (deadline > now) ? deadline - now : 0;
+		}
+
+		/* ms resolution, round up so we never return early */
+		ret = poll(&pfd, 1, (remaining >= 0) ? (remaining + 999) / 1000
+						     : -1);
+		if (ret <= 0 && !(ret < 0 && errno == EINTR)) {
+			if (!liberio_spsc_pop(eng->ready, &idx))
+				break;
+			__atomic_store_n(&eng->app_waiting, 0,
+					 __ATOMIC_RELAXED);
+			return NULL;
+		}
+
+		__liberio_engine_drain_efd(chan->ctx, eng->ready_efd);
+	}
+
+	__atomic_store_n(&eng->app_waiting, 0, __ATOMIC_RELAXED);
+
+	return chan->bufs + idx;
+}
+
+/*
+ * liberio_chan_engine_put - Give a buffer back to the engine
+ * @chan: the channel
+ * @buf: a buffer from liberio_chan_engine_get()
+ *
+ * On TX this submits @buf with its payload, see liberio_buf_set_payload().
+ *
+ * Returns 0, -EINVAL if the engine isn't running or -ENOSPC.
+ */
+int liberio_chan_engine_put(struct liberio_chan *chan, struct liberio_buf *buf)
+{
+	struct liberio_engine *eng = chan->engine;
+
+	if (!eng)
+		return -EINVAL;
+
+	if (liberio_spsc_push(eng->done, buf->index))
+		return -ENOSPC;
+
+	__liberio_engine_wake(chan->ctx, &eng->engine_waiting, eng->done_efd);
+
+	return 0;
+}
+
+void liberio_chan_engine_get_stats(const struct liberio_chan *chan,
+				   struct liberio_engine_stats *stats)
+{
+	struct liberio_engine *eng = chan->engine;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!eng)
+		return;
+
+	stats->delivered = __atomic_load_n(&eng->delivered, __ATOMIC_RELAXED);
+	stats->submitted = __atomic_load_n(&eng->submitted, __ATOMIC_RELAXED);
+	stats->overflows = __atomic_load_n(&eng->overflows, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include "hist.h"
+
+void __liberio_hist_reset(struct liberio_hist *hist)
+{
+	unsigned int i;
+
+	for (i = 0; i < LIBERIO_HIST_BUCKETS; i++)
+		__atomic_store_n(&hist->buckets[i], 0, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&hist->count, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->sum, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->min, UINT64_MAX, __ATOMIC_RELAXED);
+}
+
+/* largest value that still falls into bucket @idx */
+static uint64_t __liberio_hist_bucket_top(unsigned int idx)
+{
+	unsigned int exp;
+	uint64_t sub;
+
+	if (idx < LIBERIO_HIST_SUB)
+		return idx;
+
+	exp = (idx >> LIBERIO_HIST_SUB_BITS) + LIBERIO_HIST_SUB_BITS - 1;
+	sub = idx & (LIBERIO_HIST_SUB - 1);
+
+	return ((LIBERIO_HIST_SUB + sub + 1) << (exp - LIBERIO_HIST_SUB_BITS)) - 1;
+}
+
+/*
+ * __liberio_hist_percentile - Estimate a percentile
+ * @hist: the histogram
+ * @percentile: 0 to 100
+ *
+ * Returns the upper end of the bucket the percentile falls into, clamped
+ * to the recorded min and max, or 0 if nothing has been recorded.
+ */
+uint64_t __liberio_hist_percentile(const struct liberio_hist *hist,
+				   double percentile)
+{
+	uint64_t count, rank, seen = 0, val;
+	uint64_t min, max;
+	unsigned int i;
+
+	count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+	if (!count)
+		return 0;
+
+	if (percentile < 0.0)
+		percentile = 0.0;
+	if (percentile > 100.0)
+		percentile = 100.0;
+
+	rank = (uint64_t)(percentile / 100.0 * count + 0.5);
+	if (!rank)
+		rank = 1;
+
+	for (i = 0; i < LIBERIO_HIST_BUCKETS - 1; i++) {
+		seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+		if (seen >= rank)
+			break;
+	}
+
+	val = __liberio_hist_bucket_top(i);
+
+	min = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	if (val > max)
+		val = max;
+	if (val < min)
+		val = min;
+
+	return val;
+}
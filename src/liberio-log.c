@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "priv.h"
+#include "clog.h"
+#include "log.h"
+#include "ring.h"
+
+/* how often the log thread drains the ring */
+#define LOG_FLUSH_US	10000
+
+#define LOG_MSG_LEN	256
+
+struct liberio_log_rec {
+	int pri;
+	int err;
+	const char *token;
+	const char *fmt;
+	unsigned int nargs;
+	uint64_t args[LIBERIO_LOG_MAX_ARGS];
+};
+
+/*
+ * struct liberio_log - Asynchronous logging state of a context
+ *
+ * Records live in a preallocated array, free and filled ones are passed
+ * around by index through two lock-free rings, so any thread can log
+ * without taking a lock or allocating. A message that finds no free
+ * record is dropped and counted.
+ */
+struct liberio_log {
+	struct liberio_log_rec *recs;
+	struct liberio_ring *free;
+	struct liberio_ring *full;
+	uint64_t dropped;
+
+	pthread_t thread;
+	int running;
+};
+
+/* length modifier in front of the conversion of a printf spec */
+static int __liberio_log_is_mod(const char *spec, const char *end,
+				const char *mod)
+{
+	size_t len = strlen(mod);
+
+	return end - spec > (ptrdiff_t)len && !strncmp(end - len, mod, len);
+}
+
+/* format a single conversion spec with its argument */
+static int __liberio_log_conv(char *out, size_t size, const char *spec,
+			      const char *end, uint64_t arg)
+{
+	switch (*end) {
+	case 'd':
+	case 'i':
+		if (__liberio_log_is_mod(spec, end, "ll"))
+			return snprintf(out, size, spec, (long long)arg);
+		if (__liberio_log_is_mod(spec, end, "l"))
+			return snprintf(out, size, spec, (long)arg);
+		if (__liberio_log_is_mod(spec, end, "z"))
+			return snprintf(out, size, spec, (ssize_t)arg);
+		if (__liberio_log_is_mod(spec, end, "j"))
+			return snprintf(out, size, spec, (intmax_t)arg);
+		if (__liberio_log_is_mod(spec, end, "t"))
+			return snprintf(out, size, spec, (ptrdiff_t)arg);
+		return snprintf(out, size, spec, (int)arg);
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		if (__liberio_log_is_mod(spec, end, "ll"))
+			return snprintf(out, size, spec, (unsigned long long)arg);
+		if (__liberio_log_is_mod(spec, end, "l"))
+			return snprintf(out, size, spec, (unsigned long)arg);
+		if (__liberio_log_is_mod(spec, end, "z"))
+			return snprintf(out, size, spec, (size_t)arg);
+		if (__liberio_log_is_mod(spec, end, "j"))
+			return snprintf(out, size, spec, (uintmax_t)arg);
+		if (__liberio_log_is_mod(spec, end, "t"))
+			return snprintf(out, size, spec, (ptrdiff_t)arg);
+		return snprintf(out, size, spec, (unsigned int)arg);
+	case 'c':
+		return snprintf(out, size, spec, (int)arg);
+	case 's':
+		return snprintf(out, size, spec, (const char *)(uintptr_t)arg);
+	case 'p':
+		return snprintf(out, size, spec, (void *)(uintptr_t)arg);
+	}
+
+	return 0;
+}
+
+/*
+ * __liberio_log_format - printf() from a binary record
+ *
+ * Walks the format string and formats one conversion at a time, the
+ * length modifier tells what type the argument word has to be cast back
+ * to. Conversions beyond the recorded arguments end the message.
+ */
+static void __liberio_log_format(char *out, size_t size,
+				 const struct liberio_log_rec *rec)
+{
+	const char *p = rec->fmt, *start;
+	unsigned int arg = 0;
+	char spec[32];
+	size_t pos = 0;
+	int len;
+
+	while (*p && pos + 1 < size) {
+		if (*p != '%') {
+			out[pos++] = *p++;
+			continue;
+		}
+
+		if (p[1] == '%') {
+			out[pos++] = '%';
+			p += 2;
+			continue;
+		}
+
+		start = p++;
+		while (*p && strchr("-+ #0123456789.hlzjt", *p))
+			p++;
+
+		if (!*p || arg >= rec->nargs
+		    || (size_t)(p - start + 1) >= sizeof(spec))
+			break;
+
+		memcpy(spec, start, p - start + 1);
+		spec[p - start + 1] = '\0';
+
+		len = __liberio_log_conv(out + pos, size - pos, spec,
+					 spec + (p - start), rec->args[arg++]);
+		if (len > 0)
+			pos += ((size_t)len < size - pos) ? (size_t)len
+							  : size - pos - 1;
+		p++;
+	}
+
+	out[pos] = '\0';
+
+	if (rec->err && pos + 1 < size)
+		snprintf(out + pos, size - pos, ": %s", strerror(rec->err));
+}
+
+static void __liberio_log_emit(struct liberio_ctx *ctx,
+			       const struct liberio_log_rec *rec)
+{
+	char msg[LOG_MSG_LEN];
+
+	__liberio_log_format(msg, sizeof(msg), rec);
+
+	if (ctx->log_cb)
+		ctx->log_cb(rec->pri, msg, ctx->log_priv);
+	else
+		log_str(rec->pri, rec->token, msg);
+}
+
+void __liberio_log(struct liberio_ctx *ctx, int pri, unsigned int flags,
+		   const char *token, const char *fmt, const uint64_t *args,
+		   unsigned int nargs)
+{
+	struct liberio_log *log = ctx->log;
+	struct liberio_log_rec stack_rec, *rec = &stack_rec;
+	int err = errno;
+	uint32_t idx;
+
+	if (log) {
+		if (liberio_ring_pop(log->free, &idx)) {
+			__atomic_fetch_add(&log->dropped, 1, __ATOMIC_RELAXED);
+			goto out;
+		}
+		rec = log->recs + idx;
+	}
+
+	if (nargs > LIBERIO_LOG_MAX_ARGS)
+		nargs = LIBERIO_LOG_MAX_ARGS;
+
+	rec->pri = pri;
+	rec->err = (flags & LIBERIO_LOG_ERRNO) ? err : 0;
+	rec->token = token;
+	rec->fmt = fmt;
+	rec->nargs = nargs;
+	memcpy(rec->args, args, nargs * sizeof(*args));
+
+	if (log)
+		liberio_ring_push(log->full, idx);
+	else
+		__liberio_log_emit(ctx, rec);
+
+out:
+	/* logging must not clobber what the caller is about to return */
+	errno = err;
+}
+
+/* format and hand out everything queued so far */
+static void __liberio_log_drain(struct liberio_ctx *ctx,
+				struct liberio_log *log)
+{
+	struct liberio_log_rec rec;
+	uint64_t dropped;
+	uint32_t idx;
+
+	while (!liberio_ring_pop(log->full, &idx)) {
+		rec = log->recs[idx];
+		liberio_ring_push(log->free, idx);
+		__liberio_log_emit(ctx, &rec);
+	}
+
+	dropped = __atomic_exchange_n(&log->dropped, 0, __ATOMIC_RELAXED);
+	if (dropped) {
+		rec.pri = LOG_WARNING;
+		rec.err = 0;
+		rec.token = __func__;
+		rec.fmt = "%llu log messages dropped";
+		rec.nargs = 1;
+		rec.args[0] = dropped;
+		__liberio_log_emit(ctx, &rec);
+	}
+}
+
+static void *__liberio_log_thread(void *arg)
+{
+	struct liberio_ctx *ctx = arg;
+	struct liberio_log *log = ctx->log;
+
+	while (__atomic_load_n(&log->running, __ATOMIC_ACQUIRE)) {
+		__liberio_log_drain(ctx, log);
+		usleep(LOG_FLUSH_US);
+	}
+
+	return NULL;
+}
+
+/*
+ * liberio_ctx_flush_log - Hand out queued log messages now
+ * @ctx: the liberio context
+ *
+ * Formats and hands out everything logged asynchronously so far from the
+ * calling thread, a no-op for synchronous logging.
+ */
+void liberio_ctx_flush_log(struct liberio_ctx *ctx)
+{
+	if (ctx->log)
+		__liberio_log_drain(ctx, ctx->log);
+}
+
+void __liberio_log_free(struct liberio_ctx *ctx)
+{
+	struct liberio_log *log = ctx->log;
+
+	if (!log)
+		return;
+
+	if (log->running) {
+		__atomic_store_n(&log->running, 0, __ATOMIC_RELEASE);
+		pthread_join(log->thread, NULL);
+	}
+
+	ctx->log = NULL;
+	__liberio_log_drain(ctx, log);
+
+	__liberio_ring_free(log->full);
+	__liberio_ring_free(log->free);
+	free(log->recs);
+	free(log);
+}
+
+/*
+ * liberio_ctx_set_log_async - Defer formatting of log messages
+ * @ctx: the liberio context
+ * @entries: number of messages that can be queued, 0 to log synchronously
+ * @thread: start a thread that hands messages out every 10ms, otherwise
+ * they wait for liberio_ctx_flush_log()
+ *
+ * Must not race with logging on channels of @ctx. Messages that find the
+ * queue full are dropped and reported as a count on the next drain.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int liberio_ctx_set_log_async(struct liberio_ctx *ctx, size_t entries,
+			      int thread)
+{
+	struct liberio_log *log;
+	uint32_t i;
+	int err;
+
+	__liberio_log_free(ctx);
+
+	if (!entries)
+		return 0;
+
+	log = calloc(1, sizeof(*log));
+	if (!log)
+		return -ENOMEM;
+
+	log->recs = calloc(entries, sizeof(*log->recs));
+	log->free = __liberio_ring_new(entries);
+	log->full = __liberio_ring_new(entries);
+	if (!log->recs || !log->free || !log->full) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	for (i = 0; i < entries; i++)
+		liberio_ring_push(log->free, i);
+
+	ctx->log = log;
+
+	if (thread) {
+		log->running = 1;
+		err = pthread_create(&log->thread, NULL, __liberio_log_thread,
+				     ctx);
+		if (err) {
+			log->running = 0;
+			ctx->log = NULL;
+			err = -err;
+			goto out_free;
+		}
+	}
+
+	return 0;
+
+out_free:
+	__liberio_ring_free(log->full);
+	__liberio_ring_free(log->free);
+	free(log->recs);
+	free(log);
+
+	return err;
+}
@@ -15,7 +15,7 @@
 #include <string.h>
 
 #include "priv.h"
-#include "log.h"
+#include "clog.h"
 #include "kernel.h"
 #include "util.h"
 
@@ -36,10 +36,10 @@ int __liberio_buf_init_mmap(struct liberio_chan *chan,
 	breq.index = index;
 	breq.memory = USRP_MEMORY_MMAP;
 
-	err = liberio_ioctl(chan->fd, USRPIOC_QUERYBUF, &breq);
+	err = chan->backend->querybuf(chan, &breq);
 	if (err) {
-		log_warn(__func__,
-			"failed to create liberio_buf for index %u", index);
+		ctx_warn(chan->ctx,
+			"failed to create liberio_buf for index %zu", index);
 		return err;
 	}
 
@@ -47,12 +47,9 @@ int __liberio_buf_init_mmap(struct liberio_chan *chan,
 	buf->len = breq.length;
 	buf->valid_bytes = buf->len;
 
-	buf->mem = mmap(NULL, breq.length,
-			PROT_READ | PROT_WRITE,
-			MAP_SHARED, chan->fd,
-			breq.m.offset);
+	buf->mem = chan->backend->mmap(chan, breq.length, breq.m.offset);
 	if (buf->mem == MAP_FAILED) {
-		log_warn(__func__, "failed to mmap buffer with index %u",
+		ctx_warn(chan->ctx, "failed to mmap buffer with index %zu",
 			 index);
 		return err;
 	}
@@ -60,7 +57,7 @@ int __liberio_buf_init_mmap(struct liberio_chan *chan,
 	return err;
 }
 
-const struct liberio_buf_ops liberio_buf_mmap_ops = {
+const struct liberio_buf_ops __liberio_buf_mmap_ops = {
 	.init		=	__liberio_buf_init_mmap,
 	.release	=	__liberio_buf_release_mmap,
 };
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "priv.h"
+#include "clog.h"
+
+#define POLLER_MAX_EVENTS 64
+
+struct liberio_poller_entry {
+	struct liberio_chan *chan;
+	struct list_head node;
+};
+
+static void __liberio_poller_free(const struct ref *ref)
+{
+	struct liberio_poller *poller = container_of(ref,
+						     struct liberio_poller,
+						     refcnt);
+	struct liberio_poller_entry *entry, *tmp;
+
+	if (!poller)
+		return;
+
+	list_for_each_entry_safe(entry, tmp, &poller->chans, node) {
+		list_del(&entry->node);
+		liberio_chan_put(entry->chan);
+		free(entry);
+	}
+
+	close(poller->epfd);
+	liberio_ctx_put(poller->ctx);
+	free(poller);
+}
+
+struct liberio_poller *liberio_ctx_alloc_poller(struct liberio_ctx *ctx)
+{
+	struct liberio_poller *poller;
+
+	poller = calloc(1, sizeof(*poller));
+	if (!poller)
+		return NULL;
+
+	poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (poller->epfd < 0) {
+		ctx_warn(ctx, "failed to create epoll instance");
+		free(poller);
+		return NULL;
+	}
+
+	pthread_spin_init(&poller->lock, 0);
+	INIT_LIST_HEAD(&poller->chans);
+
+	liberio_ctx_get(ctx);
+	poller->ctx = ctx;
+	poller->refcnt = (struct ref){__liberio_poller_free, 1};
+
+	return poller;
+}
+
+inline void liberio_poller_put(struct liberio_poller *poller)
+{
+	ref_dec(&poller->refcnt);
+}
+
+inline void liberio_poller_get(struct liberio_poller *poller)
+{
+	ref_inc(&poller->refcnt);
+}
+
+/*
+ * liberio_poller_add_chan - Register a channel with a poller
+ * @poller: the poller
+ * @chan: the channel, RX channels are watched for readability,
+ *        TX channels for writability
+ *
+ * The poller holds a reference to the channel until it gets removed
+ * again or the poller is freed.
+ */
+int liberio_poller_add_chan(struct liberio_poller *poller,
+			    struct liberio_chan *chan)
+{
+	struct liberio_poller_entry *entry;
+	struct epoll_event ev;
+	int err;
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+
+	memset(&ev, 0, sizeof(ev));
+	/* EPOLLIN and EPOLLOUT match their poll() counterparts */
+	ev.events = chan->fd_events;
+	ev.data.ptr = chan;
+
+	err = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, chan->fd, &ev);
+	if (err) {
+		err = -errno;
+		free(entry);
+		return err;
+	}
+
+	liberio_chan_get(chan);
+	entry->chan = chan;
+
+	pthread_spin_lock(&poller->lock);
+	list_add_tail(&entry->node, &poller->chans);
+	pthread_spin_unlock(&poller->lock);
+
+	return 0;
+}
+
+int liberio_poller_del_chan(struct liberio_poller *poller,
+			    struct liberio_chan *chan)
+{
+	struct liberio_poller_entry *entry, *tmp;
+	struct liberio_poller_entry *found = NULL;
+
+	pthread_spin_lock(&poller->lock);
+	list_for_each_entry_safe(entry, tmp, &poller->chans, node) {
+		if (entry->chan == chan) {
+			list_del(&entry->node);
+			found = entry;
+			break;
+		}
+	}
+	pthread_spin_unlock(&poller->lock);
+
+	if (!found)
+		return -ENOENT;
+
+	epoll_ctl(poller->epfd, EPOLL_CTL_DEL, chan->fd, NULL);
+	liberio_chan_put(chan);
+	free(found);
+
+	return 0;
+}
+
+/* hand out TX buffers that sit on a free list, the fd won't tell */
+static size_t __liberio_poller_get_free(struct liberio_poller *poller,
+					struct liberio_poll_event *events,
+					size_t max_events)
+{
+	struct liberio_poller_entry *entry;
+	struct liberio_buf *buf;
+	size_t n = 0;
+
+	pthread_spin_lock(&poller->lock);
+	list_for_each_entry(entry, &poller->chans, node) {
+		if (n == max_events)
+			break;
+
+		buf = __liberio_chan_get_free(entry->chan);
+		if (!buf)
+			continue;
+
+		events[n].chan = entry->chan;
+		events[n].buf = buf;
+		events[n].err = 0;
+		n++;
+	}
+	pthread_spin_unlock(&poller->lock);
+
+	return n;
+}
+
+/*
+ * liberio_poller_wait - Wait for any registered channel to become ready
+ * @poller: the poller
+ * @events: array that receives one (channel, buffer) pair per ready channel
+ * @max_events: size of @events
+ * @timeout: the timeout to use in us, negative values wait forever
+ *
+ * Every returned event carries a buffer that has already been dequeued
+ * from its channel, i.e. it is owned by the application until it gets
+ * enqueued again. TX buffers on a channel's free list count as ready,
+ * they are handed out before waiting as the driver never signals them.
+ *
+ * A channel whose fd signals readiness but fails to dequeue, e.g. one
+ * that isn't streaming, gets an event with a NULL buffer and the error
+ * in err, so callers don't mistake it for a timeout and spin.
+ *
+ * Returns the number of events, 0 on timeout or a negative error code.
+ */
+int liberio_poller_wait(struct liberio_poller *poller,
+			struct liberio_poll_event *events, size_t max_events,
+			int timeout)
+{
+	struct epoll_event evs[POLLER_MAX_EVENTS];
+	struct liberio_chan *chan;
+	struct liberio_buf *buf;
+	int timeout_ms;
+	int nready, i, err;
+	size_t n;
+
+	if (!max_events)
+		return -EINVAL;
+
+	if (max_events > POLLER_MAX_EVENTS)
+		max_events = POLLER_MAX_EVENTS;
+
+	n = __liberio_poller_get_free(poller, events, max_events);
+	if (n == max_events)
+		return n;
+
+	/* epoll only does ms, round up so we never return early */
+	timeout_ms = (timeout >= 0) ? (timeout + 999) / 1000 : -1;
+	if (n)
+		timeout_ms = 0;
+
+	do {
+		nready = epoll_wait(poller->epfd, evs, max_events - n,
+				    timeout_ms);
+	} while (-1 == nready && EINTR == errno);
+
+	if (nready < 0) {
+		err = -errno;
+		ctx_warn(poller->ctx, "epoll_wait failed");
+		return n ? (int)n : err;
+	}
+
+	for (i = 0; i < nready; i++) {
+		chan = evs[i].data.ptr;
+
+		err = __liberio_chan_try_dequeue(chan, &buf);
+		/* a spurious wakeup or another thread beat us to it */
+		if (err == -EAGAIN && !(evs[i].events & (EPOLLERR | EPOLLHUP)))
+			continue;
+		if (err == -EAGAIN)
+			err = -EIO;
+
+		events[n].chan = chan;
+		events[n].buf = err ? NULL : buf;
+		events[n].err = err;
+		n++;
+	}
+
+	return n;
+}
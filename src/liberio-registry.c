@@ -0,0 +1,738 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef LIBERIO_HAVE_UDEV
+#include <libudev.h>
+#endif
+
+#include "priv.h"
+#include "clog.h"
+#include "util.h"
+
+#define LIBERIO_DEV_DIR		"/dev"
+
+/*
+ * struct liberio_dev_entry - A DMA device known to the registry
+ */
+struct liberio_dev_entry {
+	struct liberio_dev_info info;
+	dev_t devnum;
+	struct list_head node;
+};
+
+/*
+ * struct liberio_registry - Enumerated DMA devices of a context
+ *
+ * Devices are kept on a list and indexed by port and direction in a
+ * direct mapped table, ports that don't fit into the table are only on
+ * the list. Everything is protected by the context lock.
+ */
+struct liberio_registry {
+	struct list_head devs;
+	size_t ndevs;
+	struct liberio_dev_entry *by_port[2][LIBERIO_REG_PORTS];
+
+#ifdef LIBERIO_HAVE_UDEV
+	struct udev_monitor *mon;
+#endif
+
+	void (*hotplug_cb)(struct liberio_ctx *ctx,
+			   const struct liberio_dev_info *info, int added,
+			   void *priv);
+	void *hotplug_priv;
+};
+
+static inline int __liberio_port_indexed(int port)
+{
+	return port >= 0 && port < LIBERIO_REG_PORTS;
+}
+
+/* rx-dma<n> and tx-dma<n> are ours, the name also tells the direction */
+static int __liberio_dev_name_dir(const char *name,
+				  enum liberio_direction *dir)
+{
+	if (!strncmp(name, "rx-dma", 6))
+		*dir = RX;
+	else if (!strncmp(name, "tx-dma", 6))
+		*dir = TX;
+	else
+		return -ENODEV;
+
+	return 0;
+}
+
+static struct liberio_dev_entry *
+__liberio_registry_find_devnum(struct liberio_registry *reg, dev_t devnum)
+{
+	struct liberio_dev_entry *entry;
+
+	list_for_each_entry(entry, &reg->devs, node)
+		if (entry->devnum == devnum)
+			return entry;
+
+	return NULL;
+}
+
+static struct liberio_dev_entry *
+__liberio_registry_find_port(struct liberio_registry *reg, int port,
+			     enum liberio_direction dir)
+{
+	struct liberio_dev_entry *entry;
+
+	if (__liberio_port_indexed(port))
+		return reg->by_port[dir][port];
+
+	list_for_each_entry(entry, &reg->devs, node)
+		if (entry->info.port == port && entry->info.dir == dir)
+			return entry;
+
+	return NULL;
+}
+
+/*
+ * __liberio_registry_add - Add a device node to the registry
+ * @reg: the registry
+ * @devnode: path of the device node
+ * @devnum: its device number
+ * @info: output for the new entry, may be NULL
+ *
+ * The port comes from the driver's port attribute, or the number at the
+ * end of the name if there is none.
+ *
+ * Returns 0, -EEXIST if the device is known already, -ENAMETOOLONG if
+ * its path doesn't fit into struct liberio_dev_info or another negative
+ * error code.
+ */
+static int __liberio_registry_add(struct liberio_registry *reg,
+				  const char *devnode, dev_t devnum,
+				  struct liberio_dev_info *info)
+{
+	struct liberio_dev_entry *entry;
+	enum liberio_direction dir;
+	const char *name;
+	int port;
+
+	name = strrchr(devnode, '/');
+	name = name ? name + 1 : devnode;
+
+	if (__liberio_dev_name_dir(name, &dir))
+		return -ENODEV;
+
+	if (strlen(devnode) >= sizeof(entry->info.path))
+		return -ENAMETOOLONG;
+
+	if (__liberio_registry_find_devnum(reg, devnum))
+		return -EEXIST;
+
+	port = __liberio_sysfs_read_int(devnum, "port");
+	if (port < 0)
+		port = __liberio_port_from_name(name);
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+
+	strcpy(entry->info.path, devnode);
+	entry->info.port = port;
+	entry->info.dir = dir;
+	entry->info.api_maj = __liberio_sysfs_read_int(devnum, "api_maj");
+	entry->info.api_min = __liberio_sysfs_read_int(devnum, "api_min");
+	entry->devnum = devnum;
+
+	list_add_tail(&entry->node, &reg->devs);
+	reg->ndevs++;
+
+	if (__liberio_port_indexed(port))
+		reg->by_port[dir][port] = entry;
+
+	if (info)
+		*info = entry->info;
+
+	return 0;
+}
+
+#ifdef LIBERIO_HAVE_UDEV
+static void __liberio_registry_del(struct liberio_registry *reg,
+				   struct liberio_dev_entry *entry)
+{
+	struct liberio_dev_entry *other;
+	int port = entry->info.port;
+	enum liberio_direction dir = entry->info.dir;
+
+	list_del(&entry->node);
+	reg->ndevs--;
+
+	/* another node might serve the same port, e.g. after a rename */
+	if (__liberio_port_indexed(port) && reg->by_port[dir][port] == entry) {
+		reg->by_port[dir][port] = NULL;
+		list_for_each_entry(other, &reg->devs, node)
+			if (other->info.port == port && other->info.dir == dir)
+				reg->by_port[dir][port] = other;
+	}
+
+	free(entry);
+}
+
+static int __liberio_registry_add_udev(struct liberio_registry *reg,
+				       struct udev_device *dev,
+				       struct liberio_dev_info *info)
+{
+	const char *devnode = udev_device_get_devnode(dev);
+
+	if (!devnode)
+		return -ENODEV;
+
+	return __liberio_registry_add(reg, devnode,
+				      udev_device_get_devnum(dev), info);
+}
+
+static int __liberio_registry_scan(struct liberio_ctx *ctx,
+				   struct liberio_registry *reg)
+{
+	struct udev_list_entry *list, *item;
+	struct udev_enumerate *en;
+	struct udev_device *dev;
+	const char *subsys;
+	char *filtered = NULL;
+
+	/* listen before enumerating so nothing slips through in between */
+	reg->mon = udev_monitor_new_from_netlink(ctx->udev, "udev");
+	if (reg->mon && udev_monitor_enable_receiving(reg->mon) < 0) {
+		udev_monitor_unref(reg->mon);
+		reg->mon = NULL;
+	}
+	if (!reg->mon)
+		ctx_warnx(ctx, "no udev monitor, hotplug is not tracked");
+
+	en = udev_enumerate_new(ctx->udev);
+	if (!en)
+		return -ENOMEM;
+
+	udev_enumerate_add_match_sysname(en, "rx-dma*");
+	udev_enumerate_add_match_sysname(en, "tx-dma*");
+	udev_enumerate_scan_devices(en);
+
+	list = udev_enumerate_get_list_entry(en);
+	udev_list_entry_foreach(item, list) {
+		dev = udev_device_new_from_syspath(ctx->udev,
+						   udev_list_entry_get_name(item));
+		if (!dev)
+			continue;
+
+		__liberio_registry_add_udev(reg, dev, NULL);
+
+		/*
+		 * Only wake up for the subsystems our devices live in. The
+		 * driver doesn't promise a name, so take it from what we
+		 * found. Without devices yet, every event gets looked at.
+		 */
+		subsys = udev_device_get_subsystem(dev);
+		if (reg->mon && subsys
+		    && (!filtered || strcmp(filtered, subsys))) {
+			udev_monitor_filter_add_match_subsystem_devtype(reg->mon,
+									subsys,
+									NULL);
+			free(filtered);
+			filtered = strdup(subsys);
+		}
+
+		udev_device_unref(dev);
+	}
+
+	udev_enumerate_unref(en);
+
+	if (filtered && udev_monitor_filter_update(reg->mon) < 0)
+		ctx_warn(ctx, "failed to filter udev events");
+	free(filtered);
+
+	return 0;
+}
+#else
+static int __liberio_registry_scan(struct liberio_ctx *ctx,
+				   struct liberio_registry *reg)
+{
+	char path[sizeof(((struct liberio_dev_info *)0)->path)];
+	enum liberio_direction dir;
+	struct stat statbuf;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(LIBERIO_DEV_DIR);
+	if (!d)
+		return -errno;
+
+	while ((de = readdir(d))) {
+		if (__liberio_dev_name_dir(de->d_name, &dir))
+			continue;
+
+		/* can't be reported in a struct liberio_dev_info */
+		if (snprintf(path, sizeof(path), LIBERIO_DEV_DIR "/%s",
+			     de->d_name) >= (int)sizeof(path))
+			continue;
+
+		if (stat(path, &statbuf) < 0 || !S_ISCHR(statbuf.st_mode))
+			continue;
+
+		__liberio_registry_add(reg, path, statbuf.st_rdev, NULL);
+	}
+
+	closedir(d);
+
+	return 0;
+}
+#endif
+
+/* called with the context lock held */
+static int __liberio_registry_get(struct liberio_ctx *ctx,
+				  struct liberio_registry **regp)
+{
+	struct liberio_registry *reg;
+	int err;
+
+	if (ctx->reg) {
+		*regp = ctx->reg;
+		return 0;
+	}
+
+	reg = calloc(1, sizeof(*reg));
+	if (!reg)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&reg->devs);
+
+	err = __liberio_registry_scan(ctx, reg);
+	if (err) {
+		ctx->reg = reg;
+		__liberio_registry_free(ctx);
+		return err;
+	}
+
+	ctx->reg = reg;
+	*regp = reg;
+
+	return 0;
+}
+
+void __liberio_registry_free(struct liberio_ctx *ctx)
+{
+	struct liberio_registry *reg = ctx->reg;
+	struct liberio_dev_entry *entry, *tmp;
+
+	if (!reg)
+		return;
+
+	list_for_each_entry_safe(entry, tmp, &reg->devs, node)
+		free(entry);
+
+#ifdef LIBERIO_HAVE_UDEV
+	if (reg->mon)
+		udev_monitor_unref(reg->mon);
+#endif
+
+	ctx->reg = NULL;
+	free(reg);
+}
+
+/*
+ * liberio_ctx_scan_devices - Enumerate the DMA devices
+ * @ctx: the liberio context
+ *
+ * Happens once, on the first registry call, and starts tracking hotplug
+ * events. Calling it again drops what is known and enumerates anew.
+ *
+ * Returns the number of devices found or a negative error code.
+ */
+int liberio_ctx_scan_devices(struct liberio_ctx *ctx)
+{
+	struct liberio_registry *reg;
+	void (*cb)(struct liberio_ctx *, const struct liberio_dev_info *, int,
+		   void *) = NULL;
+	void *priv = NULL;
+	int err;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	if (ctx->reg) {
+		cb = ctx->reg->hotplug_cb;
+		priv = ctx->reg->hotplug_priv;
+		__liberio_registry_free(ctx);
+	}
+
+	err = __liberio_registry_get(ctx, &reg);
+	if (!err) {
+		reg->hotplug_cb = cb;
+		reg->hotplug_priv = priv;
+		err = reg->ndevs;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return err;
+}
+
+/*
+ * liberio_ctx_get_devices - List the DMA devices
+ * @ctx: the liberio context
+ * @devs: output array
+ * @max: size of @devs
+ *
+ * Returns the number of devices, which may be more than @max, or a
+ * negative error code.
+ */
+int liberio_ctx_get_devices(struct liberio_ctx *ctx,
+			    struct liberio_dev_info *devs, size_t max)
+{
+	struct liberio_dev_entry *entry;
+	struct liberio_registry *reg;
+	size_t n = 0;
+	int err;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	err = __liberio_registry_get(ctx, &reg);
+	if (!err) {
+		list_for_each_entry(entry, &reg->devs, node) {
+			if (n < max)
+				devs[n] = entry->info;
+			n++;
+		}
+		err = n;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return err;
+}
+
+/*
+ * liberio_ctx_find_device - Look up the DMA device for a port
+ * @ctx: the liberio context
+ * @port: the port
+ * @dir: the direction
+ * @info: output for the device
+ *
+ * Returns 0, -ENODEV if there is no such device or another negative
+ * error code.
+ */
+int liberio_ctx_find_device(struct liberio_ctx *ctx, int port,
+			    enum liberio_direction dir,
+			    struct liberio_dev_info *info)
+{
+	struct liberio_dev_entry *entry;
+	struct liberio_registry *reg;
+	int err;
+
+	if (dir != TX && dir != RX)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	err = __liberio_registry_get(ctx, &reg);
+	if (!err) {
+		entry = __liberio_registry_find_port(reg, port, dir);
+		if (entry)
+			*info = entry->info;
+		else
+			err = -ENODEV;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return err;
+}
+
+struct liberio_chan *liberio_ctx_alloc_chan_by_port(struct liberio_ctx *ctx,
+						    int port,
+						    enum liberio_direction dir,
+						    enum usrp_memory mem_type)
+{
+	struct liberio_dev_info info;
+
+	if (liberio_ctx_find_device(ctx, port, dir, &info))
+		return NULL;
+
+	return liberio_ctx_alloc_chan(ctx, info.path, dir, mem_type);
+}
+
+/*
+ * liberio_ctx_get_monitor_fd - fd that signals hotplug events
+ * @ctx: the liberio context
+ *
+ * The fd polls readable when liberio_ctx_process_hotplug() has events to
+ * process. It stays owned by the context.
+ *
+ * Returns the fd or a negative error code, -ENOTSUP without libudev.
+ */
+int liberio_ctx_get_monitor_fd(struct liberio_ctx *ctx)
+{
+#ifdef LIBERIO_HAVE_UDEV
+	struct liberio_registry *reg;
+	int err;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	err = __liberio_registry_get(ctx, &reg);
+	if (!err)
+		err = reg->mon ? udev_monitor_get_fd(reg->mon) : -ENOTSUP;
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return err;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+int liberio_ctx_set_hotplug_callback(struct liberio_ctx *ctx,
+				     void (*cb)(struct liberio_ctx *ctx,
+						const struct liberio_dev_info *info,
+						int added, void *priv),
+				     void *priv)
+{
+	struct liberio_registry *reg;
+	int err;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	err = __liberio_registry_get(ctx, &reg);
+	if (!err) {
+		reg->hotplug_cb = cb;
+		reg->hotplug_priv = priv;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return err;
+}
+
+/*
+ * liberio_ctx_process_hotplug - Apply pending hotplug events
+ * @ctx: the liberio context
+ *
+ * Does not block. Added and removed DMA devices are reported to the
+ * hotplug callback, without the registry locked, so the callback may use
+ * the registry. Channels open on a removed device are left alone.
+ *
+ * Returns the number of devices that came or went or a negative error
+ * code.
+ */
+int liberio_ctx_process_hotplug(struct liberio_ctx *ctx)
+{
+#ifdef LIBERIO_HAVE_UDEV
+	void (*cb)(struct liberio_ctx *, const struct liberio_dev_info *, int,
+		   void *);
+	struct liberio_dev_entry *entry;
+	struct liberio_registry *reg;
+	struct liberio_dev_info info;
+	struct udev_device *dev;
+	const char *action;
+	void *priv;
+	int added, err, n = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&ctx->lock);
+
+		err = __liberio_registry_get(ctx, &reg);
+		if (err) {
+			pthread_mutex_unlock(&ctx->lock);
+			return err;
+		}
+
+		if (!reg->mon) {
+			pthread_mutex_unlock(&ctx->lock);
+			return -ENOTSUP;
+		}
+
+		/* the monitor socket is non-blocking */
+		dev = udev_monitor_receive_device(reg->mon);
+		if (!dev) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+
+		action = udev_device_get_action(dev);
+		added = -1;
+
+		if (action && !strcmp(action, "add")) {
+			if (!__liberio_registry_add_udev(reg, dev, &info))
+				added = 1;
+		} else if (action && !strcmp(action, "remove")) {
+			entry = __liberio_registry_find_devnum(reg,
+					udev_device_get_devnum(dev));
+			if (entry) {
+				info = entry->info;
+				__liberio_registry_del(reg, entry);
+				added = 0;
+			}
+		}
+
+		udev_device_unref(dev);
+		cb = reg->hotplug_cb;
+		priv = reg->hotplug_priv;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if (added < 0)
+			continue;
+
+		/* info lives on our stack, async logging needs literals */
+		ctx_info(ctx, "%s device on port %d %s",
+			 (info.dir == RX) ? "RX" : "TX", info.port,
+			 added ? "added" : "removed");
+		n++;
+
+		if (cb)
+			cb(ctx, &info, added, priv);
+	}
+
+	return n;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * __liberio_registry_add_chan - Make a new channel known to its context
+ * @chan: the liberio channel
+ *
+ * Open channels are on the context's list and indexed by port and
+ * direction, the latest channel on a port wins.
+ */
+void __liberio_registry_add_chan(struct liberio_chan *chan)
+{
+	struct liberio_ctx *ctx = chan->ctx;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	list_add_tail(&chan->node, &ctx->chans);
+	if (__liberio_port_indexed(chan->port))
+		ctx->chan_by_port[chan->dir][chan->port] = chan;
+
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+void __liberio_registry_del_chan(struct liberio_chan *chan)
+{
+	struct liberio_ctx *ctx = chan->ctx;
+	struct liberio_chan *other;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	list_del(&chan->node);
+
+	if (__liberio_port_indexed(chan->port)
+	    && ctx->chan_by_port[chan->dir][chan->port] == chan) {
+		ctx->chan_by_port[chan->dir][chan->port] = NULL;
+		list_for_each_entry(other, &ctx->chans, node)
+			if (other->port == chan->port && other->dir == chan->dir)
+				ctx->chan_by_port[chan->dir][chan->port] = other;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * liberio_ctx_lookup_chan - Find an open channel by port
+ * @ctx: the liberio context
+ * @port: the port
+ * @dir: the direction
+ *
+ * Returns the channel with a reference taken, drop it with
+ * liberio_chan_put(), or NULL if none is open.
+ */
+struct liberio_chan *liberio_ctx_lookup_chan(struct liberio_ctx *ctx, int port,
+					     enum liberio_direction dir)
+{
+	struct liberio_chan *chan = NULL, *iter;
+
+	if (dir != TX && dir != RX)
+		return NULL;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	if (__liberio_port_indexed(port)) {
+		chan = ctx->chan_by_port[dir][port];
+	} else {
+		list_for_each_entry(iter, &ctx->chans, node)
+			if (iter->port == port && iter->dir == dir)
+				chan = iter;
+	}
+
+	/* a channel on its way out is still listed until its free runs */
+	if (chan && !ref_get_unless_zero(&chan->refcnt))
+		chan = NULL;
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return chan;
+}
+
+/*
+ * liberio_ctx_stop_streaming - Stop streaming on all open channels
+ * @ctx: the liberio context
+ *
+ * Returns 0 or the first error, the remaining channels are still stopped.
+ */
+int liberio_ctx_stop_streaming(struct liberio_ctx *ctx)
+{
+	struct liberio_chan *chan;
+	int err, ret = 0;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	list_for_each_entry(chan, &ctx->chans, node) {
+		err = liberio_chan_stop_streaming(chan);
+		if (err && !ret)
+			ret = -errno;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return ret;
+}
+
+/*
+ * liberio_ctx_get_stats - Snapshot the statistics of all open channels
+ * @ctx: the liberio context
+ * @stats: output array
+ * @max: size of @stats
+ *
+ * Returns the number of open channels, which may be more than @max.
+ */
+int liberio_ctx_get_stats(struct liberio_ctx *ctx,
+			  struct liberio_ctx_chan_stats *stats, size_t max)
+{
+	struct liberio_chan *chan;
+	size_t n = 0;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	list_for_each_entry(chan, &ctx->chans, node) {
+		if (n < max) {
+			stats[n].port = chan->port;
+			stats[n].dir = chan->dir;
+			liberio_chan_get_stats(chan, &stats[n].stats);
+		}
+		n++;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return n;
+}
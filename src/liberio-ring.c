@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+/*
+ * __liberio_ring_new - Allocate a ring
+ * @size: minimum number of entries, rounded up to a power of two
+ */
+struct liberio_ring *__liberio_ring_new(size_t size)
+{
+	struct liberio_ring *ring;
+	uint32_t i, n = 1;
+
+	while (n < size)
+		n <<= 1;
+
+	if (posix_memalign((void **)&ring, LIBERIO_CACHELINE, sizeof(*ring)))
+		return NULL;
+	memset(ring, 0, sizeof(*ring));
+
+	if (posix_memalign((void **)&ring->cells, LIBERIO_CACHELINE,
+			   n * sizeof(*ring->cells))) {
+		free(ring);
+		return NULL;
+	}
+
+	for (i = 0; i < n; i++)
+		ring->cells[i].seq = i;
+
+	ring->mask = n - 1;
+
+	return ring;
+}
+
+void __liberio_ring_free(struct liberio_ring *ring)
+{
+	if (!ring)
+		return;
+
+	free(ring->cells);
+	free(ring);
+}
+
+/*
+ * __liberio_spsc_new - Allocate a single producer, single consumer ring
+ * @size: minimum number of entries, rounded up to a power of two
+ */
+struct liberio_spsc *__liberio_spsc_new(size_t size)
+{
+	struct liberio_spsc *ring;
+	uint32_t n = 1;
+
+	while (n < size)
+		n <<= 1;
+
+	if (posix_memalign((void **)&ring, LIBERIO_CACHELINE, sizeof(*ring)))
+		return NULL;
+	memset(ring, 0, sizeof(*ring));
+
+	ring->vals = calloc(n, sizeof(*ring->vals));
+	if (!ring->vals) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->mask = n - 1;
+
+	return ring;
+}
+
+void __liberio_spsc_free(struct liberio_spsc *ring)
+{
+	if (!ring)
+		return;
+
+	free(ring->vals);
+	free(ring);
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include <liberio/liberio.h>
+#include <errno.h>
+
+#include "priv.h"
+#include "clog.h"
+
+#define RUN_BATCH 32
+/* how often the TX drain checks for liberio_chan_stop_run(), in us */
+#define RUN_DRAIN_SLICE 100000
+
+/*
+ * liberio_chan_set_rx_callback - Set the callback liberio_chan_run() calls
+ * for every filled RX buffer
+ * @chan: an RX channel
+ * @cb: the callback, NULL to clear it
+ * @priv: passed to @cb
+ *
+ * @cb must not enqueue @buf, it gets re-enqueued as soon as @cb returns.
+ * A positive return value stops the loop, a negative one aborts it with
+ * that error.
+ */
+int liberio_chan_set_rx_callback(struct liberio_chan *chan,
+				 int (*cb)(struct liberio_chan *chan,
+					   struct liberio_buf *buf,
+					   void *priv),
+				 void *priv)
+{
+	if (chan->dir != RX)
+		return -EINVAL;
+
+	chan->rx_cb = cb;
+	chan->cb_priv = priv;
+
+	return 0;
+}
+
+/*
+ * liberio_chan_set_tx_fill_callback - Set the callback liberio_chan_run()
+ * calls to fill every free TX buffer
+ * @chan: a TX channel
+ * @cb: the callback, NULL to clear it
+ * @priv: passed to @cb
+ *
+ * @cb fills @buf and sets its payload, the buffer gets submitted as soon
+ * as @cb returns 0. A positive return value stops the loop without
+ * submitting @buf, a negative one aborts it with that error.
+ */
+int liberio_chan_set_tx_fill_callback(struct liberio_chan *chan,
+				      int (*cb)(struct liberio_chan *chan,
+						struct liberio_buf *buf,
+						void *priv),
+				      void *priv)
+{
+	if (chan->dir != TX)
+		return -EINVAL;
+
+	chan->tx_fill_cb = cb;
+	chan->cb_priv = priv;
+
+	return 0;
+}
+
+/*
+ * liberio_chan_stop_run - Make liberio_chan_run() return
+ * @chan: the channel
+ *
+ * Safe to call from the callback or from another thread, the loop
+ * returns after the batch it is working on. TX buffers still in flight
+ * are not waited for then, stopping the stream takes them back. A stop
+ * issued before liberio_chan_run() starts makes it return right away,
+ * the request is cleared when the run returns.
+ */
+void liberio_chan_stop_run(struct liberio_chan *chan)
+{
+	__atomic_store_n(&chan->run_stop, 1, __ATOMIC_RELEASE);
+}
+
+static int __liberio_chan_run_rx(struct liberio_chan *chan, int timeout)
+{
+	struct liberio_buf *bufs[RUN_BATCH];
+	int ret = 0, err, n, i;
+
+	while (!ret && !__atomic_load_n(&chan->run_stop, __ATOMIC_ACQUIRE)) {
+		n = liberio_chan_buf_dequeue_many(chan, bufs, RUN_BATCH, 1,
+						  timeout);
+		if (n < 0)
+			return n;
+		if (!n)
+			return -ETIMEDOUT;
+
+		/*
+		 * Hand each buffer back right after its callback, so the
+		 * driver is never short more than the one being worked on.
+		 * Once told to stop, the rest of the batch goes back unseen.
+		 */
+		for (i = 0; i < n; i++) {
+			if (!ret)
+				ret = chan->rx_cb(chan, bufs[i], chan->cb_priv);
+
+			err = liberio_chan_buf_enqueue(chan, bufs[i]);
+			if (err) {
+				ctx_warn(chan->ctx, "failed to enqueue buffer");
+				return -errno;
+			}
+		}
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * fill and submit one buffer, returns the callback's verdict
+ *
+ * Buffers that don't get submitted stay off the free list until the run
+ * ends, otherwise dequeue would hand them out again as completions.
+ */
+static int __liberio_chan_run_fill(struct liberio_chan *chan,
+				   struct liberio_buf *buf, size_t *inflight)
+{
+	int ret;
+
+	ret = chan->tx_fill_cb(chan, buf, chan->cb_priv);
+	if (ret)
+		return ret;
+
+	if (liberio_chan_buf_enqueue(chan, buf)) {
+		ctx_warn(chan->ctx, "failed to enqueue buffer");
+		return -errno;
+	}
+
+	(*inflight)++;
+
+	return 0;
+}
+
+static int __liberio_chan_run_tx(struct liberio_chan *chan, int timeout)
+{
+	struct liberio_buf *bufs[RUN_BATCH];
+	struct liberio_buf *buf;
+	uint64_t now, deadline = 0;
+	size_t inflight = 0;
+	int ret = 0, slice, n, i;
+
+	/* get the whole free list in flight before waiting for anything */
+	while (!ret && (buf = __liberio_chan_get_free(chan)))
+		ret = __liberio_chan_run_fill(chan, buf, &inflight);
+
+	while (!ret && !__atomic_load_n(&chan->run_stop, __ATOMIC_ACQUIRE)) {
+		n = __liberio_chan_reap(chan, bufs, RUN_BATCH, timeout);
+		if (n < 0) {
+			ret = n;
+			break;
+		}
+		if (!n) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		inflight -= n;
+		for (i = 0; i < n && !ret; i++)
+			ret = __liberio_chan_run_fill(chan, bufs[i], &inflight);
+	}
+
+	/*
+	 * Let what is already queued go out before streaming stops. Only
+	 * the driver gets asked, buffers a stopped fill left on the free
+	 * list never went out and must not count as completed. The wait is
+	 * bounded by @timeout in total and by liberio_chan_stop_run().
+	 */
+	if (timeout >= 0)
+		deadline = __liberio_get_time_us() + timeout;
+
+	while (inflight && !__atomic_load_n(&chan->run_stop, __ATOMIC_ACQUIRE)) {
+		slice = RUN_DRAIN_SLICE;
+		if (timeout >= 0) {
+			now = __liberio_get_time_us();
+			if (now >= deadline)
+				break;
+			if (deadline - now < (uint64_t)slice)
+				slice = deadline - now;
+		}
+
+		n = __liberio_chan_reap(chan, bufs, RUN_BATCH, slice);
+		if (n < 0)
+			break;
+
+		inflight -= n;
+	}
+
+	if (inflight)
+		ctx_warnx(chan->ctx, "%zu buffers did not complete",
+			  inflight);
+
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * liberio_chan_run - Stream through the channel's callback
+ * @chan: a channel with buffers requested and its callback set
+ * @timeout: the timeout for each wait for buffers in us, negative values
+ * wait forever
+ *
+ * Starts streaming and calls the RX or TX fill callback for every buffer
+ * until it asks to stop, liberio_chan_stop_run() gets called or no
+ * buffer completes within @timeout. All buffers must be owned by the
+ * library when called, as after liberio_chan_request_buffers() or a
+ * previous run, streaming is stopped again on return.
+ *
+ * Returns 0 when stopped, -ETIMEDOUT on timeout or a negative error code.
+ */
+int liberio_chan_run(struct liberio_chan *chan, int timeout)
+{
+	int err, ret;
+
+	if (chan->engine || !chan->nbufs)
+		return -EBUSY;
+
+	if ((chan->dir == RX && !chan->rx_cb)
+	    || (chan->dir == TX && !chan->tx_fill_cb))
+		return -EINVAL;
+
+	/* a stop that came in before the loop got going still counts */
+	if (__atomic_load_n(&chan->run_stop, __ATOMIC_ACQUIRE)) {
+		ret = 0;
+		goto out_clear;
+	}
+
+	if (chan->dir == RX) {
+		err = liberio_chan_enqueue_all(chan);
+		if (err) {
+			ctx_crit(chan->ctx, "failed to enqueue buffers");
+			ret = err;
+			goto out_clear;
+		}
+	}
+
+	err = liberio_chan_start_streaming(chan);
+	if (err) {
+		ctx_crit(chan->ctx, "failed to start streaming");
+		ret = -errno;
+		goto out_clear;
+	}
+
+	if (chan->dir == RX)
+		ret = __liberio_chan_run_rx(chan, timeout);
+	else
+		ret = __liberio_chan_run_tx(chan, timeout);
+
+	err = liberio_chan_stop_streaming(chan) ? -errno : 0;
+
+	/* every TX buffer is back with us now */
+	__liberio_chan_reset_free(chan);
+
+	if (!ret)
+		ret = err;
+
+out_clear:
+	__atomic_store_n(&chan->run_stop, 0, __ATOMIC_RELEASE);
+
+	return ret;
+}
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+/* before priv.h, kernel.h #defines the __u* types the uapi headers typedef */
+#include <linux/io_uring.h>
+
+#include <liberio/liberio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "priv.h"
+#include "clog.h"
+
+/* older uapi headers */
+#ifndef IORING_POLL_ADD_MULTI
+#define IORING_POLL_ADD_MULTI	(1U << 0)
+#endif
+
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE	(1U << 1)
+#endif
+
+#ifndef IORING_FEAT_EXT_ARG
+#define IORING_FEAT_EXT_ARG	(1U << 8)
+#define IORING_ENTER_EXT_ARG	(1U << 3)
+
+struct io_uring_getevents_arg {
+	__u64	sigmask;
+	__u32	sigmask_sz;
+	__u32	pad;
+	__u64	ts;
+};
+#endif
+
+/* one poll request in flight at a time, leave some room for re-arming */
+#define URING_ENTRIES 4
+
+/*
+ * struct liberio_uring - io_uring used to wait for the channel fd
+ *
+ * The vb2 style driver has no uring_cmd handler and io_uring has no
+ * ioctl opcode, so QBUF and DQBUF stay plain ioctls. What the ring buys
+ * us is readiness: a multishot POLL_ADD stays armed across wakeups, so a
+ * wait that finds a completion already posted in the CQ ring doesn't
+ * enter the kernel at all, and one that has to sleep does so with a
+ * single io_uring_enter() that also re-arms a single-shot poll on
+ * kernels without multishot.
+ */
+struct liberio_uring {
+	int fd;
+
+	void *sq_ptr;
+	size_t sq_len;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+
+	void *cq_ptr;
+	size_t cq_len;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	unsigned int events;
+	int multishot;
+	int armed;
+	unsigned int pending;
+};
+
+static int __liberio_uring_setup(unsigned int entries,
+				 struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int __liberio_uring_enter(int fd, unsigned int to_submit,
+				 unsigned int min_complete, unsigned int flags,
+				 void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, arg, argsz);
+}
+
+/* queue a POLL_ADD for the channel fd, submitted with the next enter */
+static void __liberio_uring_arm(struct liberio_uring *ring, int fd)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, idx;
+	__u32 events = ring->events;
+
+	tail = *ring->sq_tail;
+	idx = tail & *ring->sq_mask;
+
+	sqe = ring->sqes + idx;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+	sqe->poll32_events = events;
+	sqe->len = ring->multishot ? IORING_POLL_ADD_MULTI : 0;
+
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	ring->pending++;
+	ring->armed = 1;
+}
+
+/*
+ * __liberio_uring_reap - Consume posted completions
+ *
+ * Returns 1 if any of them reported the fd ready, 0 otherwise.
+ */
+static int __liberio_uring_reap(struct liberio_chan *chan)
+{
+	struct liberio_uring *ring = chan->uring;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	int ready = 0;
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		cqe = ring->cqes + (head & *ring->cq_mask);
+
+		if (cqe->res >= 0)
+			ready = 1;
+		else if (cqe->res == -EINVAL && ring->multishot)
+			ring->multishot = 0;
+		else
+			ctx_warnx(chan->ctx, "poll failed (%d)", cqe->res);
+
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			ring->armed = 0;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return ready;
+}
+
+/*
+ * __liberio_uring_wait - Wait for the channel fd through the io_uring
+ * @chan: the liberio channel to wait on
+ * @timeout: the timeout to use in us, negative values wait forever
+ *
+ * Returns > 0 if ready, 0 on timeout or a negative error code, like the
+ * select() based wait.
+ */
+int __liberio_uring_wait(struct liberio_chan *chan, int timeout)
+{
+	struct liberio_uring *ring = chan->uring;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	uint64_t now, deadline = 0;
+	int err;
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout >= 0) {
+		deadline = __liberio_get_time_us() + timeout;
+		arg.ts = (unsigned long)&ts;
+	}
+
+	for (;;) {
+		if (__liberio_uring_reap(chan))
+			return 1;
+
+		/* a submitting enter doesn't report the timeout, keep track */
+		if (timeout >= 0) {
+			now = __liberio_get_time_us();
+			if (now >= deadline)
+				return 0;
+			ts.tv_sec = (deadline - now) / 1000000;
+			ts.tv_nsec = ((deadline - now) % 1000000) * 1000;
+		}
+
+		if (!ring->armed)
+			__liberio_uring_arm(ring, chan->fd);
+
+		err = __liberio_uring_enter(ring->fd, ring->pending, 1,
+					    IORING_ENTER_GETEVENTS |
+					    IORING_ENTER_EXT_ARG,
+					    &arg, sizeof(arg));
+		if (err >= 0) {
+			ring->pending -= err;
+			continue;
+		}
+
+		if (errno == ETIME)
+			return __liberio_uring_reap(chan);
+		if (errno != EINTR) {
+			ctx_warn(chan->ctx, "io_uring_enter failed");
+			return -errno;
+		}
+	}
+}
+
+static void __liberio_uring_unmap(struct liberio_uring *ring)
+{
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_len);
+}
+
+/*
+ * __liberio_uring_init - Set up an io_uring to wait for the channel fd
+ * @chan: the liberio channel
+ *
+ * Needs IORING_ENTER_EXT_ARG (Linux 5.11) for timed waits, multishot
+ * poll (5.13) is used if the kernel has it.
+ *
+ * Returns 0 on success or a negative error code, the channel keeps
+ * using select() then.
+ */
+int __liberio_uring_init(struct liberio_chan *chan)
+{
+	struct liberio_uring *ring;
+	struct io_uring_params p;
+	int err;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return -ENOMEM;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = __liberio_uring_setup(URING_ENTRIES, &p);
+	if (ring->fd < 0) {
+		err = -errno;
+		free(ring);
+		return err;
+	}
+
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		err = -EOPNOTSUPP;
+		goto out_close;
+	}
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_SQ_RING);
+
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_CQ_RING);
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+
+	if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED
+	    || ring->sqes == MAP_FAILED) {
+		err = -errno;
+		goto out_unmap;
+	}
+
+	ring->sq_head = ring->sq_ptr + p.sq_off.head;
+	ring->sq_tail = ring->sq_ptr + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ptr + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ptr + p.sq_off.array;
+
+	ring->cq_head = ring->cq_ptr + p.cq_off.head;
+	ring->cq_tail = ring->cq_ptr + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ptr + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ptr + p.cq_off.cqes;
+
+	ring->events = chan->fd_events;
+	ring->multishot = 1;
+
+	chan->uring = ring;
+
+	return 0;
+
+out_unmap:
+	__liberio_uring_unmap(ring);
+out_close:
+	close(ring->fd);
+	free(ring);
+
+	return err;
+}
+
+void __liberio_uring_free(struct liberio_chan *chan)
+{
+	struct liberio_uring *ring = chan->uring;
+
+	if (!ring)
+		return;
+
+	__liberio_uring_unmap(ring);
+	close(ring->fd);
+	free(ring);
+
+	chan->uring = NULL;
+}
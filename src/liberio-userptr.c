@@ -10,42 +10,244 @@
  */
 
 #include <liberio/liberio.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 #include "priv.h"
-#include "log.h"
+#include "clog.h"
+
+size_t __liberio_hugepage_size(void)
+{
+	static size_t hugepage_size;
+	char line[128];
+	FILE *fp;
+
+	if (hugepage_size)
+		return hugepage_size;
+
+	hugepage_size = 2 * 1024 * 1024;
+
+	fp = fopen("/proc/meminfo", "r");
+	if (!fp)
+		return hugepage_size;
+
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned long kb;
+
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+			hugepage_size = kb * 1024;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return hugepage_size;
+}
+
+/*
+ * Back a range of USERPTR buffers with a single mapping, preferring
+ * explicit hugetlbfs pages, then anonymous memory with transparent huge
+ * pages if the range spans at least one huge page, then plain anonymous
+ * pages. Every liberio_chan_request_buffers() (and every grow) gets one
+ * arena.
+ *
+ * Only hugetlb pages are known to be physically contiguous. There the
+ * stride is rounded up to a power of two, which divides the huge page
+ * size, so no buffer straddles two huge pages. Anonymous memory,
+ * transparent huge pages included, only gives that guarantee per page,
+ * so larger buffers there can't be used with drivers needing contiguous
+ * memory (vb2-dma-contig).
+ */
+static int __liberio_pool_init_userptr(struct liberio_chan *chan,
+				       size_t first, size_t num)
+{
+	struct liberio_arena *arena;
+	size_t page = getpagesize();
+	size_t huge = __liberio_hugepage_size();
+	size_t stride, len;
+	void *mem;
+
+	if (!chan->buf_size)
+		chan->buf_size = page;
+
+	if (chan->buf_size > huge) {
+		ctx_crit(chan->ctx, "buffers of %zu bytes exceed the %zu byte huge page",
+			 chan->buf_size, huge);
+		return -EINVAL;
+	}
+
+	arena = calloc(1, sizeof(*arena));
+	if (!arena)
+		return -ENOMEM;
+
+	arena->first = first;
+	arena->count = num;
+
+	for (stride = page; stride < chan->buf_size; stride <<= 1)
+		;
+	len = (stride * num + huge - 1) & ~(huge - 1);
+
+	mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (mem != MAP_FAILED) {
+		arena->mem = mem;
+		arena->len = len;
+		arena->stride = stride;
+		arena->backing = "hugetlb";
+		goto out;
+	}
+
+	stride = (chan->buf_size + page - 1) & ~(page - 1);
+	len = stride * num;
+
+	mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		ctx_crit(chan->ctx, "failed to allocate %zu bytes for %zu buffers",
+			 len, num);
+		free(arena);
+		return -ENOMEM;
+	}
+
+	arena->mem = mem;
+	arena->len = len;
+	arena->stride = stride;
+	arena->backing = "anonymous";
+
+#ifdef MADV_HUGEPAGE
+	if (len >= huge && !madvise(mem, len, MADV_HUGEPAGE))
+		arena->backing = "thp";
+#endif
+
+	if (chan->buf_size > page)
+		ctx_warnx(chan->ctx, "%zu byte buffers without hugetlb pages are not physically contiguous",
+			  chan->buf_size);
+
+out:
+	list_add_tail(&arena->node, &chan->arenas);
+
+	ctx_info(chan->ctx, "%zu buffers of %zu bytes in %zu byte %s arena",
+		 num, chan->buf_size, arena->len, arena->backing);
+
+	return 0;
+}
+
+static void __liberio_pool_release_userptr(struct liberio_chan *chan)
+{
+	struct liberio_arena *arena, *tmp;
+
+	list_for_each_entry_safe(arena, tmp, &chan->arenas, node) {
+		list_del(&arena->node);
+		munmap(arena->mem, arena->len);
+		free(arena);
+	}
+}
 
 static int __liberio_buf_init_userptr(struct liberio_chan *chan,
 				      struct liberio_buf *buf, size_t index)
 {
-	struct usrp_buffer_breq;
-	int err;
+	struct liberio_arena *arena;
 
-	/* until we have scatter gather capabilities, be happy
-	 * with page sized chunks
-	 */
-	err = posix_memalign(&buf->mem, getpagesize(), getpagesize());
-	if (err || !buf->mem)
-		log_crit(__func__, "failed to allocate memory for buf %u",
-			 index);
+	list_for_each_entry(arena, &chan->arenas, node) {
+		if (index < arena->first ||
+		    index >= arena->first + arena->count)
+			continue;
 
-	buf->index = index;
+		buf->index = index;
+		buf->mem = (char *)arena->mem +
+			   (index - arena->first) * arena->stride;
+		buf->len = chan->buf_size;
+		buf->valid_bytes = buf->len;
 
-	/* see above */
-	buf->len = getpagesize();
-	buf->valid_bytes = buf->len;
+		return 0;
+	}
 
-	return 0;
+	return -EINVAL;
 }
 
 static void __liberio_buf_release_userptr(struct liberio_buf *buf)
 {
-	if (buf && buf->mem)
-		free(buf->mem);
+	/* the memory belongs to the arena */
+	if (buf)
+		buf->mem = NULL;
 }
 
-const struct liberio_buf_ops liberio_buf_userptr_ops = {
+const struct liberio_buf_ops __liberio_buf_userptr_ops = {
+	.pool_init	=	__liberio_pool_init_userptr,
+	.pool_release	=	__liberio_pool_release_userptr,
 	.init		=	__liberio_buf_init_userptr,
 	.release	=	__liberio_buf_release_userptr,
 };
 
+/*
+ * USERPTR dequeues only tell us the address and length of the buffer, map
+ * that back to the descriptor with a small open addressing hash table
+ * (linear probing, at most half full) that gets built once per
+ * liberio_chan_request_buffers() call.
+ */
+static inline size_t __liberio_userptr_hash(unsigned long addr,
+					    unsigned int bits)
+{
+	/* fibonacci hashing, the high bits of the product mix all of addr */
+	return (size_t)(((uint64_t)addr * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+}
+
+int __liberio_userptr_index_build(struct liberio_chan *chan)
+{
+	unsigned int bits = 1;
+	size_t i, slot, mask;
+
+	while ((1UL << bits) < 2 * chan->nbufs_alloc)
+		bits++;
+
+	free(chan->addr_index);
+	chan->addr_index = calloc(1UL << bits, sizeof(*chan->addr_index));
+	if (!chan->addr_index)
+		return -ENOMEM;
+
+	chan->addr_index_bits = bits;
+	mask = (1UL << bits) - 1;
+
+	for (i = 0; i < chan->nbufs_alloc; i++) {
+		slot = __liberio_userptr_hash((unsigned long)chan->bufs[i].mem,
+					      bits);
+		while (chan->addr_index[slot])
+			slot = (slot + 1) & mask;
+		chan->addr_index[slot] = chan->bufs + i;
+	}
+
+	return 0;
+}
+
+void __liberio_userptr_index_free(struct liberio_chan *chan)
+{
+	free(chan->addr_index);
+	chan->addr_index = NULL;
+	chan->addr_index_bits = 0;
+}
+
+struct liberio_buf *__liberio_userptr_index_lookup(struct liberio_chan *chan,
+						   unsigned long addr,
+						   size_t len)
+{
+	struct liberio_buf *buf;
+	size_t slot, mask;
+
+	if (!chan->addr_index)
+		return NULL;
+
+	mask = (1UL << chan->addr_index_bits) - 1;
+	slot = __liberio_userptr_hash(addr, chan->addr_index_bits);
+
+	while ((buf = chan->addr_index[slot])) {
+		if ((unsigned long)buf->mem == addr && buf->len == len)
+			return buf;
+		slot = (slot + 1) & mask;
+	}
+
+	return NULL;
+}
@@ -10,51 +10,186 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdint.h>
 #include <sys/socket.h>
 #include <string.h>
+#include <unistd.h>
+#ifdef LIBERIO_HAVE_UDEV
 #include <libudev.h>
+#endif
 
 #include "priv.h"
+#include "util.h"
 
-struct udev_device *liberio_udev_device_from_fd(struct udev *udev,
-						int fd)
+/*
+ * __liberio_sysfs_read - Read a sysfs attribute of a character device
+ * @devnum: the device number
+ * @attr: attribute name below the device's sysfs directory
+ * @buf: output, the value without its trailing newline
+ * @len: size of @buf
+ *
+ * Goes straight to /sys/dev/char/<maj>:<min>/, which is what libudev
+ * ends up reading as well.
+ *
+ * Returns the length of the value or a negative error code.
+ */
+int __liberio_sysfs_read(dev_t devnum, const char *attr, char *buf, size_t len)
 {
-	struct udev_device *dev;
-	struct stat statbuf;
+	char path[PATH_MAX];
+	ssize_t n;
+	int fd;
+
+	if (!len)
+		return -EINVAL;
+
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/%s",
+		 major(devnum), minor(devnum), attr);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	do {
+		n = read(fd, buf, len - 1);
+	} while (-1 == n && EINTR == errno);
+
+	close(fd);
+
+	if (n < 0)
+		return -errno;
+
+	while (n && (buf[n - 1] == '\n' || buf[n - 1] == '\r'))
+		n--;
+	buf[n] = '\0';
+
+	return n;
+}
+
+/*
+ * __liberio_sysfs_read_int - Read a numeric sysfs attribute
+ * @devnum: the device number
+ * @attr: attribute name, its value a plain decimal number
+ *
+ * Returns the value or a negative error code.
+ */
+int __liberio_sysfs_read_int(dev_t devnum, const char *attr)
+{
+	char val[32];
 	int err;
 
-	err = fstat(fd, &statbuf);
+	err = __liberio_sysfs_read(devnum, attr, val, sizeof(val));
 	if (err < 0)
-		return NULL;
+		return err;
 
-	if (!S_ISCHR(statbuf.st_mode))
-		return NULL;
+	return strtol(val, NULL, 10);
+}
 
-	return udev_device_new_from_devnum(udev, 'c', statbuf.st_rdev);
+/* rx-dma3 -> 3, for drivers without a port attribute */
+int __liberio_port_from_name(const char *name)
+{
+	const char *p = name + strlen(name);
+
+	while (p > name && isdigit((unsigned char)p[-1]))
+		p--;
+
+	return *p ? atoi(p) : -ENOENT;
 }
 
-const char *liberio_chan_get_sysattr(struct liberio_chan *chan,
-				     const char *sysattr)
+int __liberio_sysfs_write(dev_t devnum, const char *attr, const char *value)
 {
-	if (!chan || !sysattr)
+	char path[PATH_MAX];
+	size_t len = strlen(value);
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/%s",
+		 major(devnum), minor(devnum), attr);
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	do {
+		n = write(fd, value, len);
+	} while (-1 == n && EINTR == errno);
+
+	close(fd);
+
+	if (n < 0)
+		return -errno;
+
+	return (size_t)n == len ? 0 : -EIO;
+}
+
+#ifdef LIBERIO_HAVE_UDEV
+/* the udev device is only needed for sysattrs, open doesn't pay for it */
+static struct udev_device *__liberio_chan_udev_dev(struct liberio_chan *chan)
+{
+	if (!chan->dev)
+		chan->dev = udev_device_new_from_devnum(chan->ctx->udev, 'c',
+							chan->devnum);
+
+	return chan->dev;
+}
+#endif
+
+/*
+ * __liberio_chan_get_sysattr - Read a sysfs attribute of the channel's device
+ * @chan: the liberio channel
+ * @sysattr: attribute name
+ *
+ * Without libudev the value lives in a per channel buffer and is only
+ * valid until the next call on @chan.
+ *
+ * Returns the value or NULL if there is no such attribute.
+ */
+const char *__liberio_chan_get_sysattr(struct liberio_chan *chan,
+				       const char *sysattr)
+{
+	if (!chan || !sysattr || !chan->devnum)
+		return NULL;
+
+#ifdef LIBERIO_HAVE_UDEV
+	if (!__liberio_chan_udev_dev(chan))
 		return NULL;
 
 	return udev_device_get_sysattr_value(chan->dev, sysattr);
+#else
+	if (__liberio_sysfs_read(chan->devnum, sysattr, chan->sysattr,
+				 sizeof(chan->sysattr)) < 0)
+		return NULL;
+
+	return chan->sysattr;
+#endif
 }
 
-int liberio_chan_set_sysattr(struct liberio_chan *chan, const char *sysattr,
-			     char *value)
+int __liberio_chan_set_sysattr(struct liberio_chan *chan, const char *sysattr,
+			       char *value)
 {
 	if (!chan || !sysattr || !value)
 		return -EINVAL;
 
+	if (!chan->devnum)
+		return -ENODEV;
+
+#ifdef LIBERIO_HAVE_UDEV
+	if (!__liberio_chan_udev_dev(chan))
+		return -ENODEV;
+
 	return udev_device_set_sysattr_value(chan->dev, sysattr, value);
+#else
+	return __liberio_sysfs_write(chan->devnum, sysattr, value);
+#endif
 }
 
-int liberio_ioctl(int fd, unsigned long req, void *arg)
+int __liberio_ioctl(int fd, unsigned long req, void *arg)
 {
 	int r;
 
@@ -65,7 +200,7 @@ int liberio_ioctl(int fd, unsigned long req, void *arg)
 	return r;
 }
 
-int liberio_send_fd(int sockfd, int fd)
+int __liberio_send_fd(int sockfd, int fd)
 {
 	struct msghdr message;
 	struct iovec iov[1];
@@ -97,9 +232,8 @@ int liberio_send_fd(int sockfd, int fd)
 	return sendmsg(sockfd, &message, 0);
 }
 
-int liberio_recv_fd(int sockfd)
+int __liberio_recv_fd(int sockfd)
 {
-	int sent_fd;
 	struct msghdr message;
 	struct iovec iov[1];
 	struct cmsghdr *cmsg = NULL;
@@ -137,3 +271,185 @@ int liberio_recv_fd(int sockfd)
 	return -EINVAL;
 }
 
+/* SCM_MAX_FD in the kernel, the most fds a single message may carry */
+#define LIBERIO_FDS_PER_MSG 253
+#define LIBERIO_FD_MSG_MAGIC 0x4c465644 /* "LFVD" */
+
+struct liberio_fd_msg_hdr {
+	uint32_t magic;
+	uint32_t count;
+	uint32_t remaining;
+};
+
+/*
+ * liberio_send_fds - Pass a batch of fds plus descriptors over a socket
+ * @sockfd: AF_UNIX socket, SOCK_SEQPACKET or SOCK_DGRAM so messages stay whole
+ * @fds: the fds to send
+ * @descs: one descriptor per fd, carried in the same message
+ * @num: number of fds
+ *
+ * Sends everything in a single sendmsg() as long as @num fits into one
+ * SCM_RIGHTS message (253 fds), larger batches are split.
+ *
+ * Returns 0 or a negative error code.
+ */
+int liberio_send_fds(int sockfd, const int *fds,
+		     const struct liberio_fd_desc *descs, size_t num)
+{
+	char ctrl_buf[CMSG_SPACE(sizeof(int) * LIBERIO_FDS_PER_MSG)];
+	struct liberio_fd_msg_hdr hdr;
+	struct cmsghdr *control_message;
+	struct msghdr message;
+	struct iovec iov[2];
+	size_t sent = 0, count;
+	ssize_t res;
+
+	do {
+		count = num - sent;
+		if (count > LIBERIO_FDS_PER_MSG)
+			count = LIBERIO_FDS_PER_MSG;
+
+		hdr.magic = LIBERIO_FD_MSG_MAGIC;
+		hdr.count = count;
+		hdr.remaining = num - sent - count;
+
+		iov[0].iov_base = &hdr;
+		iov[0].iov_len = sizeof(hdr);
+		iov[1].iov_base = (void *)(descs + sent);
+		iov[1].iov_len = count * sizeof(*descs);
+
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = iov;
+		message.msg_iovlen = 2;
+
+		if (count) {
+			memset(ctrl_buf, 0, CMSG_SPACE(sizeof(int) * count));
+			message.msg_control = ctrl_buf;
+			message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+			control_message = CMSG_FIRSTHDR(&message);
+			control_message->cmsg_level = SOL_SOCKET;
+			control_message->cmsg_type = SCM_RIGHTS;
+			control_message->cmsg_len = CMSG_LEN(sizeof(int) * count);
+			memcpy(CMSG_DATA(control_message), fds + sent,
+			       sizeof(int) * count);
+		}
+
+		do {
+			res = sendmsg(sockfd, &message, 0);
+		} while (-1 == res && EINTR == errno);
+
+		if (res < 0)
+			return -errno;
+
+		sent += count;
+	} while (sent < num);
+
+	return 0;
+}
+
+/*
+ * liberio_recv_fds - Receive a batch sent with liberio_send_fds()
+ * @sockfd: the receiving socket
+ * @fds: array for the received fds, owned by the caller afterwards
+ * @descs: array for the matching descriptors
+ * @max: size of @fds and @descs
+ *
+ * Returns the number of received fds or a negative error code. If the
+ * batch does not fit into @max all of it gets closed and -EMSGSIZE is
+ * returned. A batch that fails part way is still received to the end
+ * and closed, so none of it is left queued on the socket.
+ */
+int liberio_recv_fds(int sockfd, int *fds, struct liberio_fd_desc *descs,
+		     size_t max)
+{
+	char ctrl_buf[CMSG_SPACE(sizeof(int) * LIBERIO_FDS_PER_MSG)];
+	struct liberio_fd_desc tmp[LIBERIO_FDS_PER_MSG];
+	struct liberio_fd_msg_hdr hdr;
+	struct cmsghdr *cmsg;
+	struct msghdr message;
+	struct iovec iov[2];
+	size_t n = 0, nfds, i;
+	int err = 0, msg_err;
+	ssize_t res;
+
+	do {
+		iov[0].iov_base = &hdr;
+		iov[0].iov_len = sizeof(hdr);
+		iov[1].iov_base = tmp;
+		iov[1].iov_len = sizeof(tmp);
+
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = iov;
+		message.msg_iovlen = 2;
+		message.msg_control = ctrl_buf;
+		message.msg_controllen = sizeof(ctrl_buf);
+
+		do {
+			res = recvmsg(sockfd, &message, MSG_CMSG_CLOEXEC);
+		} while (-1 == res && EINTR == errno);
+
+		if (res < 0) {
+			if (!err)
+				err = -errno;
+			break;
+		}
+
+		if (!res) {
+			if (!err)
+				err = -ECONNRESET;
+			break;
+		}
+
+		nfds = 0;
+		for (cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&message, cmsg)) {
+			if ((cmsg->cmsg_level == SOL_SOCKET) &&
+			    (cmsg->cmsg_type == SCM_RIGHTS)) {
+				nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				break;
+			}
+		}
+
+		msg_err = 0;
+		if (res < (ssize_t)sizeof(hdr) ||
+		    hdr.magic != LIBERIO_FD_MSG_MAGIC) {
+			/* not one of ours, no telling what else is queued */
+			hdr.remaining = 0;
+			msg_err = -EPROTO;
+		} else if (hdr.count != nfds ||
+			   res != (ssize_t)(sizeof(hdr) + nfds * sizeof(*descs)) ||
+			   (message.msg_flags & MSG_CTRUNC)) {
+			msg_err = -EPROTO;
+		} else if (n + nfds > max) {
+			msg_err = -EMSGSIZE;
+		}
+
+		/* keep the first error, but drain the rest of the batch */
+		if (!err)
+			err = msg_err;
+
+		for (i = 0; i < nfds; i++) {
+			int fd = ((int *)CMSG_DATA(cmsg))[i];
+
+			if (err) {
+				close(fd);
+				continue;
+			}
+
+			fds[n + i] = fd;
+			descs[n + i] = tmp[i];
+		}
+
+		if (!err)
+			n += nfds;
+	} while (hdr.remaining);
+
+	if (err) {
+		for (i = 0; i < n; i++)
+			close(fds[i]);
+		return err;
+	}
+
+	return n;
+}
@@ -23,21 +23,25 @@
 #include <errno.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <time.h>
 
+#ifdef LIBERIO_HAVE_UDEV
 #include <libudev.h>
+#endif
 
 #include "util.h"
 #include "log.h"
 #include "priv.h"
 #include "kernel.h"
+#include "ring.h"
+#include "clog.h"
 
-extern const struct liberio_buf_ops liberio_buf_mmap_ops;
-extern const struct liberio_buf_ops liberio_buf_userptr_ops;
-extern const struct liberio_buf_ops liberio_buf_dmabuf_ops;
+extern const struct liberio_buf_ops __liberio_buf_mmap_ops;
+extern const struct liberio_buf_ops __liberio_buf_userptr_ops;
+extern const struct liberio_buf_ops __liberio_buf_dmabuf_ops;
 
 #define RETRIES 100
 #define TIMEOUT 1
-#define USRP_MAX_FRAMES 128
 
 static struct liberio_chan *
 __liberio_chan_alloc(struct liberio_ctx *ctx,
@@ -52,7 +56,13 @@ static void __liberio_ctx_free(const struct ref *ref)
 	if (!ctx)
 		return;
 
+	__liberio_registry_free(ctx);
+	pthread_mutex_destroy(&ctx->lock);
+	__liberio_log_free(ctx);
+#ifdef LIBERIO_HAVE_UDEV
 	udev_unref(ctx->udev);
+#endif
+	__liberio_emu_free(ctx->emu);
 
 	free(ctx);
 }
@@ -60,25 +70,31 @@ static void __liberio_ctx_free(const struct ref *ref)
 struct liberio_ctx *liberio_ctx_new(void)
 {
 	struct liberio_ctx *ctx;
-	struct udev *udev;
-	int err;
 
 	ctx = calloc(1, sizeof(*ctx));
 	if (!ctx)
 		return NULL;
 
+#ifdef LIBERIO_HAVE_UDEV
 	ctx->udev = udev_new();
 	if (!ctx->udev)
 		goto err_udev;
+#endif
 
+	ctx->backend = &__liberio_backend_dev;
+	ctx->log_level = LOG_WARNING;
+	pthread_mutex_init(&ctx->lock, NULL);
+	INIT_LIST_HEAD(&ctx->chans);
 	ctx->refcnt = (struct ref){__liberio_ctx_free, 1};
 
 
 	return ctx;
 
+#ifdef LIBERIO_HAVE_UDEV
 err_udev:
 	free(ctx);
 	return NULL;
+#endif
 }
 
 inline void liberio_ctx_put(struct liberio_ctx *ctx)
@@ -126,41 +142,76 @@ size_t liberio_buf_get_len(const struct liberio_buf *buf, size_t plane)
 	return buf->len;
 }
 
+uint64_t liberio_buf_get_timestamp(const struct liberio_buf *buf)
+{
+	return buf->timestamp_us;
+}
+
+uint32_t liberio_buf_get_sequence(const struct liberio_buf *buf)
+{
+	return buf->sequence;
+}
+
 size_t liberio_buf_get_index(const struct liberio_buf *buf)
 {
 	return buf->index;
 }
 
+/*
+ * liberio_ctx_set_loglevel - Set what gets logged for a context
+ * @ctx: the liberio context
+ * @loglevel: 0 logs warnings to syslog, 1 to stderr, 2 adds info and 3
+ * debug messages
+ */
 void liberio_ctx_set_loglevel(struct liberio_ctx *ctx, int loglevel)
 {
-	(void) ctx;
 	log_init(loglevel, "usrp_dma");
+
+	if (loglevel > 2)
+		ctx->log_level = LOG_DEBUG;
+	else if (loglevel > 1)
+		ctx->log_level = LOG_INFO;
+	else
+		ctx->log_level = LOG_WARNING;
 }
 
+/*
+ * liberio_ctx_register_logger - Send a context's messages to a callback
+ * @ctx: the liberio context
+ * @cb: called with the syslog priority and the message, NULL to go back
+ * to stderr/syslog
+ * @priv: passed to @cb
+ *
+ * The callback gets the messages liberio_ctx_set_loglevel() lets
+ * through, same as stderr/syslog would.
+ */
 void liberio_ctx_register_logger(struct liberio_ctx *ctx, void (*cb)(int, const char *, void*),
 				 void *priv)
 {
-	(void) ctx;
-	log_register(cb, priv);
+	ctx->log_cb = cb;
+	ctx->log_priv = priv;
 }
 
 static void __liberio_chan_free(const struct ref *ref)
 {
-	ssize_t i;
-	int err;
 	struct liberio_chan *chan = container_of(ref, struct liberio_chan,
 						refcnt);
 	if (!chan)
 		return;
 
+	__liberio_registry_del_chan(chan);
+
+	if (chan->engine)
+		liberio_chan_engine_stop(chan);
+
+	__liberio_uring_free(chan);
+
 	liberio_chan_stop_streaming(chan);
 	liberio_chan_request_buffers(chan, 0);
 
-	if (chan->dev)
-		udev_device_unref(chan->dev);
+	chan->backend->close(chan);
 
 	liberio_ctx_put(chan->ctx);
-	close(chan->fd);
 	free(chan);
 }
 
@@ -189,62 +240,41 @@ const char *liberio_chan_get_type(const struct liberio_chan *chan)
 	return memstring[chan->mem_type];
 }
 
-static int __liberio_get_api_from_file(const char *file, int *maj, int *min)
+/*
+ * liberio_chan_get_api_version - Driver API version of the channel
+ * @chan: the liberio channel
+ * @maj: output for the major version
+ * @min: output for the minor version
+ *
+ * Returns 0 or a negative error code if the driver does not tell.
+ */
+int liberio_chan_get_api_version(const struct liberio_chan *chan, int *maj,
+				 int *min)
 {
-	struct udev_device *dev;
-	struct udev *udev;
-	struct stat statbuf;
-	int err;
-
-	err = stat(file, &statbuf);
-	if (err < 0)
-		return err;
-
-	if (!S_ISCHR(statbuf.st_mode))
-		return -ENODEV;
-
-	udev = udev_new();
-
-	dev = udev_device_new_from_devnum(udev, 'c', statbuf.st_rdev);
-	*maj = strtol(udev_device_get_sysattr_value(dev, "api_maj"), NULL, 10);
-	*min = strtol(udev_device_get_sysattr_value(dev, "api_min"), NULL, 10);
+	if (chan->api_maj < 0)
+		return chan->api_maj;
 
-	udev_device_unref(dev);
-	udev_unref(udev);
+	*maj = chan->api_maj;
+	*min = chan->api_min < 0 ? 0 : chan->api_min;
 
 	return 0;
 }
 
-static int __liberio_get_chan_attr_int(struct liberio_chan *chan,
-				       const char *attr,
-				       int base)
+/*
+ * A fresh channel normally finds the driver without buffers, asking for
+ * the first one is a single ioctl instead of a STREAMOFF and a REQBUFS(0)
+ * that would have nothing to tear down.
+ */
+static int __liberio_chan_is_idle(struct liberio_chan *chan)
 {
-	struct udev *udev = chan->ctx->udev;
-	struct udev_device *dev;
-	struct stat statbuf;
-	int ret;
-
-	if (!chan)
-		return -ENODEV;
-
-	ret = fstat(chan->fd, &statbuf);
-	if (ret < 0)
-		return ret;
-
-	if (!S_ISCHR(statbuf.st_mode))
-		return -EINVAL;
-
-	udev = chan->ctx->udev;
-	dev = udev_device_new_from_devnum(udev, 'c', statbuf.st_rdev);
-	if (!dev)
-		goto err_val;
-
-	ret = strtol(udev_device_get_sysattr_value(dev, attr), NULL, base);
+	struct usrp_buffer breq;
 
-	udev_device_unref(dev);
+	memset(&breq, 0, sizeof(breq));
+	breq.type = __to_buf_type(chan);
+	breq.memory = chan->mem_type;
+	breq.index = 0;
 
-err_val:
-	return ret;
+	return chan->backend->querybuf(chan, &breq) && errno == EINVAL;
 }
 
 static struct liberio_chan *
@@ -253,49 +283,58 @@ __liberio_chan_alloc(struct liberio_ctx *ctx,
 		     const enum liberio_direction dir,
 		     enum usrp_memory mem_type)
 {
-	struct udev *udev = ctx->udev;
 	struct liberio_chan *chan;
-	int maj, min;
 	int err;
 
 	chan = calloc(1, sizeof(*chan));
 	if (!chan)
 		return NULL;
 
-	pthread_spin_init(&chan->lock, 0);
-
-	chan->fd = open(file, O_RDWR);
-	if (chan->fd < 0) {
-		log_warn(__func__, "Failed to open device");
-		goto out_free;
-	}
+	chan->ctx = ctx;
+	chan->dir = dir;
+	chan->backend = ctx->backend;
+	chan->api_maj = -ENOENT;
+	chan->api_min = -ENOENT;
 
-	chan->dev = liberio_udev_device_from_fd(udev, chan->fd);
-	if (!chan->dev)
+	err = chan->backend->open(chan, file);
+	if (err)
 		goto out_free;
 
-	chan->ctx = ctx;
-	chan->dir = dir;
 	chan->bufs = NULL;
 	chan->nbufs = 0;
+	chan->nbufs_alloc = 0;
+	INIT_LIST_HEAD(&chan->arenas);
 	chan->mem_type = mem_type;
 	chan->fix_broken_chdr = 0;
+	chan->wait_mode = LIBERIO_WAIT_BLOCK;
+	chan->spin_us = 0;
+	chan->stats.queued_min = UINT64_MAX;
+	__liberio_hist_reset(&chan->latency);
 
-	chan->port = __liberio_get_chan_attr_int(chan, "port", 10);
-	INIT_LIST_HEAD(&chan->free_bufs);
+	memset(&chan->qbuf_tmpl, 0, sizeof(chan->qbuf_tmpl));
+	chan->qbuf_tmpl.type = __to_buf_type(chan);
+	chan->qbuf_tmpl.memory = mem_type;
 
 	if (mem_type == USRP_MEMORY_MMAP) {
-		chan->ops = &liberio_buf_mmap_ops;
+		chan->ops = &__liberio_buf_mmap_ops;
 	} else if (mem_type == USRP_MEMORY_USERPTR) {
-		chan->ops = &liberio_buf_userptr_ops;
+		chan->ops = &__liberio_buf_userptr_ops;
+	} else if (mem_type == USRP_MEMORY_DMABUF) {
+		chan->ops = &__liberio_buf_dmabuf_ops;
 	} else {
-		log_crit(__func__, "Invalid memory type specified");
+		ctx_crit(ctx, "Invalid memory type specified");
 		return NULL;
 	}
 
 	chan->refcnt = (struct ref){__liberio_chan_free, 1};
-	liberio_chan_stop_streaming(chan);
-	liberio_chan_request_buffers(chan, 0);
+
+	/* only clean up after a previous user if it left buffers behind */
+	if (!__liberio_chan_is_idle(chan)) {
+		liberio_chan_stop_streaming(chan);
+		liberio_chan_request_buffers(chan, 0);
+	}
+
+	__liberio_registry_add_chan(chan);
 
 	return chan;
 
@@ -306,13 +345,96 @@ out_free:
 	return NULL;
 }
 
+static void __liberio_chan_release_bufs(struct liberio_chan *chan)
+{
+	ssize_t i;
+
+	for (i = chan->nbufs_alloc - 1; i >= 0; i--)
+		chan->ops->release(chan->bufs + i);
+
+	free(chan->bufs);
+	chan->bufs = NULL;
+	chan->nbufs = 0;
+	chan->nbufs_alloc = 0;
+
+	__liberio_userptr_index_free(chan);
+
+	if (chan->ops->pool_release)
+		chan->ops->pool_release(chan);
+
+	__liberio_ring_free(chan->free_ring);
+	chan->free_ring = NULL;
+}
+
+/*
+ * __liberio_chan_init_bufs - Set up descriptors for freshly allocated
+ * driver buffers
+ * @chan: the liberio channel
+ * @first: index of the first new buffer
+ * @count: number of new buffers
+ *
+ * On failure the new buffers are released again, the ones below @first
+ * are left alone.
+ */
+static int __liberio_chan_init_bufs(struct liberio_chan *chan, size_t first,
+				    size_t count)
+{
+	size_t i;
+	int err;
+
+	if (chan->ops->pool_init) {
+		err = chan->ops->pool_init(chan, first, count);
+		if (err) {
+			ctx_crit(chan->ctx, "failed to set up buffer pool");
+			return err;
+		}
+	}
+
+	for (i = first; i < first + count; i++) {
+		err = chan->ops->init(chan, chan->bufs + i, i);
+		if (err) {
+			ctx_crit(chan->ctx, "failed to init buffer (%zu/%zu)", i,
+				first + count);
+			goto out_release;
+		}
+	}
+
+	chan->nbufs_alloc = first + count;
+	chan->nbufs = first + count;
+
+	if (chan->mem_type == USRP_MEMORY_USERPTR) {
+		err = __liberio_userptr_index_build(chan);
+		if (err) {
+			ctx_crit(chan->ctx, "failed to build buffer index");
+			chan->nbufs_alloc = first;
+			chan->nbufs = first;
+			goto out_release;
+		}
+	}
+
+	/* TX buffers start out owned by the application */
+	if (chan->free_ring)
+		for (i = first; i < first + count; i++)
+			liberio_ring_push(chan->free_ring, i);
+
+	return 0;
+
+out_release:
+	while (i-- > first)
+		chan->ops->release(chan->bufs + i);
+
+	return err;
+}
+
 int liberio_chan_request_buffers(struct liberio_chan *chan, size_t num_buffers)
 {
 	struct usrp_requestbuffers req;
 	int err;
-	ssize_t i;
 	enum usrp_buf_type type = __to_buf_type(chan);
 
+	if (chan->engine)
+		return -EBUSY;
+
 	/*
 	 * if we're cleaning up, free the buffers (and unmap the memory-mapped memory in case
 	 * of USRP_MEMORY_MMAP) before calling ioctl USRPIOC_REQBUFS with req.count = 0.
@@ -320,21 +442,13 @@ int liberio_chan_request_buffers(struct liberio_chan *chan, size_t num_buffers)
 	 * cannot free" in vb2_core_reqbufs
 	 */
 	if (!num_buffers && chan->bufs)
-	{
-		for (i = chan->nbufs - 1; i >= 0; i--)
-		{
-			chan->ops->release(chan->bufs + i);
-		}
-		free(chan->bufs);
-		chan->bufs=NULL;
-		chan->nbufs=0;
-	}
+		__liberio_chan_release_bufs(chan);
 
-	if (num_buffers > USRP_MAX_FRAMES) {
-		log_warnx(__func__, "tried to allocate %u buffers, max is %u"
-			  " proceeding with: %u",
-			  num_buffers, USRP_MAX_FRAMES, USRP_MAX_FRAMES);
-		num_buffers = USRP_MAX_FRAMES;
+	if (num_buffers > chan->max_bufs) {
+		ctx_warnx(chan->ctx, "tried to allocate %zu buffers, max is %zu"
+			  " proceeding with: %zu",
+			  num_buffers, chan->max_bufs, chan->max_bufs);
+		num_buffers = chan->max_bufs;
 	}
 
 	memset(&req, 0, sizeof(req));
@@ -342,9 +456,9 @@ int liberio_chan_request_buffers(struct liberio_chan *chan, size_t num_buffers)
 	req.memory = chan->mem_type;
 	req.count = num_buffers;
 
-	err = liberio_ioctl(chan->fd, USRPIOC_REQBUFS, &req);
+	err = chan->backend->reqbufs(chan, &req);
 	if (err) {
-		log_crit(__func__, "failed to request buffers (chan=%p, num_buffers was %u) ret=%d, errno=%d",
+		ctx_crit(chan->ctx, "failed to request buffers (chan=%p, num_buffers was %zu) ret=%d, errno=%d",
 			 chan, num_buffers, err, errno);
 		return err;
 	}
@@ -353,38 +467,148 @@ int liberio_chan_request_buffers(struct liberio_chan *chan, size_t num_buffers)
 	if (!num_buffers)
 		return 0;
 
-	chan->bufs = calloc(req.count, sizeof(struct liberio_buf));
+	if (req.count < num_buffers)
+		ctx_info(chan->ctx, "driver granted %u of %zu buffers",
+			 req.count, num_buffers);
+
+	/*
+	 * Size the descriptor array (and the TX ring) for the maximum so
+	 * liberio_chan_resize_buffers() can grow the pool without moving
+	 * descriptors the application may still hold.
+	 */
+	chan->bufs = calloc(chan->max_bufs, sizeof(struct liberio_buf));
 	if (!chan->bufs) {
-		log_crit(__func__, "failed to alloc mem for buffers");
+		ctx_crit(chan->ctx, "failed to alloc mem for buffers");
 		return -ENOMEM;
 	}
 
-	for (i = 0; i < req.count; i++) {
-		err = chan->ops->init(chan, chan->bufs + i, i);
-		if (err) {
-			log_crit(__func__, "failed to init buffer (%u/%u)", i,
-				req.count);
+	if (chan->dir == TX) {
+		chan->free_ring = __liberio_ring_new(chan->max_bufs);
+		if (!chan->free_ring) {
+			ctx_crit(chan->ctx, "failed to alloc free buffer ring");
+			err = -ENOMEM;
 			goto out_free;
 		}
-		pthread_spin_lock(&chan->lock);
-		if (chan->dir == TX)
-			list_add(&chan->bufs[i].node, &chan->free_bufs);
-		pthread_spin_unlock(&chan->lock);
 	}
 
-	chan->nbufs = i;
+	err = __liberio_chan_init_bufs(chan, 0, req.count);
+	if (err)
+		goto out_free;
 
 	return 0;
 
 out_free:
-	while (i) {
-		chan->ops->release(chan->bufs + i);
-		i--;
+	__liberio_chan_release_bufs(chan);
+
+	return err;
+}
+
+/*
+ * liberio_chan_resize_buffers - Grow or shrink the buffer pool
+ * @chan: the liberio channel
+ * @num_buffers: the new number of buffers
+ *
+ * Unlike liberio_chan_request_buffers() this works while streaming and
+ * keeps every existing buffer valid.
+ *
+ * Growing brings back buffers retired by an earlier shrink, and asks
+ * the backend for more beyond them. The USRP DMA driver has no
+ * interface for that, so beyond the retired buffers only emulated
+ * channels can grow, others fail with -ENOTTY. If the backend fails,
+ * the pool is left as it was. New buffers start out owned by the
+ * application, the same as after liberio_chan_request_buffers(). TX
+ * buffers go onto the free list, and RX buffers have to be enqueued
+ * by the caller.
+ *
+ * Shrinking retires the buffers with index >= @num_buffers. They stop
+ * circulating: enqueueing a retired buffer parks it instead of passing
+ * it to the driver, and retired TX buffers never come out of dequeue.
+ * Their memory is only freed by the next liberio_chan_request_buffers().
+ */
+int liberio_chan_resize_buffers(struct liberio_chan *chan, size_t num_buffers)
+{
+	struct liberio_create_bufs create;
+	size_t i, old = chan->nbufs, alloc = chan->nbufs_alloc;
+	int err;
+
+	if (!chan->bufs || !num_buffers)
+		return -EINVAL;
+
+	if (chan->engine)
+		return -EBUSY;
+
+	if (num_buffers > chan->max_bufs)
+		return -ENOSPC;
+
+	/* create the missing buffers first, so failing leaves the pool as is */
+	if (num_buffers > alloc) {
+		if (!chan->backend->create_bufs)
+			return -ENOTTY;
+
+		memset(&create, 0, sizeof(create));
+		create.type = __to_buf_type(chan);
+		create.memory = chan->mem_type;
+		create.count = num_buffers - alloc;
+
+		err = chan->backend->create_bufs(chan, &create);
+		if (err) {
+			ctx_warn(chan->ctx, "failed to create %u more buffers",
+				 create.count);
+			return -errno;
+		}
+
+		if (create.index != alloc) {
+			ctx_crit(chan->ctx, "driver created buffers at %u, expected %zu",
+				 create.index, alloc);
+			return -EIO;
+		}
+
+		err = __liberio_chan_init_bufs(chan, create.index, create.count);
+		if (err) {
+			chan->nbufs = old;
+			return err;
+		}
 	}
 
-	free(chan->bufs);
+	/* bring back retired buffers, no driver involvement needed */
+	for (i = old; i < num_buffers && i < alloc; i++) {
+		if (!chan->bufs[i].parked)
+			continue;
 
-	return err;
+		chan->bufs[i].parked = 0;
+		if (chan->free_ring)
+			liberio_ring_push(chan->free_ring, i);
+	}
+
+	chan->nbufs = num_buffers;
+
+	return 0;
+}
+
+/*
+ * liberio_chan_set_buf_size - Set the size of USERPTR buffers
+ * @chan: the liberio channel
+ * @size: size of each buffer in bytes, 0 selects one page
+ *
+ * Takes effect with the next liberio_chan_request_buffers() call.
+ *
+ * Buffers larger than a page are only physically contiguous if the pool
+ * gets hugetlb pages, sizes above the huge page size are refused.
+ */
+int liberio_chan_set_buf_size(struct liberio_chan *chan, size_t size)
+{
+	if (chan->mem_type != USRP_MEMORY_USERPTR)
+		return -EINVAL;
+
+	if (size > __liberio_hugepage_size())
+		return -EINVAL;
+
+	if (chan->bufs)
+		return -EBUSY;
+
+	chan->buf_size = size;
+
+	return 0;
 }
 
 int liberio_chan_set_fixed_size(struct liberio_chan *chan, size_t plane,
@@ -396,7 +620,7 @@ int liberio_chan_set_fixed_size(struct liberio_chan *chan, size_t plane,
 	breq.type = USRP_FMT_CHDR_FIXED_BLOCK;
 	breq.length = size;
 
-	return liberio_ioctl(chan->fd, USRPIOC_SET_FMT, &breq);
+	return chan->backend->set_fmt(chan, &breq);
 }
 
 size_t liberio_chan_get_num_bufs(const struct liberio_chan *chan)
@@ -406,8 +630,6 @@ size_t liberio_chan_get_num_bufs(const struct liberio_chan *chan)
 
 static uint16_t __liberio_buf_extract_chdr_length(struct liberio_buf *buf)
 {
-	const uint32_t *tmp_buf = buf->mem;
-
 	return (((uint32_t *)buf->mem)[0]) & 0xffff;
 }
 
@@ -417,168 +639,936 @@ liberio_chan_get_buf_at_index(const struct liberio_chan *chan, size_t index)
 	return chan->bufs + index;
 }
 
-/*
- * liberio_chan_buf_enqueue - Enqueue a buffer to the driver
- * @chan: the liberio channel to use
- * @buf: the liberio buffer to use
- */
-int liberio_chan_buf_enqueue(struct liberio_chan *chan, struct liberio_buf *buf)
-{
-	struct usrp_buffer breq;
-	fd_set fds;
+#define __liberio_stat_inc(chan, field, val) \
+	__atomic_fetch_add(&(chan)->stats.field, (val), __ATOMIC_RELAXED)
 
-	memset(&breq, 0, sizeof(breq));
-	breq.type = __to_buf_type(chan);
-	breq.memory = chan->mem_type;
-	breq.index = buf->index;
+/* water marks, may be updated from several threads at once */
+static inline void __liberio_stat_max(uint64_t *max, uint64_t val)
+{
+	uint64_t old = __atomic_load_n(max, __ATOMIC_RELAXED);
 
-	if (chan->mem_type == USRP_MEMORY_USERPTR) {
-		breq.m.userptr = (unsigned long)buf->mem;
-		breq.length = buf->len;
-	}
+	while (val > old &&
+	       !__atomic_compare_exchange_n(max, &old, val, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
 
-	/* For the broken_chdr case, we need to tell driver the size */
-	if (chan->dir == TX || (chan->dir == RX && chan->fix_broken_chdr))
-		breq.bytesused = buf->valid_bytes;
+static inline void __liberio_stat_min(uint64_t *min, uint64_t val)
+{
+	uint64_t old = __atomic_load_n(min, __ATOMIC_RELAXED);
 
-	return liberio_ioctl(chan->fd, USRPIOC_QBUF, &breq);
+	while (val < old &&
+	       !__atomic_compare_exchange_n(min, &old, val, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
 }
 
-int liberio_chan_enqueue_all(struct liberio_chan *chan)
+/* account for a buffer the driver took, bytes only count for TX */
+static inline void __liberio_stats_qbuf(struct liberio_chan *chan,
+					size_t bytes)
 {
-	size_t i;
-	int err;
-
-	if (chan->dir != RX)
-		return -EINVAL;
+	struct liberio_chan_counters *stats = &chan->stats;
+	uint64_t queued;
 
-	for (i = 0; i < chan->nbufs; i++) {
-		err = liberio_chan_buf_enqueue(chan, chan->bufs + i);
-		if (err)
-			return err;
-	}
+	__liberio_stat_inc(chan, enqueued, 1);
+	if (chan->dir == TX)
+		__liberio_stat_inc(chan, bytes, bytes);
 
-	return 0;
+	queued = __atomic_add_fetch(&stats->queued, 1, __ATOMIC_RELAXED);
+	__liberio_stat_max(&stats->queued_max, queued);
 }
 
-/*
- * liberio_buf_dequeue - Dequeue a buffer from the driver
- * @chan: the liberio channel to dequeue from
- * @timeout: the timeout to use in us
- */
-struct liberio_buf *liberio_chan_buf_dequeue(struct liberio_chan *chan,
-					     int timeout)
+/* account for a buffer the driver handed back */
+static inline void __liberio_stats_dqbuf(struct liberio_chan *chan)
 {
-	struct usrp_buffer breq;
-	struct liberio_buf *buf;
-	int err, i;
-	fd_set fds;
-	struct timeval tv;
-	struct timeval *tv_ptr = &tv;
-
-	// Should only happen with chan->dir == TX (see liberio_chan_request_buffers)
-	pthread_spin_lock(&chan->lock);
-	if (!list_empty(&chan->free_bufs)) {
-		buf = list_first_entry(&chan->free_bufs, struct liberio_buf,
-				       node);
-		list_del(&buf->node);
-		pthread_spin_unlock(&chan->lock);
-		return buf;
-	}
-	pthread_spin_unlock(&chan->lock);
-
-	FD_ZERO(&fds);
-	FD_SET(chan->fd, &fds);
+	struct liberio_chan_counters *stats = &chan->stats;
+	uint64_t queued;
 
+	__liberio_stat_inc(chan, dequeued, 1);
 
-	if (timeout >= 0) {
-		tv.tv_sec = timeout / 1000000;
-		tv.tv_usec = timeout % 1000000;
-	} else {
-		tv_ptr = NULL;
-	}
+	queued = __atomic_sub_fetch(&stats->queued, 1, __ATOMIC_RELAXED);
+	__liberio_stat_min(&stats->queued_min, queued);
+}
 
-	if (chan->dir == RX)
-		err = select(chan->fd + 1, &fds, NULL, NULL, tv_ptr);
-	else
-		err = select(chan->fd + 1, NULL, &fds, NULL, tv_ptr);
+/*
+ * record how long the driver had @buf, using the completion timestamp it
+ * reported or the current time if it doesn't fill one in
+ */
+static inline void __liberio_chan_record_latency(struct liberio_chan *chan,
+						 struct liberio_buf *buf)
+{
+	uint64_t done;
 
-	if (!err)
-		return NULL;
+	if (!buf->queued_us)
+		return;
 
-	if (-1 == err) {
-		log_warn(__func__, "select failed");
-		return NULL;
-	}
+	done = buf->timestamp_us;
+	if (!done)
+		done = __liberio_get_time_us();
 
-	memset(&breq, 0, sizeof(breq));
-	breq.type = __to_buf_type(chan);
+	if (likely(done >= buf->queued_us))
+		liberio_hist_record(&chan->latency, done - buf->queued_us);
 
-	breq.memory = chan->mem_type;
+	buf->queued_us = 0;
+}
 
-	err = liberio_ioctl(chan->fd, USRPIOC_DQBUF, &breq);
-	if (err)
-		return NULL;
+/*
+ * __liberio_chan_check_seq - Detect buffers the driver never handed us
+ * @chan: an RX channel
+ * @seq: sequence number of the buffer just dequeued
+ *
+ * The driver counts every buffer it would have filled, so a jump ahead
+ * means it dropped some. Going backwards (the driver restarted counting,
+ * or doesn't count at all) just resyncs.
+ */
+static inline void __liberio_chan_check_seq(struct liberio_chan *chan,
+					    uint32_t seq)
+{
+	uint32_t expected = chan->next_seq;
+	int32_t missed = seq - expected;
 
-	if (chan->mem_type == USRP_MEMORY_MMAP) {
-		buf = chan->bufs + breq.index;
-	} else if (chan->mem_type == USRP_MEMORY_USERPTR) {
-		buf = NULL;
+	chan->next_seq = seq + 1;
 
-		for (i = 0; i < chan->nbufs; i++)
-			if (breq.m.userptr == (unsigned long)chan->bufs[i].mem
-			    && breq.length == chan->bufs[i].len)
-				buf = chan->bufs + i;
-		if (!buf)
-			return NULL;
+	if (unlikely(missed > 0) && chan->seq_valid) {
+		__liberio_stat_inc(chan, gaps, 1);
+		__liberio_stat_inc(chan, lost, missed);
+		if (chan->gap_cb)
+			chan->gap_cb(chan, expected, seq, chan->gap_priv);
 	}
 
-	if (chan->dir == RX && chan->fix_broken_chdr)
-		buf->valid_bytes = __liberio_buf_extract_chdr_length(buf);
-	else
-		buf->valid_bytes = breq.bytesused;
-
-	return buf;
+	chan->seq_valid = 1;
 }
 
 /*
- * liberio_buf_export() - Export usrp dma buffer as dmabuf fd
- * that can be shared between processes
- * @chan: context
- * @buf: buffer
- * @dmafd: dma file descriptor output
+ * __liberio_chan_qbuf_req - Enqueue a buffer to the driver
+ * @chan: the liberio channel to use
+ * @breq: request to hand to the driver, copied from chan->qbuf_tmpl
+ * @buf: the liberio buffer to use
+ *
+ * Only the per buffer fields of @breq get updated, so a request can be
+ * reused for several buffers in a row.
  */
-int liberio_chan_buf_export(struct liberio_chan *chan, struct liberio_buf *buf,
-			    int *dmafd)
+static int __liberio_chan_qbuf_req(struct liberio_chan *chan,
+				   struct usrp_buffer *breq,
+				   struct liberio_buf *buf)
 {
-	struct usrp_exportbuffer breq;
-	int err;
+	/* retired by liberio_chan_resize_buffers(), keep it out of the driver */
+	if (unlikely(buf->index >= chan->nbufs)) {
+		buf->parked = 1;
+		return 0;
+	}
 
-	memset(&breq, 0, sizeof(breq));
-	breq.type = __to_buf_type(chan);
-	breq.index = buf->index;
+	breq->index = buf->index;
+	breq->flags = 0;
 
-	err = liberio_ioctl(chan->fd, USRPIOC_EXPBUF, &breq);
-	if (err) {
-		log_warn(__func__, "failed to export buffer");
-		return err;
+	if (chan->mem_type == USRP_MEMORY_USERPTR) {
+		breq->m.userptr = (unsigned long)buf->mem;
+		breq->length = buf->len;
+	} else if (chan->mem_type == USRP_MEMORY_DMABUF) {
+		if (buf->fd < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		__liberio_dmabuf_sync(buf, DMA_BUF_SYNC_END);
+		breq->m.fd = buf->fd;
+		breq->length = buf->len;
 	}
 
-	*dmafd = breq.fd;
+	/* For the broken_chdr case, we need to tell driver the size */
+	if (chan->dir == TX || (chan->dir == RX && chan->fix_broken_chdr))
+		breq->bytesused = buf->valid_bytes;
 
-	return 0;
-}
+	if (unlikely(chan->backend->qbuf(chan, breq))) {
+		__liberio_stat_inc(chan, ioctl_errors, 1);
+		return -1;
+	}
 
-int liberio_chan_start_streaming(struct liberio_chan *chan)
-{
-	enum usrp_buf_type type = __to_buf_type(chan);
+	__liberio_stats_qbuf(chan, buf->valid_bytes);
+	buf->queued_us = __liberio_get_time_us();
 
-	return liberio_ioctl(chan->fd, USRPIOC_STREAMON, (void *)type);
+	return 0;
+}
+
+/*
+ * liberio_chan_buf_enqueue - Enqueue a buffer to the driver
+ * @chan: the liberio channel to use
+ * @buf: the liberio buffer to use
+ */
+int liberio_chan_buf_enqueue(struct liberio_chan *chan, struct liberio_buf *buf)
+{
+	struct usrp_buffer breq = chan->qbuf_tmpl;
+
+	return __liberio_chan_qbuf_req(chan, &breq, buf);
+}
+
+/*
+ * liberio_chan_buf_enqueue_many - Enqueue a batch of buffers to the driver
+ * @chan: the liberio channel to use
+ * @bufs: the liberio buffers to enqueue, in order
+ * @num: number of buffers in @bufs
+ * @queued: output for the number of buffers handed to the driver
+ *
+ * Stops at the first buffer the driver refuses. On return bufs[0] up to
+ * bufs[*queued - 1] are owned by the driver, the rest still belong to the
+ * caller.
+ *
+ * Returns 0 if all buffers got enqueued, or the negative error code of
+ * the failing buffer (bufs[*queued]).
+ */
+int liberio_chan_buf_enqueue_many(struct liberio_chan *chan,
+				  struct liberio_buf **bufs, size_t num,
+				  size_t *queued)
+{
+	struct usrp_buffer breq = chan->qbuf_tmpl;
+	size_t i;
+	int err = 0;
+
+	for (i = 0; i < num; i++) {
+		err = __liberio_chan_qbuf_req(chan, &breq, bufs[i]);
+		if (err) {
+			err = -errno;
+			break;
+		}
+	}
+
+	if (queued)
+		*queued = i;
+
+	return err;
+}
+
+/*
+ * liberio_chan_enqueue_all - Enqueue all buffers of a channel
+ * @chan: the liberio channel to use
+ *
+ * For TX channels this hands the buffers on the free list to the driver
+ * with their current payload. Buffers the application dequeued or the
+ * driver still holds are left alone.
+ *
+ * If the driver refuses a buffer, the ones before it stay queued. On TX
+ * the refused one goes back on the free list with the ones not tried.
+ *
+ * Returns 0 if all buffers got enqueued or a negative error code.
+ */
+int liberio_chan_enqueue_all(struct liberio_chan *chan)
+{
+	struct usrp_buffer breq = chan->qbuf_tmpl;
+	uint32_t idx;
+	size_t i;
+	int err;
+
+	if (!chan->free_ring) {
+		for (i = 0; i < chan->nbufs; i++)
+			if (__liberio_chan_qbuf_req(chan, &breq, chan->bufs + i))
+				return -errno;
+
+		return 0;
+	}
+
+	while (!liberio_ring_pop(chan->free_ring, &idx)) {
+		/* retired while it sat on the free list */
+		if (idx >= chan->nbufs) {
+			chan->bufs[idx].parked = 1;
+			continue;
+		}
+
+		if (__liberio_chan_qbuf_req(chan, &breq, chan->bufs + idx)) {
+			err = -errno;
+			liberio_ring_push(chan->free_ring, idx);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * __liberio_chan_dqbuf_req - Dequeue a completed buffer without waiting
+ * @chan: the liberio channel to dequeue from
+ * @breq: request to hand to the driver, type and memory must be set
+ * @bufp: output for the dequeued buffer
+ *
+ * Callers draining several buffers in a row can set up @breq once and
+ * reuse it, the driver only looks at type and memory.
+ *
+ * Returns 0 on success, -EAGAIN if the driver has no completed buffer
+ * or a negative error code.
+ */
+static int __liberio_chan_dqbuf_req(struct liberio_chan *chan,
+				    struct usrp_buffer *breq,
+				    struct liberio_buf **bufp)
+{
+	struct liberio_buf *buf = NULL;
+	int err;
+
+again:
+	err = chan->backend->dqbuf(chan, breq);
+	if (err) {
+		if (errno != EAGAIN)
+			__liberio_stat_inc(chan, ioctl_errors, 1);
+		return -errno;
+	}
+
+	__liberio_stats_dqbuf(chan);
+
+	if (chan->mem_type == USRP_MEMORY_MMAP) {
+		if (breq->index < chan->nbufs_alloc)
+			buf = chan->bufs + breq->index;
+	} else if (chan->mem_type == USRP_MEMORY_USERPTR) {
+		buf = __liberio_userptr_index_lookup(chan, breq->m.userptr,
+						     breq->length);
+	} else if (chan->mem_type == USRP_MEMORY_DMABUF) {
+		if (breq->index < chan->nbufs_alloc) {
+			buf = chan->bufs + breq->index;
+			__liberio_dmabuf_sync(buf, DMA_BUF_SYNC_START);
+		}
+	}
+
+	if (!buf)
+		return -EINVAL;
+
+	/* a retired TX buffer has nothing to offer, try the next one */
+	if (unlikely(buf->index >= chan->nbufs) && chan->dir == TX) {
+		buf->queued_us = 0;
+		buf->parked = 1;
+		goto again;
+	}
+
+	if (chan->dir == RX && chan->fix_broken_chdr)
+		buf->valid_bytes = __liberio_buf_extract_chdr_length(buf);
+	else
+		buf->valid_bytes = breq->bytesused;
+
+	buf->timestamp_us = (uint64_t)breq->timestamp.tv_sec * 1000000
+		+ breq->timestamp.tv_usec;
+	buf->sequence = breq->sequence;
+
+	__liberio_chan_record_latency(chan, buf);
+
+	if (chan->dir == RX) {
+		__liberio_stat_inc(chan, bytes, buf->valid_bytes);
+		__liberio_chan_check_seq(chan, breq->sequence);
+	}
+
+	*bufp = buf;
+
+	return 0;
+}
+
+static inline void __liberio_chan_init_dqbuf_req(struct liberio_chan *chan,
+						 struct usrp_buffer *breq)
+{
+	memset(breq, 0, sizeof(*breq));
+	breq->type = __to_buf_type(chan);
+	breq->memory = chan->mem_type;
+}
+
+int __liberio_chan_dqbuf(struct liberio_chan *chan, struct liberio_buf **bufp)
+{
+	struct usrp_buffer breq;
+
+	__liberio_chan_init_dqbuf_req(chan, &breq);
+
+	return __liberio_chan_dqbuf_req(chan, &breq, bufp);
+}
+
+/*
+ * __liberio_chan_wait - Wait for the channel fd to become ready
+ * @chan: the liberio channel to wait on
+ * @timeout: the timeout to use in us, negative values wait forever
+ *
+ * Returns > 0 if ready, 0 on timeout or a negative error code.
+ */
+static int __liberio_chan_wait(struct liberio_chan *chan, int timeout)
+{
+	int err;
+
+	if (chan->uring)
+		err = __liberio_uring_wait(chan, timeout);
+	else
+		err = chan->backend->wait(chan, timeout);
+
+	if (unlikely(err < 0))
+		__liberio_stat_inc(chan, wait_errors, 1);
+
+	return err;
+}
+
+uint64_t __liberio_get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * __liberio_chan_wait_dqbuf - Wait for and dequeue a completed buffer
+ * @chan: the liberio channel to dequeue from
+ * @breq: request to hand to the driver, see __liberio_chan_dqbuf_req()
+ * @bufp: output for the dequeued buffer
+ * @timeout: the timeout to use in us, negative values wait forever
+ *
+ * Meant to be called after a non-blocking dequeue came back empty, waits
+ * according to the channel's wait mode: LIBERIO_WAIT_BLOCK sleeps in
+ * the backend (select() on a device), LIBERIO_WAIT_URING in
+ * io_uring_enter(), LIBERIO_WAIT_POLL
+ * keeps retrying the dequeue until the timeout expires and
+ * LIBERIO_WAIT_HYBRID does so for at most spin_us before going to sleep.
+ *
+ * Returns 0 on success, -EAGAIN on timeout or a negative error code.
+ */
+static int __liberio_chan_wait_dqbuf(struct liberio_chan *chan,
+				     struct usrp_buffer *breq,
+				     struct liberio_buf **bufp, int timeout)
+{
+	uint64_t now, spin_end, deadline = 0;
+	int64_t remaining = timeout;
+	int err;
+
+	if (timeout >= 0)
+		deadline = __liberio_get_time_us() + timeout;
+
+	if (chan->wait_mode == LIBERIO_WAIT_POLL
+	    || chan->wait_mode == LIBERIO_WAIT_HYBRID) {
+		now = __liberio_get_time_us();
+		if (chan->wait_mode == LIBERIO_WAIT_POLL)
+			spin_end = (timeout >= 0) ? deadline : UINT64_MAX;
+		else
+			spin_end = now + chan->spin_us;
+
+		if (timeout >= 0 && spin_end > deadline)
+			spin_end = deadline;
+
+		do {
+			err = __liberio_chan_dqbuf_req(chan, breq, bufp);
+			if (err != -EAGAIN)
+				return err;
+			cpu_relax();
+			now = __liberio_get_time_us();
+		} while (now < spin_end);
+
+		if (chan->wait_mode == LIBERIO_WAIT_POLL)
+			return -EAGAIN;
+
+		if (timeout >= 0)
+			remaining = (deadline > now) ? deadline - now : 0;
+	}
+
+	for (;;) {
+		err = __liberio_chan_wait(chan, remaining);
+		if (err < 0)
+			return err;
+		if (!err)
+			return -EAGAIN;
+
+		err = __liberio_chan_dqbuf_req(chan, breq, bufp);
+		if (err != -EAGAIN)
+			return err;
+
+		/* spurious wakeup, go back to sleep for what is left */
+		if (timeout >= 0) {
+			now = __liberio_get_time_us();
+			if (now >= deadline)
+				return -EAGAIN;
+			remaining = deadline - now;
+		}
+	}
+}
+
+struct liberio_buf *__liberio_chan_get_free(struct liberio_chan *chan)
+{
+	uint32_t idx;
+
+	// Only TX has a free ring (see liberio_chan_request_buffers)
+	if (!chan->free_ring)
+		return NULL;
+
+	while (!liberio_ring_pop(chan->free_ring, &idx)) {
+		if (likely(idx < chan->nbufs))
+			return chan->bufs + idx;
+
+		/* retired while it sat on the free list */
+		chan->bufs[idx].parked = 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * __liberio_chan_reset_free - Put all TX buffers back on the free list
+ * @chan: the liberio channel, must not be streaming
+ */
+void __liberio_chan_reset_free(struct liberio_chan *chan)
+{
+	uint32_t idx;
+	size_t i;
+
+	if (!chan->free_ring)
+		return;
+
+	while (!liberio_ring_pop(chan->free_ring, &idx))
+		;
+
+	for (i = 0; i < chan->nbufs; i++)
+		liberio_ring_push(chan->free_ring, i);
+}
+
+/*
+ * __liberio_chan_reap - Dequeue completed buffers from the driver
+ * @chan: the liberio channel to dequeue from
+ * @bufs: array that receives the dequeued buffers
+ * @max: size of @bufs
+ * @timeout: how long to wait for the first buffer in us, negative values
+ * wait forever
+ *
+ * Unlike liberio_chan_buf_dequeue_many() this never hands out buffers
+ * from the TX free list, everything it returns came back from the driver.
+ *
+ * Returns the number of dequeued buffers, 0 on timeout or a negative
+ * error code.
+ */
+int __liberio_chan_reap(struct liberio_chan *chan, struct liberio_buf **bufs,
+			size_t max, int timeout)
+{
+	struct usrp_buffer breq;
+	size_t n;
+	int err;
+
+	__liberio_chan_init_dqbuf_req(chan, &breq);
+
+	err = __liberio_chan_dqbuf_req(chan, &breq, bufs);
+	if (err == -EAGAIN && timeout)
+		err = __liberio_chan_wait_dqbuf(chan, &breq, bufs, timeout);
+	if (err)
+		return (err == -EAGAIN) ? 0 : err;
+
+	for (n = 1; n < max; n++)
+		if (__liberio_chan_dqbuf_req(chan, &breq, bufs + n))
+			break;
+
+	return n;
+}
+
+/*
+ * __liberio_chan_try_dequeue - Get a buffer without waiting
+ * @chan: the liberio channel to dequeue from
+ * @bufp: output for the buffer
+ *
+ * Hands out a buffer from the free list if there is one (TX only),
+ * otherwise tries to dequeue a completed one from the driver.
+ */
+int __liberio_chan_try_dequeue(struct liberio_chan *chan,
+			       struct liberio_buf **bufp)
+{
+	*bufp = __liberio_chan_get_free(chan);
+	if (*bufp)
+		return 0;
+
+	return __liberio_chan_dqbuf(chan, bufp);
+}
+
+/*
+ * liberio_buf_dequeue - Dequeue a buffer from the driver
+ * @chan: the liberio channel to dequeue from
+ * @timeout: the timeout to use in us
+ */
+struct liberio_buf *liberio_chan_buf_dequeue(struct liberio_chan *chan,
+					     int timeout)
+{
+	struct usrp_buffer breq;
+	struct liberio_buf *buf;
+	int err;
+
+	buf = __liberio_chan_get_free(chan);
+	if (buf)
+		return buf;
+
+	/* optimistically try to grab a buffer before going to sleep */
+	__liberio_chan_init_dqbuf_req(chan, &breq);
+
+	err = __liberio_chan_dqbuf_req(chan, &breq, &buf);
+	if (err == -EAGAIN && timeout) {
+		err = __liberio_chan_wait_dqbuf(chan, &breq, &buf, timeout);
+		if (err == -EAGAIN)
+			__liberio_stat_inc(chan, timeouts, 1);
+	}
+	if (err)
+		return NULL;
+
+	return buf;
+}
+
+/*
+ * liberio_chan_buf_dequeue_many - Dequeue a batch of buffers from the driver
+ * @chan: the liberio channel to dequeue from
+ * @bufs: array that receives the dequeued buffers
+ * @max: size of @bufs
+ * @min: number of buffers to wait for before returning
+ * @timeout: the deadline to use in us, negative values wait forever
+ *
+ * Sleeps until at least @min buffers have been dequeued or the deadline
+ * passed, and after every wakeup drains all completed buffers (up to @max)
+ * without going back to select() in between.
+ *
+ * Returns the number of dequeued buffers, which may be less than @min
+ * if the deadline passed, or a negative error code if none could be
+ * dequeued.
+ */
+int liberio_chan_buf_dequeue_many(struct liberio_chan *chan,
+				  struct liberio_buf **bufs, size_t max,
+				  size_t min, int timeout)
+{
+	struct usrp_buffer breq;
+	uint64_t deadline = 0;
+	int64_t remaining = timeout;
+	size_t n = 0;
+	int err;
+
+	if (min > max)
+		min = max;
+
+	while (n < max && (bufs[n] = __liberio_chan_get_free(chan)))
+		n++;
+
+	if (timeout > 0)
+		deadline = __liberio_get_time_us() + timeout;
+
+	__liberio_chan_init_dqbuf_req(chan, &breq);
+
+	while (n < max) {
+		err = __liberio_chan_dqbuf_req(chan, &breq, bufs + n);
+		if (!err) {
+			n++;
+			continue;
+		}
+
+		if (err != -EAGAIN)
+			return n ? n : err;
+
+		if (n >= min)
+			break;
+
+		if (timeout > 0) {
+			remaining = deadline - __liberio_get_time_us();
+			if (remaining < 0)
+				remaining = 0;
+		}
+
+		if (!remaining)
+			break;
+
+		err = __liberio_chan_wait_dqbuf(chan, &breq, bufs + n,
+						remaining);
+		if (!err) {
+			n++;
+			continue;
+		}
+
+		if (err != -EAGAIN)
+			return n ? n : err;
+
+		break;
+	}
+
+	if (n < min && timeout)
+		__liberio_stat_inc(chan, timeouts, 1);
+
+	return n;
+}
+
+/*
+ * liberio_chan_set_wait_mode - Select how dequeue waits for buffers
+ * @chan: the liberio channel
+ * @mode: LIBERIO_WAIT_BLOCK, LIBERIO_WAIT_POLL or LIBERIO_WAIT_HYBRID
+ * @spin_us: how long LIBERIO_WAIT_HYBRID busy-polls before sleeping
+ *
+ * Dequeue always tries a non-blocking USRPIOC_DQBUF first, the mode only
+ * decides what happens when no buffer is ready yet. LIBERIO_WAIT_URING
+ * needs io_uring support in the kernel, if it isn't there the channel
+ * keeps its current mode and an error is returned.
+ */
+int liberio_chan_set_wait_mode(struct liberio_chan *chan,
+			       enum liberio_wait_mode mode,
+			       unsigned int spin_us)
+{
+	int err;
+
+	if (mode < LIBERIO_WAIT_BLOCK || mode > LIBERIO_WAIT_URING)
+		return -EINVAL;
+
+	if (mode == LIBERIO_WAIT_URING && !chan->uring) {
+		err = __liberio_uring_init(chan);
+		if (err) {
+			ctx_warnx(chan->ctx, "io_uring not available (%d)", err);
+			return err;
+		}
+	} else if (mode != LIBERIO_WAIT_URING) {
+		__liberio_uring_free(chan);
+	}
+
+	chan->wait_mode = mode;
+	chan->spin_us = spin_us;
+
+	return 0;
+}
+
+/*
+ * liberio_chan_set_gap_callback - Get told about dropped RX buffers
+ * @chan: an RX channel
+ * @cb: called with the first missing and the received sequence number,
+ * NULL to only count gaps in the channel statistics
+ * @priv: passed to @cb
+ *
+ * Gaps are detected from the sequence number the driver reports on every
+ * DQBUF, @cb runs in the thread that dequeued the buffer after the gap.
+ */
+int liberio_chan_set_gap_callback(struct liberio_chan *chan,
+				  void (*cb)(struct liberio_chan *chan,
+					     uint32_t expected, uint32_t seq,
+					     void *priv),
+				  void *priv)
+{
+	if (chan->dir != RX)
+		return -EINVAL;
+
+	chan->gap_cb = cb;
+	chan->gap_priv = priv;
+
+	return 0;
+}
+
+int liberio_chan_get_fd(const struct liberio_chan *chan)
+{
+	return chan->fd;
+}
+
+/*
+ * liberio_buf_export() - Export usrp dma buffer as dmabuf fd
+ * that can be shared between processes
+ * @chan: context
+ * @buf: buffer
+ * @dmafd: dma file descriptor output
+ */
+int __liberio_chan_buf_export(struct liberio_chan *chan,
+			      struct liberio_buf *buf, int *dmafd)
+{
+	struct usrp_exportbuffer breq;
+	int err;
+
+	memset(&breq, 0, sizeof(breq));
+	breq.type = __to_buf_type(chan);
+	breq.index = buf->index;
+
+	err = chan->backend->expbuf(chan, &breq);
+	if (err) {
+		ctx_warn(chan->ctx, "failed to export buffer");
+		return err;
+	}
+
+	*dmafd = breq.fd;
+
+	return 0;
+}
+
+/*
+ * liberio_chan_export_pool() - Export all buffers of a channel and pass them
+ * to another process
+ * @chan: context
+ * @sockfd: AF_UNIX socket, see liberio_send_fds()
+ *
+ * The receiver gets one dmabuf fd per buffer from liberio_recv_fds(),
+ * together with the buffer index, length, port and direction.
+ */
+int liberio_chan_export_pool(struct liberio_chan *chan, int sockfd)
+{
+	struct liberio_fd_desc *descs;
+	int *fds;
+	size_t i, n = 0;
+	int err = -ENOMEM;
+
+	if (!chan->nbufs)
+		return -EINVAL;
+
+	fds = calloc(chan->nbufs, sizeof(*fds));
+	descs = calloc(chan->nbufs, sizeof(*descs));
+	if (!fds || !descs)
+		goto out_free;
+
+	for (n = 0; n < chan->nbufs; n++) {
+		err = __liberio_chan_buf_export(chan, chan->bufs + n, fds + n);
+		if (err)
+			goto out_close;
+
+		descs[n].index = chan->bufs[n].index;
+		descs[n].length = chan->bufs[n].len;
+		descs[n].port = chan->port;
+		descs[n].dir = chan->dir;
+	}
+
+	err = liberio_send_fds(sockfd, fds, descs, n);
+	if (err)
+		ctx_warn(chan->ctx, "failed to send buffer pool");
+
+out_close:
+	/* the receiver holds its own references now */
+	for (i = 0; i < n; i++)
+		close(fds[i]);
+out_free:
+	free(descs);
+	free(fds);
+
+	return err;
+}
+
+static void __liberio_chan_reclaim_all(struct liberio_chan *chan)
+{
+	size_t i;
+
+	__atomic_store_n(&chan->stats.queued, 0, __ATOMIC_RELAXED);
+
+	for (i = 0; i < chan->nbufs_alloc; i++)
+		chan->bufs[i].queued_us = 0;
+}
+
+int liberio_chan_start_streaming(struct liberio_chan *chan)
+{
+	uint64_t now;
+	size_t i;
+	int err;
+
+	err = chan->backend->streamon(chan);
+	if (err) {
+		__liberio_stat_inc(chan, ioctl_errors, 1);
+		return err;
+	}
+
+	/* the driver starts counting again */
+	chan->seq_valid = 0;
+
+	/* buffers queued up front only start their trip now */
+	now = __liberio_get_time_us();
+	for (i = 0; i < chan->nbufs; i++)
+		if (chan->bufs[i].queued_us)
+			chan->bufs[i].queued_us = now;
+
+	return 0;
 }
 
 int liberio_chan_stop_streaming(struct liberio_chan *chan)
 {
-	enum usrp_buf_type type = __to_buf_type(chan);
+	int err;
+
+	err = chan->backend->streamoff(chan);
+	if (err)
+		__liberio_stat_inc(chan, ioctl_errors, 1);
+	else
+		/* the driver gave back everything it had */
+		__liberio_chan_reclaim_all(chan);
+
+	return err;
+}
+
+/*
+ * liberio_chan_get_stats - Take a snapshot of the channel statistics
+ * @chan: the liberio channel
+ * @stats: output for the snapshot
+ *
+ * Counters are read one by one while the I/O paths keep updating them,
+ * so the snapshot is not a consistent cut across all fields.
+ */
+void liberio_chan_get_stats(const struct liberio_chan *chan,
+			    struct liberio_chan_stats *stats)
+{
+	const struct liberio_chan_counters *c = &chan->stats;
+
+	stats->enqueued = __atomic_load_n(&c->enqueued, __ATOMIC_RELAXED);
+	stats->dequeued = __atomic_load_n(&c->dequeued, __ATOMIC_RELAXED);
+	stats->bytes = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+	stats->timeouts = __atomic_load_n(&c->timeouts, __ATOMIC_RELAXED);
+	stats->wait_errors = __atomic_load_n(&c->wait_errors, __ATOMIC_RELAXED);
+	stats->ioctl_errors = __atomic_load_n(&c->ioctl_errors,
+					      __ATOMIC_RELAXED);
+	stats->gaps = __atomic_load_n(&c->gaps, __ATOMIC_RELAXED);
+	stats->lost = __atomic_load_n(&c->lost, __ATOMIC_RELAXED);
+	stats->queued = __atomic_load_n(&c->queued, __ATOMIC_RELAXED);
+	stats->queued_max = __atomic_load_n(&c->queued_max, __ATOMIC_RELAXED);
+	stats->queued_min = __atomic_load_n(&c->queued_min, __ATOMIC_RELAXED);
+
+	/* no dequeue since the last reset */
+	if (stats->queued_min == UINT64_MAX)
+		stats->queued_min = stats->queued;
+
+	stats->free = chan->free_ring ? liberio_ring_count(chan->free_ring) : 0;
+}
+
+/*
+ * liberio_chan_reset_stats - Zero the channel counters
+ * @chan: the liberio channel
+ *
+ * The high and low water marks restart from the current number of
+ * buffers with the driver.
+ */
+void liberio_chan_reset_stats(struct liberio_chan *chan)
+{
+	struct liberio_chan_counters *c = &chan->stats;
+
+	__atomic_store_n(&c->enqueued, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->dequeued, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->bytes, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->timeouts, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->wait_errors, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->ioctl_errors, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->gaps, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->lost, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->queued_max,
+			 __atomic_load_n(&c->queued, __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&c->queued_min, UINT64_MAX, __ATOMIC_RELAXED);
+
+	__liberio_hist_reset(&chan->latency);
+}
+
+/*
+ * liberio_chan_get_latency_stats - Summarize the buffer turnaround
+ * @chan: the liberio channel
+ * @stats: output for the summary
+ *
+ * Turnaround is the time from handing a buffer to the driver, or from
+ * STREAMON for buffers queued before it, to the completion timestamp the
+ * driver reports on DQBUF. Percentiles are accurate to within 1/16.
+ */
+void liberio_chan_get_latency_stats(const struct liberio_chan *chan,
+				    struct liberio_latency_stats *stats)
+{
+	const struct liberio_hist *hist = &chan->latency;
+
+	stats->count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+	if (!stats->count) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
 
-	return liberio_ioctl(chan->fd, USRPIOC_STREAMOFF, (void *)type);
+	stats->min_us = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+	stats->max_us = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	stats->mean_us = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED)
+		/ stats->count;
+	stats->p50_us = __liberio_hist_percentile(hist, 50.0);
+	stats->p90_us = __liberio_hist_percentile(hist, 90.0);
+	stats->p99_us = __liberio_hist_percentile(hist, 99.0);
+	stats->p999_us = __liberio_hist_percentile(hist, 99.9);
+}
+
+/*
+ * liberio_chan_get_latency_percentile - Get a turnaround percentile
+ * @chan: the liberio channel
+ * @percentile: 0 to 100
+ *
+ * Returns the turnaround in us, 0 if no buffer completed yet.
+ */
+uint64_t liberio_chan_get_latency_percentile(const struct liberio_chan *chan,
+					     double percentile)
+{
+	return __liberio_hist_percentile(&chan->latency, percentile);
 }
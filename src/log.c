@@ -182,6 +182,13 @@ log_warn(const char *token, const char *emsg, ...)
 	}
 }
 
+/* emit an already formatted message, the caller did the filtering */
+void
+log_str(int pri, const char *token, const char *msg)
+{
+	logit(pri, token, "%s", msg);
+}
+
 void
 log_warnx(const char *token, const char *emsg, ...)
 {
@@ -28,6 +28,8 @@ void             log_debug(const char *, const char *, ...) __attribute__ ((form
 void             fatal(const char*, const char *) __attribute__((__noreturn__));
 void             fatalx(const char *) __attribute__((__noreturn__));
 
+void             log_str(int, const char *, const char *);
+
 void		 log_register(void (*cb)(int, const char*, void*), void*);
 void             log_accept(const char *);
 
@@ -13,45 +13,227 @@
 #define LIBERIO_PRIV_H
 
 #include <pthread.h>
+#include <sys/types.h>
 #include <liberio/liberio.h>
 #include "kernel.h"
+#include "hist.h"
+
+/* longest sysattr value handed out without libudev */
+#define LIBERIO_SYSATTR_LEN	256
+
+/* ports below this are looked up in a table, see liberio-registry.c */
+#define LIBERIO_REG_PORTS	256
 
 struct liberio_ctx {
+#ifdef LIBERIO_HAVE_UDEV
 	struct udev *udev;
+#endif
 	struct ref refcnt;
+
+	/* what new channels talk to, the emulator state if that's it */
+	const struct liberio_backend_ops *backend;
+	struct liberio_emu *emu;
+
+	/* see clog.h, priorities above log_level cost a single compare */
+	int log_level;
+	void (*log_cb)(int, const char *, void *);
+	void *log_priv;
+	struct liberio_log *log;
+
+	/* protects the open channels and the device registry */
+	pthread_mutex_t lock;
+	struct list_head chans;
+	struct liberio_chan *chan_by_port[2][LIBERIO_REG_PORTS];
+	struct liberio_registry *reg;
+};
+
+/* liberio_chan_resize_buffers() asking a backend for @count more buffers */
+struct liberio_create_bufs {
+	uint32_t index;		/* out: first new buffer */
+	uint32_t count;		/* in: wanted, out: created */
+	uint32_t memory;	/* enum usrp_memory */
+	uint32_t type;		/* enum usrp_buf_type */
+};
+
+/*
+ * struct liberio_backend_ops - What a channel's requests go to
+ *
+ * The request hooks follow ioctl() conventions: 0 on success or -1 with
+ * errno set. open() sets up fd, fd_events, port and max_bufs, the API
+ * version if there is one, fd must poll ready with fd_events whenever
+ * dqbuf() has a buffer. create_bufs() is optional, the USRP DMA driver
+ * has no way to add buffers to an existing pool.
+ */
+struct liberio_backend_ops {
+	const char *name;
+	int (*open)(struct liberio_chan *chan, const char *file);
+	void (*close)(struct liberio_chan *chan);
+	int (*reqbufs)(struct liberio_chan *chan,
+		       struct usrp_requestbuffers *req);
+	int (*create_bufs)(struct liberio_chan *chan,
+			   struct liberio_create_bufs *create);
+	int (*querybuf)(struct liberio_chan *chan, struct usrp_buffer *breq);
+	int (*qbuf)(struct liberio_chan *chan, struct usrp_buffer *breq);
+	int (*dqbuf)(struct liberio_chan *chan, struct usrp_buffer *breq);
+	int (*streamon)(struct liberio_chan *chan);
+	int (*streamoff)(struct liberio_chan *chan);
+	int (*expbuf)(struct liberio_chan *chan,
+		      struct usrp_exportbuffer *breq);
+	int (*set_fmt)(struct liberio_chan *chan, struct usrp_fmt *fmt);
+	void *(*mmap)(struct liberio_chan *chan, size_t len, off_t offset);
+	/* > 0 if ready, 0 on timeout or a negative error code */
+	int (*wait)(struct liberio_chan *chan, int timeout);
 };
 
+extern const struct liberio_backend_ops __liberio_backend_dev;
+extern const struct liberio_backend_ops __liberio_backend_emu;
+
 struct liberio_buf {
 	uint32_t index;
 	void *mem;
 	size_t len;
 	size_t valid_bytes;
-	struct list_head node;
+
+	/* retired by a shrink and back with the library */
+	int parked;
+
+	/* when it was last handed to the driver, 0 if it isn't there */
+	uint64_t queued_us;
+
+	/* as reported by the driver on DQBUF */
+	uint64_t timestamp_us;
+	uint32_t sequence;
+
+	/* USRP_MEMORY_DMABUF only */
+	int fd;
+	int sync;
 };
 
 struct liberio_chan;
 
+/*
+ * struct liberio_buf_ops - Memory type specific buffer handling
+ *
+ * @pool_init: Optional, called with the index of the first buffer and the
+ *             number of buffers before a range of buffers gets initialized
+ * @pool_release: Optional, called after all buffers got released
+ * @init: Set up a single buffer
+ * @release: Tear down a single buffer
+ */
 struct liberio_buf_ops {
+	int (*pool_init)(struct liberio_chan *, size_t, size_t);
+	void (*pool_release)(struct liberio_chan *);
 	int (*init)(struct liberio_chan *, struct liberio_buf *, size_t);
 	void (*release)(struct liberio_buf *);
 };
 
+struct liberio_arena {
+	void *mem;
+	size_t len;
+	size_t stride;
+	const char *backing;
+
+	/* range of buffer indices carved out of this arena */
+	size_t first;
+	size_t count;
+	struct list_head node;
+};
+
+struct liberio_engine {
+	struct liberio_chan *chan;
+	struct liberio_engine_attr attr;
+
+	pthread_t thread;
+	int running;
+
+	/* filled buffers for the application, returned ones for the driver */
+	struct liberio_spsc *ready;
+	struct liberio_spsc *done;
+
+	/* engine only, buffers the driver refused, retried first */
+	uint32_t *retry;
+	size_t nretry;
+	int retry_warned;
+
+	/* eventfds and flags to wake up a sleeping side */
+	int ready_efd;
+	int done_efd;
+	int app_waiting;
+	int engine_waiting;
+
+	uint64_t delivered;
+	uint64_t submitted;
+	uint64_t overflows;
+};
+
+/*
+ * struct liberio_chan_counters - Statistics kept on the I/O paths
+ *
+ * Updated with relaxed atomics so a snapshot can be taken from any
+ * thread. queued counts the buffers the driver holds, a STREAMOFF takes
+ * all of them back.
+ */
+struct liberio_chan_counters {
+	uint64_t enqueued;
+	uint64_t dequeued;
+	uint64_t bytes;
+	uint64_t timeouts;
+	uint64_t wait_errors;
+	uint64_t ioctl_errors;
+	uint64_t gaps;
+	uint64_t lost;
+	uint64_t queued;
+	uint64_t queued_max;
+	uint64_t queued_min;
+};
+
 struct liberio_chan {
 	struct liberio_ctx *ctx;
 
 	int port;
 
-	pthread_spinlock_t lock;
+	/* read from sysfs once at open, -ENOENT if there is no such attribute */
+	int api_maj;
+	int api_min;
+
+	/* on the context's list of open channels */
 	struct list_head node;
 
+	/* character device behind fd, 0 if the backend has none */
+	dev_t devnum;
+#ifdef LIBERIO_HAVE_UDEV
+	/* created on the first __liberio_chan_get_sysattr() */
 	struct udev_device *dev;
+#else
+	char sysattr[LIBERIO_SYSATTR_LEN];
+#endif
+
+	const struct liberio_backend_ops *backend;
+	void *backend_priv;
 
 	int fd;
+	short fd_events;
 	enum liberio_direction dir;
 
+	/*
+	 * bufs has room for max_bufs descriptors, nbufs_alloc of them exist
+	 * in the driver and the first nbufs are in use
+	 */
 	struct liberio_buf *bufs;
 	size_t nbufs;
-	struct list_head free_bufs;
+	size_t nbufs_alloc;
+	size_t max_bufs;
+
+	/* TX only, indices of buffers owned by the application */
+	struct liberio_ring *free_ring;
+
+	/* USERPTR buffer size and backing memory */
+	size_t buf_size;
+	struct list_head arenas;
+
+	/* USERPTR address -> descriptor lookup table */
+	struct liberio_buf **addr_index;
+	unsigned int addr_index_bits;
 
 	struct ref refcnt;
 
@@ -59,9 +241,91 @@ struct liberio_chan {
 
 	enum usrp_memory mem_type;
 
+	/* QBUF request with the per channel fields filled in */
+	struct usrp_buffer qbuf_tmpl;
+
 	int fix_broken_chdr;
+
+	enum liberio_wait_mode wait_mode;
+	unsigned int spin_us;
+
+	struct liberio_engine *engine;
+
+	/* set up for LIBERIO_WAIT_URING */
+	struct liberio_uring *uring;
+
+	/* liberio_chan_run() callbacks, only one is set depending on dir */
+	int (*rx_cb)(struct liberio_chan *chan, struct liberio_buf *buf,
+		     void *priv);
+	int (*tx_fill_cb)(struct liberio_chan *chan, struct liberio_buf *buf,
+			  void *priv);
+	void *cb_priv;
+	int run_stop;
+
+	/* RX sequence number expected next, valid once one was seen */
+	uint32_t next_seq;
+	int seq_valid;
+	void (*gap_cb)(struct liberio_chan *chan, uint32_t expected,
+		       uint32_t seq, void *priv);
+	void *gap_priv;
+
+	struct liberio_chan_counters stats;
+
+	/* enqueue to driver completion time in us */
+	struct liberio_hist latency;
+};
+
+struct liberio_poller {
+	struct liberio_ctx *ctx;
+
+	int epfd;
+
+	pthread_spinlock_t lock;
+	struct list_head chans;
+
+	struct ref refcnt;
 };
 
+size_t __liberio_hugepage_size(void);
+
+int __liberio_userptr_index_build(struct liberio_chan *chan);
+
+void __liberio_userptr_index_free(struct liberio_chan *chan);
+
+struct liberio_buf *__liberio_userptr_index_lookup(struct liberio_chan *chan,
+						   unsigned long addr,
+						   size_t len);
+
+void __liberio_dmabuf_sync(struct liberio_buf *buf, unsigned int flags);
+
+int __liberio_chan_dqbuf(struct liberio_chan *chan, struct liberio_buf **bufp);
+
+uint64_t __liberio_get_time_us(void);
+
+void __liberio_emu_free(struct liberio_emu *emu);
+
+void __liberio_registry_add_chan(struct liberio_chan *chan);
+
+void __liberio_registry_del_chan(struct liberio_chan *chan);
+
+void __liberio_registry_free(struct liberio_ctx *ctx);
+
+int __liberio_uring_init(struct liberio_chan *chan);
+
+void __liberio_uring_free(struct liberio_chan *chan);
+
+int __liberio_uring_wait(struct liberio_chan *chan, int timeout);
+
+struct liberio_buf *__liberio_chan_get_free(struct liberio_chan *chan);
+
+void __liberio_chan_reset_free(struct liberio_chan *chan);
+
+int __liberio_chan_reap(struct liberio_chan *chan, struct liberio_buf **bufs,
+			size_t max, int timeout);
+
+int __liberio_chan_try_dequeue(struct liberio_chan *chan,
+			       struct liberio_buf **bufp);
+
 static inline enum usrp_buf_type __to_buf_type(struct liberio_chan *chan)
 {
 	return (chan->dir == TX) ? USRP_BUF_TYPE_OUTPUT : USRP_BUF_TYPE_INPUT;
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2017, National Instruments Corp.
+ *
+ * "That dude over there just punched Merica into that guy,
+ *  he must be a Liberio!"
+ * 	- Urban Dictionary
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#ifndef LIBERIO_RING_H
+#define LIBERIO_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
+
+#define LIBERIO_CACHELINE 64
+
+/*
+ * struct liberio_ring - Bounded lock-free MPMC queue of buffer indices
+ *
+ * Dmitry Vyukov's bounded queue: every cell carries a sequence number
+ * that tells producers and consumers whether it is theirs to use, so
+ * head and tail only ever get advanced with a single CAS and nobody
+ * spins on a lock. Head and tail live on separate cache lines so
+ * producers and consumers don't bounce each other's line.
+ *
+ * A cell claimed by a push or pop that hasn't finished yet looks like a
+ * full (or empty) ring to the other side. Only give up if head and tail
+ * agree, otherwise wait for the other thread to finish. The free list
+ * always holds all buffers it can, so reporting full there would lose
+ * one.
+ *
+ * @mask: size - 1, size is a power of two
+ * @cells: the slots
+ * @head: next position to push to
+ * @tail: next position to pop from
+ */
+struct liberio_ring_cell {
+	uint32_t seq;
+	uint32_t val;
+};
+
+struct liberio_ring {
+	uint32_t mask;
+	struct liberio_ring_cell *cells;
+
+	uint32_t head __attribute__((aligned(LIBERIO_CACHELINE)));
+	uint32_t tail __attribute__((aligned(LIBERIO_CACHELINE)));
+} __attribute__((aligned(LIBERIO_CACHELINE)));
+
+struct liberio_ring *__liberio_ring_new(size_t size);
+
+void __liberio_ring_free(struct liberio_ring *ring);
+
+/* returns 0 on success, -1 if the ring is full */
+static inline int liberio_ring_push(struct liberio_ring *ring, uint32_t val)
+{
+	struct liberio_ring_cell *cell;
+	uint32_t pos, seq;
+	int32_t dif;
+
+	pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = ring->cells + (pos & ring->mask);
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		dif = (int32_t)(seq - pos);
+
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&ring->head, &pos,
+							pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			if (pos - __atomic_load_n(&ring->tail,
+						  __ATOMIC_RELAXED) > ring->mask)
+				return -1;
+			/* a pop of this cell is still under way */
+			sched_yield();
+			pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->val = val;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* returns 0 on success, -1 if the ring is empty */
+static inline int liberio_ring_pop(struct liberio_ring *ring, uint32_t *val)
+{
+	struct liberio_ring_cell *cell;
+	uint32_t pos, seq;
+	int32_t dif;
+
+	pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = ring->cells + (pos & ring->mask);
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		dif = (int32_t)(seq - (pos + 1));
+
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&ring->tail, &pos,
+							pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			if (pos == __atomic_load_n(&ring->head, __ATOMIC_RELAXED))
+				return -1;
+			/* a push to this cell is still under way */
+			sched_yield();
+			pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	*val = cell->val;
+	__atomic_store_n(&cell->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * number of queued values, only a hint while others push or pop: the
+ * two loads aren't a snapshot, so clamp the difference to the ring size
+ */
+static inline size_t liberio_ring_count(struct liberio_ring *ring)
+{
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	int32_t n = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) - tail;
+
+	if (n < 0)
+		return 0;
+	if ((uint32_t)n > ring->mask + 1)
+		return ring->mask + 1;
+
+	return n;
+}
+
+/*
+ * struct liberio_spsc - Bounded lock-free single producer, single
+ * consumer queue of buffer indices
+ *
+ * Cheaper than struct liberio_ring when only one thread pushes and one
+ * thread pops, plain loads and stores with acquire/release ordering and
+ * no CAS. Each side keeps a cached copy of the other side's index so it
+ * only touches the shared cache line when the cached copy says the ring
+ * is full (or empty).
+ *
+ * @mask: size - 1, size is a power of two
+ * @vals: the slots
+ * @head: next position to push to, written by the producer
+ * @tail_cache: producer's copy of tail
+ * @tail: next position to pop from, written by the consumer
+ * @head_cache: consumer's copy of head
+ */
+struct liberio_spsc {
+	uint32_t mask;
+	uint32_t *vals;
+
+	uint32_t head __attribute__((aligned(LIBERIO_CACHELINE)));
+	uint32_t tail_cache;
+
+	uint32_t tail __attribute__((aligned(LIBERIO_CACHELINE)));
+	uint32_t head_cache;
+} __attribute__((aligned(LIBERIO_CACHELINE)));
+
+struct liberio_spsc *__liberio_spsc_new(size_t size);
+
+void __liberio_spsc_free(struct liberio_spsc *ring);
+
+/* returns 0 on success, -1 if the ring is full */
+static inline int liberio_spsc_push(struct liberio_spsc *ring, uint32_t val)
+{
+	uint32_t head = ring->head;
+
+	if (head - ring->tail_cache > ring->mask) {
+		ring->tail_cache = __atomic_load_n(&ring->tail,
+						   __ATOMIC_ACQUIRE);
+		if (head - ring->tail_cache > ring->mask)
+			return -1;
+	}
+
+	ring->vals[head & ring->mask] = val;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* returns 0 on success, -1 if the ring is empty */
+static inline int liberio_spsc_pop(struct liberio_spsc *ring, uint32_t *val)
+{
+	uint32_t tail = ring->tail;
+
+	if (tail == ring->head_cache) {
+		ring->head_cache = __atomic_load_n(&ring->head,
+						   __ATOMIC_ACQUIRE);
+		if (tail == ring->head_cache)
+			return -1;
+	}
+
+	*val = ring->vals[tail & ring->mask];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* consumer side only */
+static inline int liberio_spsc_empty(struct liberio_spsc *ring)
+{
+	return ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+#endif /* LIBERIO_RING_H */
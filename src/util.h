@@ -12,21 +12,37 @@
 #ifndef LIBERIO_UTIL_H
 #define LIBERIO_UTIL_H
 
+#include <sys/types.h>
+
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
 
-struct udev_device;
-struct udev;
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+int __liberio_sysfs_read(dev_t devnum, const char *attr, char *buf,
+			 size_t len);
+
+int __liberio_sysfs_read_int(dev_t devnum, const char *attr);
+
+int __liberio_port_from_name(const char *name);
 
-struct udev_device *liberio_udev_device_from_fd(struct udev *udev,
-						int fd);
+int __liberio_sysfs_write(dev_t devnum, const char *attr, const char *value);
 
-int liberio_ioctl(int fd, unsigned long req, void *arg);
+int __liberio_ioctl(int fd, unsigned long req, void *arg);
 
-const char *liberio_chan_get_sysattr(struct liberio_chan *chan,
-				     const char *sysattr);
+const char *__liberio_chan_get_sysattr(struct liberio_chan *chan,
+				       const char *sysattr);
 
-int liberio_chan_set_sysattr(struct liberio_chan *chan, const char *sysattr,
-			     char *value);
+int __liberio_chan_set_sysattr(struct liberio_chan *chan, const char *sysattr,
+			       char *value);
 
 #endif /* LIBERIO_UTIL_H */